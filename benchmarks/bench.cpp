@@ -0,0 +1,225 @@
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/ext/matrix_clip_space.hpp"
+#include "ivy_log.h"
+#include "ivy_thread.h"
+#include "ivy_time.h"
+#include "client/client.h"
+#include "client/utils/cpu_tracer.h"
+#include "client/utils/region_manager.h"
+#include "client/utils/traversal_profiler.h"
+#include "client/utils/step_histogram.h"
+#include "client/utils/wide_tree.h"
+#include "server/server.h"
+#include "server/generators/file_generator.h"
+#include "server/generators/procedural_generator.h"
+
+/**
+ * Headless benchmark: builds a region with the server generator, then flies a CPU tracer along a fixed camera path and writes the
+ * timings as JSON, so that two commits can be compared without opening a window.
+ *
+ * Usage: iVy_bench [--output bench.json] [--frames 64] [--resolution 640x360] [--threads 0] [--scalar] [--deduplicate] [--lod 0]
+ *                  [--dda-limit 0] [--tree-limit 0] [--profile-cache] [--save-archive] [--generation-speedup]
+ *
+ * With --deduplicate, the region is turned into a DAG once compacted, see WideTree::deduplicate. With --lod, rays stop going down the
+ * tree once the nodes they hit are no wider than the given number of pixels, see CpuTracer::set_lod_cone. With --dda-limit and --tree-limit,
+ * rays stop once out of budget, see CpuTracer::set_step_limits. The steps of every pixel are reported as a histogram. With
+ * --profile-cache, the cache misses of the region layout are reported before and after its compaction, see profile_traversal. With
+ * --save-archive, the region is saved as a region archive in IVY_REGION_ARCHIVE_DIRECTORY, from which the server then streams it. With
+ * --generation-speedup, the region is also generated procedurally on one thread then on as many threads as the tracer, and the speedup
+ * between both runs is reported.
+ */
+
+namespace {
+    struct Keyframe {
+        glm::vec3 position, direction;
+    };
+
+    /**
+     * The camera path, starting from the position client.cpp forces for benchmarking. Frames are spread evenly over it, and the
+     * camera is interpolated linearly between keyframes.
+     */
+    const Keyframe camera_path[] = {
+            {{600, 550, 600},                                  {0.5099, -0.70, 0.5101}},
+            {{IVY_REGION_WIDTH / 2, 450, IVY_REGION_WIDTH / 4}, {0.0, -0.45, 1.0}},
+            {{IVY_REGION_WIDTH * 3 / 4, 300, IVY_REGION_WIDTH / 2}, {-0.6, -0.2, 0.6}},
+            {{IVY_REGION_WIDTH / 2, 900, IVY_REGION_WIDTH * 3 / 4}, {-0.5, -0.9, -0.5}},
+    };
+    const int keyframe_count = sizeof(camera_path) / sizeof(Keyframe);
+
+    Keyframe camera_at(int frame, int frame_count) {
+        float t = frame_count > 1 ? float(frame) / float(frame_count - 1) * float(keyframe_count - 1) : 0.0f;
+        int i = std::min(int(t), keyframe_count - 2);
+        float f = t - float(i);
+        return {camera_path[i].position * (1.0f - f) + camera_path[i + 1].position * f,
+                glm::normalize(camera_path[i].direction * (1.0f - f) + camera_path[i + 1].direction * f)};
+    }
+
+    struct FrameResult {
+        double duration_ms;
+        client::utils::TraceStats stats;
+    };
+}
+
+int main(int argc, char **argv) {
+    std::string output = "bench.json";
+    int frame_count = 64, width = 640, height = 360, thread_count = 0, dda_step_limit = 0, tree_step_limit = 0;
+    float lod_pixel_size = 0.0f;
+    bool use_packets = true, is_deduplicated = false, is_cache_profiled = false, is_archive_saved = false, is_speedup_measured = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--output") && i + 1 < argc) output = argv[++i];
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc) frame_count = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--resolution") && i + 1 < argc && sscanf(argv[++i], "%dx%d", &width, &height) == 2) continue;
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) thread_count = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--scalar")) use_packets = false;
+        else if (!strcmp(argv[i], "--deduplicate")) is_deduplicated = true;
+        else if (!strcmp(argv[i], "--lod") && i + 1 < argc) lod_pixel_size = std::max(0.0f, float(atof(argv[++i])));
+        else if (!strcmp(argv[i], "--dda-limit") && i + 1 < argc) dda_step_limit = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tree-limit") && i + 1 < argc) tree_step_limit = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--profile-cache")) is_cache_profiled = true;
+        else if (!strcmp(argv[i], "--save-archive")) is_archive_saved = true;
+        else if (!strcmp(argv[i], "--generation-speedup")) is_speedup_measured = true;
+        else {
+            error("Usage: %s [--output bench.json] [--frames 64] [--resolution 640x360] [--threads 0] [--scalar] [--deduplicate] [--lod 0] "
+                  "[--dda-limit 0] [--tree-limit 0] [--profile-cache] [--save-archive] [--generation-speedup]", argv[0]);
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0) {
+        error("Invalid resolution %dx%d", width, height);
+        return 1;
+    }
+    thread_count = thread_count_or_default(thread_count);
+
+    server::start();
+    client::memory_pool = new FastMemoryPool(client::utils::RegionManager::get_pool_size(0));
+
+    // Generating the region on one thread then on several, in scratch views whose blocks are then reused by the world view
+    double single_thread_ms = 0, multi_thread_ms = 0;
+    if (is_speedup_measured) {
+        for (int generator_thread_count: {1, thread_count}) {
+            server::ProceduralGenerator generator(generator_thread_count);
+            auto *scratch_view = new client::utils::WideTree();
+            auto t0 = time_us();
+            generator.generate_view(0, 0, 0, *scratch_view);
+            (generator_thread_count == 1 ? single_thread_ms : multi_thread_ms) = double(time_us() - t0) / 1e3;
+            delete scratch_view;
+        }
+        info("Generation speedup: %.2fx on %d threads (%.2f ms on one thread, %.2f ms on %d), %.0f%% parallel efficiency",
+             single_thread_ms / multi_thread_ms, thread_count, single_thread_ms, multi_thread_ms, thread_count,
+             100.0 * single_thread_ms / multi_thread_ms / thread_count);
+    }
+
+    // Building the world view the same way the baseline renderer does
+    auto *view = new client::utils::WideTree();
+    auto t0 = time_us();
+    server::world_generator->generate_view(0, 0, 0, *view);
+    double generation_ms = double(time_us() - t0) / 1e3;
+    client::utils::TraversalStats cache_before, cache_after;
+    if (is_cache_profiled) cache_before = client::utils::profile_traversal(*view);
+    t0 = time_us();
+    view->compact();
+    double compaction_ms = double(time_us() - t0) / 1e3;
+    info("Built world view in %.2f ms (%.2f ms of compaction)", generation_ms + compaction_ms, compaction_ms);
+    if (is_cache_profiled) {
+        cache_after = client::utils::profile_traversal(*view);
+        client::utils::log_traversal_stats("Traversal before compaction", cache_before);
+        client::utils::log_traversal_stats("Traversal after compaction", cache_after);
+    }
+    if (is_archive_saved) {
+        std::filesystem::create_directories(IVY_REGION_ARCHIVE_DIRECTORY);
+        std::string path = server::FileGenerator(IVY_REGION_ARCHIVE_DIRECTORY).get_region_path(0, 0, 0);
+        if (!view->save_archive(path.c_str())) fatal("Could not write the region archive %s", path.c_str());
+        info("Saved the region archive %s", path.c_str());
+    }
+    size_t deduplicated_bytes = 0;
+    double deduplication_ms = 0;
+    if (is_deduplicated) {
+        t0 = time_us();
+        deduplicated_bytes = view->deduplicate();
+        deduplication_ms = double(time_us() - t0) / 1e3;
+        info("Deduplicated world view in %.2f ms, saving %.2f MiB", deduplication_ms, (double) deduplicated_bytes / 1024.0 / 1024.0);
+    }
+
+    // Flying along the camera path
+    client::utils::CpuTracer tracer(*view);
+    client::utils::CpuImage image{width, height, {}, {}};
+    glm::mat4 projection_matrix = glm::perspective(glm::radians(80.0f), float(width) / float(height), 0.1f, 100.0f);
+    tracer.set_lod_cone(client::utils::CpuTracer::get_lod_cone(projection_matrix, height, lod_pixel_size));
+    tracer.set_step_limits(dda_step_limit, tree_step_limit);
+    std::vector<FrameResult> frames;
+    client::utils::TraceStats total;
+    client::utils::StepHistogram step_histogram;
+    double total_ms = 0;
+    for (int frame = 0; frame < frame_count; frame++) {
+        Keyframe camera = camera_at(frame, frame_count);
+        glm::vec3 right = glm::normalize(glm::cross(camera.direction, glm::vec3{0, 1, 0}));
+        glm::mat4 view_matrix = glm::lookAt(camera.position, camera.position + camera.direction, glm::normalize(glm::cross(camera.direction, right)));
+        t0 = time_us();
+        auto stats = tracer.render(image, camera.position, view_matrix, projection_matrix, use_packets, thread_count);
+        double duration_ms = double(time_us() - t0) / 1e3;
+        frames.push_back({duration_ms, stats});
+        step_histogram.add(image.step_counts.data(), image.step_counts.size());
+        total += stats;
+        total_ms += duration_ms;
+    }
+    info("Rendered %d frames at %dx%d in %.2f ms (%.2f Mrays/s, %.2f node visits and %.2f DDA steps per ray, %.1f%% of rays stopped at LOD)",
+         frame_count, width, height, total_ms, double(total.ray_count) / total_ms / 1e3, double(total.node_visits) / double(total.ray_count),
+         double(total.dda_steps) / double(total.ray_count), double(total.lod_hit_count) / double(total.ray_count) * 100.0);
+    info("Steps per pixel: %u median, %u at the 99th percentile, %u at most, %lu rays out of budget", step_histogram.get_percentile(50),
+         step_histogram.get_percentile(99), step_histogram.max_steps, total.truncated_count);
+
+    // Writing the results
+    FILE *file = fopen(output.c_str(), "w");
+    if (!file) fatal("Could not open %s for writing", output.c_str());
+    fprintf(file, "{\n");
+    fprintf(file, "  \"resolution\": [%d, %d],\n", width, height);
+    fprintf(file, "  \"threads\": %d,\n", thread_count);
+    fprintf(file, "  \"packets\": %s,\n", use_packets && client::utils::CpuTracer::has_packet_support() ? "true" : "false");
+    fprintf(file, "  \"region_width\": %ld,\n", IVY_REGION_WIDTH);
+    fprintf(file, "  \"lod_pixel_size\": %.3f,\n", lod_pixel_size);
+    fprintf(file, "  \"step_limits\": {\"dda\": %d, \"tree\": %d},\n", std::max(0, dda_step_limit), std::max(0, tree_step_limit));
+    fprintf(file, "  \"generation_ms\": %.3f,\n", generation_ms);
+    fprintf(file, "  \"compaction_ms\": %.3f,\n", compaction_ms);
+    if (is_speedup_measured) {
+        fprintf(file, "  \"generation_speedup\": {\"threads\": %d, \"single_thread_ms\": %.3f, \"multi_thread_ms\": %.3f, \"speedup\": %.3f, "
+                      "\"parallel_efficiency\": %.3f},\n", thread_count, single_thread_ms, multi_thread_ms, single_thread_ms / multi_thread_ms,
+                single_thread_ms / multi_thread_ms / thread_count);
+    }
+    if (is_cache_profiled) {
+        fprintf(file, "  \"cache_profile\": {\"before_compaction\": %s, \"after_compaction\": %s},\n", cache_before.to_json().c_str(),
+                cache_after.to_json().c_str());
+    }
+    if (is_deduplicated) fprintf(file, "  \"deduplication\": {\"duration_ms\": %.3f, \"saved_bytes\": %zu},\n", deduplication_ms, deduplicated_bytes);
+    fprintf(file, "  \"memory_pool\": {\"size\": %zu, \"allocated\": %zu, \"used\": %zu},\n", client::memory_pool->size(),
+            client::memory_pool->allocated(), client::memory_pool->used());
+    fprintf(file, "  \"memory_pool_stats\": %s,\n", client::memory_pool->get_stats().to_json().c_str());
+    fprintf(file, "  \"total\": {\"duration_ms\": %.3f, \"rays\": %lu, \"rays_per_second\": %.1f, \"node_visits_per_ray\": %.4f, "
+                  "\"dda_steps_per_ray\": %.4f, \"hit_rate\": %.4f, \"lod_hit_rate\": %.4f},\n", total_ms, total.ray_count,
+            double(total.ray_count) / total_ms * 1e3, double(total.node_visits) / double(total.ray_count), double(total.dda_steps) / double(total.ray_count),
+            double(total.hit_count) / double(total.ray_count), double(total.lod_hit_count) / double(total.ray_count));
+    fprintf(file, "  \"step_histogram\": %s,\n", step_histogram.to_json().c_str());
+    fprintf(file, "  \"truncated_rate\": %.6f,\n", double(total.truncated_count) / double(total.ray_count));
+    fprintf(file, "  \"frames\": [\n");
+    for (int frame = 0; frame < frame_count; frame++) {
+        const FrameResult &result = frames[frame];
+        Keyframe camera = camera_at(frame, frame_count);
+        fprintf(file, "    {\"position\": [%.2f, %.2f, %.2f], \"duration_ms\": %.3f, \"rays_per_second\": %.1f, \"node_visits_per_ray\": %.4f, "
+                      "\"dda_steps_per_ray\": %.4f, \"hit_rate\": %.4f, \"lod_hit_rate\": %.4f}%s\n", camera.position.x, camera.position.y,
+                camera.position.z, result.duration_ms, double(result.stats.ray_count) / result.duration_ms * 1e3,
+                double(result.stats.node_visits) / double(result.stats.ray_count), double(result.stats.dda_steps) / double(result.stats.ray_count),
+                double(result.stats.hit_count) / double(result.stats.ray_count), double(result.stats.lod_hit_count) / double(result.stats.ray_count),
+                frame + 1 < frame_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    info("Wrote benchmark results to %s", output.c_str());
+
+    delete view;
+    delete client::memory_pool;
+    server::stop();
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * @return The number of threads to use for a parallel job, given a requested count where 0 means "one per hardware thread".
+ */
+inline int thread_count_or_default(int thread_count) {
+    if (thread_count > 0) return thread_count;
+    return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+/**
+ * Run task(i) for every i in [0, task_count) on a short-lived pool of worker threads. Tasks are handed out one at a time through an
+ * atomic counter, so uneven tasks still keep every worker busy. The calling thread takes part in the work, and the function only
+ * returns once every task is done.
+ * @param task_count Number of tasks to run.
+ * @param task Callable taking the task index.
+ * @param thread_count Number of threads to use, including the calling one. 0 means one per hardware thread.
+ */
+template<typename F>
+inline void parallel_for(int task_count, F &&task, int thread_count = 0) {
+    thread_count = std::min(thread_count_or_default(thread_count), task_count);
+    std::atomic<int> next_task{0};
+    auto worker = [&]() {
+        for (int i = next_task++; i < task_count; i = next_task++) task(i);
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < thread_count; i++) workers.emplace_back(worker);
+    worker();
+    for (auto &thread: workers) thread.join();
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include "ivy_log.h"
 #include "client/client.h"
 #include "client/camera.h"
@@ -6,6 +8,19 @@
 #include "client/gui/chat.h"
 #include "client/renderers/renderer.h"
 #include "client/renderers/baseline/wide_tree_renderer.h"
+#include "client/utils/region_manager.h"
+#include "common/console.h"
+
+/**
+ * File written by the "/pool stats json" command.
+ */
+#define IVY_POOL_STATS_PATH ("memory_pool_stats.json")
+
+/**
+ * Range of the LOD cutoff of the renderer, in pixels, see gui::debug::lod_pixel_size.
+ */
+#define IVY_LOD_PIXEL_SIZE_MIN (0.25f)
+#define IVY_LOD_PIXEL_SIZE_MAX (64.0f)
 
 namespace client {
 
@@ -17,6 +32,59 @@ namespace client {
         void resize_view(int resolution_x, int resolution_y){
             if(active_renderer) active_renderer->resize(resolution_x, resolution_y);
         }
+
+        /**
+         * Print a histogram of the memory pool usage per size class, or write it as JSON with "/pool stats json".
+         */
+        void print_pool_stats(const char **parameters) {
+            PoolStats stats = memory_pool->get_stats();
+            char line[256];
+            if (parameters[0] != nullptr && strcmp(parameters[0], "json") == 0) {
+                FILE *file = fopen(IVY_POOL_STATS_PATH, "w");
+                if (file == nullptr) {
+                    error("Could not open %s", IVY_POOL_STATS_PATH);
+                    return;
+                }
+                fputs(stats.to_json().c_str(), file);
+                fclose(file);
+                snprintf(line, sizeof(line), "Wrote the memory pool stats to %s", IVY_POOL_STATS_PATH);
+                info("%s", line);
+                console::printf(line);
+                return;
+            }
+
+            snprintf(line, sizeof(line), "Pool: %.2lf MiB allocated, %.2lf MiB used, %.2lf MiB unfilled, %zu free blocks, %zu span blocks",
+                     (double) stats.allocated / 1024.0 / 1024.0, (double) stats.used / 1024.0 / 1024.0, (double) stats.unfilled_bytes / 1024.0 / 1024.0,
+                     stats.free_block_count, stats.span_block_count);
+            info("%s", line);
+            console::printf(line);
+            size_t max_live_bytes = 1;
+            for (const PoolSizeClassStats &size_class: stats.size_classes) max_live_bytes = std::max(max_live_bytes, size_class.live_bytes);
+            for (const PoolSizeClassStats &size_class: stats.size_classes) {
+                char bar[33] = {'\0'};
+                memset(bar, '#', size_class.live_bytes * 32 / max_live_bytes);
+                snprintf(line, sizeof(line), "%4d B: %9.2lf KiB live, %7zu holes, %5zu blocks, %5.1lf%% fragmented %s", size_class.size,
+                         (double) size_class.live_bytes / 1024.0, size_class.hole_count, size_class.block_count, size_class.fragmentation * 100.0, bar);
+                info("%s", line);
+                console::printf(line);
+            }
+        }
+
+        /**
+         * Scale the LOD cutoff of the renderer, see gui::debug::lod_pixel_size. Going below IVY_LOD_PIXEL_SIZE_MIN disables the cutoff,
+         * and scaling it up from there enables it again.
+         */
+        void scale_lod_pixel_size(float factor) {
+            float pixel_size = gui::debug::lod_pixel_size * factor;
+            if (gui::debug::lod_pixel_size == 0.0f) pixel_size = factor > 1.0f ? IVY_LOD_PIXEL_SIZE_MIN : 0.0f;
+            else if (pixel_size < IVY_LOD_PIXEL_SIZE_MIN) pixel_size = 0.0f;
+            gui::debug::lod_pixel_size = std::min(pixel_size, IVY_LOD_PIXEL_SIZE_MAX);
+        }
+
+        const char *pool_stats_keywords[] = {"pool", "stats"};
+        const char *pool_stats_formats[] = {"json"};
+        const console::CommandParameter pool_stats_format = {"format", true, pool_stats_formats, 1};
+        const console::CommandParameter *pool_stats_parameters[] = {&pool_stats_format};
     }
 
     void start() {
@@ -29,7 +97,7 @@ namespace client {
          * Initializing the client
          */
         window = context::init();
-        memory_pool = new FastMemoryPool();
+        memory_pool = new FastMemoryPool(utils::RegionManager::get_pool_size());
         active_renderer = new renderers::WideTreeRenderer();
         context::register_framebuffer_callback(resize_view);
         glfwShowWindow(window);
@@ -47,6 +115,11 @@ namespace client {
         context::register_key_callback(GLFW_KEY_F11, [](int action) { if (action == GLFW_PRESS) context::set_fullscreen(!context::is_fullscreen()); });
         context::register_key_callback(GLFW_KEY_F3, [](int action) { if (action == GLFW_PRESS) gui::debug::is_enabled = !gui::debug::is_enabled; });
         context::register_key_callback(GLFW_KEY_F2, [](int action) { if (action == GLFW_PRESS) context::set_vsync_enabled(!context::is_vsync_enabled()); });
+        context::register_key_callback(GLFW_KEY_F5, [](int action) { if (action == GLFW_PRESS) scale_lod_pixel_size(0.5f); });
+        context::register_key_callback(GLFW_KEY_F6, [](int action) { if (action == GLFW_PRESS) scale_lod_pixel_size(2.0f); });
+        context::register_key_callback(GLFW_KEY_F7, [](int action) {
+            if (action == GLFW_PRESS) gui::debug::is_heatmap_enabled = !gui::debug::is_heatmap_enabled;
+        });
         context::register_key_callback(GLFW_KEY_LEFT_ALT, [](int action) { if (action == GLFW_PRESS) context::set_cursor_enabled(true); });
         context::register_mouse_callback(GLFW_MOUSE_BUTTON_LEFT, [](int) { if (!gui::chat::is_enabled) context::set_cursor_enabled(false); });
 
@@ -69,6 +142,11 @@ namespace client {
             }
         }, 1);
 
+        /**
+         * Console commands, typed in the chat after a slash
+         */
+        console::register_command({pool_stats_keywords, 2, pool_stats_parameters, 1, print_pool_stats});
+
         /**
          * Rendering loop!
          */
@@ -1,3 +1,5 @@
+#include <cstdio>
+#include <cstring>
 #include "imgui.h"
 #include "ivy_time.h"
 #include "ivy_log.h"
@@ -22,6 +24,21 @@ namespace client::gui::chat {
             char owner_name[32] = "Player";
         } chat_history[64] = {};
         int chat_history_current = -1, chat_history_length = 0;
+        bool is_initialized = false;
+
+        void add_message(const char *text, const char *owner_name) {
+            chat_history_current = (chat_history_current + 1) % 64;
+            if (chat_history_length < 64) chat_history_length += 1;
+            Message &message = chat_history[chat_history_current];
+            snprintf(message.text, sizeof(message.text), "%s", text);
+            snprintf(message.owner_name, sizeof(message.owner_name), "%s", owner_name);
+            message.timestamp_us = time_us();
+        }
+
+        void initialize() {
+            is_initialized = true;
+            console::register_printer([](const char *message) { add_message(message, "Console"); });
+        }
 
         void render_all() {
             // Layout
@@ -44,7 +61,7 @@ namespace client::gui::chat {
                 ImGui::Begin("ChatHistory", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoInputs |
                                                      ImGuiWindowFlags_NoMove);
                 for (int i = 0; i < chat_history_length; i++) {
-                    Message &message = chat_history[(chat_history_current - chat_history_length + i + 1) % 64];
+                    Message &message = chat_history[(chat_history_current - chat_history_length + i + 1 + 64) % 64];
                     ImGui::Text("[%s] %s", message.owner_name, message.text);
                 }
                 ImGui::End();
@@ -63,20 +80,18 @@ namespace client::gui::chat {
                 if (input_buffer[0] != '\0') {
                     if (input_buffer[0] == '/') {
                         // Split line into keywords, and send to the console helper for parsing
-                        const char *tokens[32]; // Maximum 32 tokens
+                        const char *tokens[33]; // Maximum 32 tokens, followed by a null terminator
                         int token_count = 0;
                         char *token = strtok(input_buffer+1, " ");
                         while(token && token_count < 32) {
                             tokens[token_count++] = token;
                             token = strtok(nullptr, " ");
                         }
+                        tokens[token_count] = nullptr;
                         console::parse(tokens);
                     } else {
                         // Add message to chat history
-                        chat_history_current += 1;
-                        if (chat_history_length <= 64) chat_history_length += 1;
-                        strncpy(chat_history[chat_history_current].text, input_buffer, 256);
-                        chat_history[chat_history_current].timestamp_us = time_us();
+                        add_message(input_buffer, "Player");
                     }
                     input_buffer[0] = '\0'; // Clear input buffer
                 }
@@ -94,7 +109,7 @@ namespace client::gui::chat {
             // Update chat_recent_count by checking timestamps of messages
             int chat_recent_count = 0;
             for (int i = chat_history_length - 1; i >= 0; i--) {
-                Message &message = chat_history[(chat_history_current - chat_history_length + i + 1) % 64];
+                Message &message = chat_history[(chat_history_current - chat_history_length + i + 1 + 64) % 64];
                 if ((current_timestamp_us - message.timestamp_us) / 1'000'000 < recent_duration_seconds) {
                     chat_recent_count++;
                 } else {
@@ -119,7 +134,7 @@ namespace client::gui::chat {
                 ImGui::Begin("RecentMessages", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoInputs |
                                                         ImGuiWindowFlags_NoMove);
                 for (int i = chat_history_length - chat_recent_count; i < chat_history_length; i++) {
-                    Message &message = chat_history[(chat_history_current - chat_history_length + i + 1) % 64];
+                    Message &message = chat_history[(chat_history_current - chat_history_length + i + 1 + 64) % 64];
                     ImGui::Text("[%s] %s", message.owner_name, message.text);
                 }
                 ImGui::End();
@@ -134,6 +149,7 @@ namespace client::gui::chat {
     }
 
     void render() {
+        if (!is_initialized) initialize();
         if (is_enabled) render_all();
         else render_recent_messages_only();
     }
@@ -1,3 +1,4 @@
+#include <cfloat>
 #include "debug.h"
 #include "imgui.h"
 #include "client/context.h"
@@ -8,6 +9,9 @@
 
 namespace client::gui::debug {
     bool is_enabled = false;
+    float lod_pixel_size = 1.0f;
+    bool is_heatmap_enabled = false;
+    client::utils::StepHistogram step_histogram;
 
     namespace {
         bool is_initialized = false;
@@ -47,6 +51,16 @@ namespace client::gui::debug {
             ImGui::Text("Memory-pool allocation: %.2lf MiB", (double) memory_pool->allocated() / 1024.0 / 1024.0);
             ImGui::Text("Memory-pool usage: %.2lf MiB", (double) memory_pool->used() / 1024.0 / 1024.0);
             ImGui::Text("Worldgen: %s", server::world_generator->get_name());
+            if (lod_pixel_size > 0.0f) ImGui::Text("LOD cutoff: %.2f px (F5/F6)", lod_pixel_size);
+            else ImGui::Text("LOD cutoff: Disabled (F5/F6)");
+            if (is_heatmap_enabled && step_histogram.pixel_count > 0) {
+                ImGui::Text("Steps per pixel: %u median, %u p99, %u max (F7)", step_histogram.get_percentile(50), step_histogram.get_percentile(99),
+                            step_histogram.max_steps);
+                float buckets[IVY_STEP_HISTOGRAM_SIZE];
+                for (int i = 0; i < IVY_STEP_HISTOGRAM_SIZE; i++) buckets[i] = float(step_histogram.counts[i]);
+                ImGui::PlotHistogram("##steps", buckets, IVY_STEP_HISTOGRAM_SIZE, 0, nullptr, 0.0f, FLT_MAX, {0.0f, 40.0f});
+            }
+            else ImGui::Text("Step heatmap: Disabled (F7)");
             ImGui::Text("Chat: %s", chat::is_enabled ? "Opened" : "Closed");
             ImGui::Text("Framerate: %.0f FPS (~%.2f ms/frame)", io.Framerate, averaged_frame_duration);
         }
@@ -1,6 +1,21 @@
 #pragma once
 
+#include "client/utils/step_histogram.h"
+
 namespace client::gui::debug {
     extern bool is_enabled;
+
+    /**
+     * Footprint of a ray, in pixels, below which the renderer shades the nodes it hits with their LOD voxel instead of going down to
+     * their voxels. Larger values trade detail for fewer traversal steps on far terrain, and 0 disables the cutoff.
+     */
+    extern float lod_pixel_size;
+
+    /**
+     * Whether the renderer shades every pixel with the traversal steps of its rays instead of its color, and reads those steps back
+     * into the histogram shown by the overlay. The readback stalls the pipeline, so it only happens while the heatmap is shown.
+     */
+    extern bool is_heatmap_enabled;
+    extern client::utils::StepHistogram step_histogram;
     void render();
 }
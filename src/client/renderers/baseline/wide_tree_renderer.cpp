@@ -10,12 +10,12 @@
 #include "client/gui/debug.h"
 #include "client/gui/chat.h"
 #include "wide_tree_renderer.h"
+#include "client/renderers/ssbo_uploader.h"
 #include "client/shaders/baseline/main_pass.glsl"
 #include "server/server.h"
 #include "server/generators/generator.h"
 
 namespace client::renderers {
-
     WideTreeRenderer::WideTreeRenderer() : Renderer("64-tree") {
         // Initializing the renderer shader, SSBO and framebuffer
         main_pass_shader = client::util::build_program(main_pass_glsl, GL_COMPUTE_SHADER);
@@ -24,35 +24,61 @@ namespace client::renderers {
         context::get_framebuffer_size(&framebuffer_resolution_x, &framebuffer_resolution_y);
         resize(framebuffer_resolution_x, framebuffer_resolution_y);
 
-        // Initializing the world view
-        info("Initializing world view with a single %ldx%ldx%ld region", IVY_REGION_WIDTH, IVY_REGION_WIDTH, IVY_REGION_WIDTH);
-        auto t0 = time_us();
-        server::world_generator->generate_view(0, 0, 0, view);
-        info("Generated world view in %.2f ms!", double (time_us()-t0)/1e3);
-        glNamedBufferData(memory_pool_SSBO, (long) memory_pool->size(), memory_pool->to_pointer(0), GL_STATIC_COPY);
+        // The world view is paged in around the camera by the region manager, and the blocks of the pool are uploaded as they change
+        info("Initializing world view with %dx%d regions of %ldx%ldx%ld", regions.get_window_width(), regions.get_window_width(),
+             IVY_REGION_WIDTH, IVY_REGION_WIDTH, IVY_REGION_WIDTH);
+        glCreateBuffers(1, &region_table_SSBO);
+        max_memory_pool_SSBO_size = SSBOUploader::get_max_buffer_size(memory_pool);
     }
 
     WideTreeRenderer::~WideTreeRenderer() {
+        if (framebuffer_texture) destroy_texture(framebuffer_texture);
+        if (step_texture) destroy_texture(step_texture);
         glDeleteProgram(main_pass_shader);
         glDeleteFramebuffers(1, &framebuffer);
         glDeleteBuffers(1, &memory_pool_SSBO);
+        glDeleteBuffers(1, &region_table_SSBO);
     }
 
     void WideTreeRenderer::render() {
+        // Paging regions in and out around the camera, then uploading the pool blocks modified since the last frame
+        if (regions.update(client::camera::position)) {
+            const std::vector<uint32_t> &region_table = regions.get_region_table();
+            glNamedBufferData(region_table_SSBO, long(region_table.size() * sizeof(uint32_t)), region_table.data(), GL_DYNAMIC_DRAW);
+        }
+        SSBOUploader uploader(memory_pool_SSBO, memory_pool_SSBO_size, max_memory_pool_SSBO_size);
+        memory_pool->upload_dirty_blocks(uploader);
+
         // Then, doing the rendering of the world view
         glUseProgram(main_pass_shader);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, memory_pool_SSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, region_table_SSBO);
         bind_texture(framebuffer_texture, 0, GL_RGBA8, GL_WRITE_ONLY);
+        bind_texture(step_texture, 1, GL_R32UI, GL_WRITE_ONLY);
         glUniform2ui(glGetUniformLocation(main_pass_shader, "screen_size"), (uint32_t) framebuffer_resolution_x, (uint32_t) framebuffer_resolution_y);
         glUniform3f(glGetUniformLocation(main_pass_shader, "camera_position"), client::camera::position.x, client::camera::position.y, client::camera::position.z);
         glUniformMatrix4fv(glGetUniformLocation(main_pass_shader, "view_matrix"), 1, GL_FALSE, &camera::view_matrix[0][0]);
         glUniformMatrix4fv(glGetUniformLocation(main_pass_shader, "projection_matrix"), 1, GL_FALSE, &projection_matrix[0][0]);
         glUniform1ui(glGetUniformLocation(main_pass_shader, "world_width"), uint(pow(IVY_NODE_WIDTH, IVY_REGION_TREE_DEPTH)));
+        glUniform2i(glGetUniformLocation(main_pass_shader, "region_window_origin"), regions.get_window_origin_x(), regions.get_window_origin_z());
+        glUniform1i(glGetUniformLocation(main_pass_shader, "region_window_width"), regions.get_window_width());
+        glUniform1f(glGetUniformLocation(main_pass_shader, "lod_cone"),
+                    gui::debug::lod_pixel_size * 2.0f / (projection_matrix[1][1] * float(framebuffer_resolution_y)));
         glUniform1i(glGetUniformLocation(main_pass_shader, "tree_step_limit"), tree_step_limit);
         glUniform1i(glGetUniformLocation(main_pass_shader, "dda_step_limit"), dda_step_limit);
+        glUniform1i(glGetUniformLocation(main_pass_shader, "is_heatmap_enabled"), gui::debug::is_heatmap_enabled);
         glUniform3f(glGetUniformLocation(main_pass_shader, "sun_direction"), sun_direction.x, sun_direction.y, sun_direction.z);
         glDispatchCompute(GLuint(ceilf(float(framebuffer_resolution_x) / 8.0f)), GLuint(ceilf(float(framebuffer_resolution_y) / 8.0f)), 1);
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        // With the heatmap, reading the step counts back for the histogram of the debug overlay, which waits for the frame to be done
+        if (gui::debug::is_heatmap_enabled) {
+            glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+            step_counts.resize(size_t(framebuffer_resolution_x) * size_t(framebuffer_resolution_y));
+            glGetTextureImage(step_texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, long(step_counts.size() * sizeof(uint32_t)), step_counts.data());
+            gui::debug::step_histogram = {};
+            gui::debug::step_histogram.add(step_counts.data(), step_counts.size());
+        }
         glBlitNamedFramebuffer(framebuffer, 0,
                                0, 0, framebuffer_resolution_x, framebuffer_resolution_y,
                                0, 0, framebuffer_resolution_x, framebuffer_resolution_y,
@@ -68,11 +94,13 @@ namespace client::renderers {
 
     void WideTreeRenderer::resize(int resolution_x, int resolution_y) {
         if (framebuffer_texture) destroy_texture(framebuffer_texture);
+        if (step_texture) destroy_texture(step_texture);
         glViewport(0, 0, resolution_x, resolution_y);
         framebuffer_resolution_x = std::max(1, resolution_x);
         framebuffer_resolution_y = std::max(1, resolution_y);
         projection_matrix = glm::perspective(glm::radians(80.0f), (float) framebuffer_resolution_x / float(framebuffer_resolution_y), 0.1f, 100.0f);
         framebuffer_texture = client::util::create_texture(framebuffer_resolution_x, framebuffer_resolution_y, GL_RGBA8, GL_NONE);
+        step_texture = client::util::create_texture(framebuffer_resolution_x, framebuffer_resolution_y, GL_R32UI, GL_NONE);
         glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, framebuffer_texture, 0);
     }
 }
\ No newline at end of file
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <vector>
 #include "glm/ext/matrix_float4x4.hpp"
 #include "client/renderers/renderer.h"
-#include "client/utils/wide_tree.h"
+#include "client/utils/region_manager.h"
+
+/**
+ * Default step budgets of every ray of main_pass.glsl, see its dda_step_limit and tree_step_limit uniforms. They sit well above the
+ * steps of the worst primary rays of the benchmark views, so that they only cut pathological rays, such as rays grazing large surfaces.
+ */
+#define IVY_DDA_STEP_LIMIT (1024)
+#define IVY_TREE_STEP_LIMIT (512)
 
 namespace client::renderers {
     class WideTreeRenderer final: public Renderer {
@@ -13,11 +21,13 @@ namespace client::renderers {
         void resize(int resolution_x, int resolution_y) override;
     private:
         GLuint main_pass_shader = 0;
-        GLuint memory_pool_SSBO = 0;
-        GLuint framebuffer = 0, framebuffer_texture = 0;
+        GLuint memory_pool_SSBO = 0, region_table_SSBO = 0;
+        size_t memory_pool_SSBO_size = 0, max_memory_pool_SSBO_size = 0;  // The SSBO grows with the extent of the pool, see SSBOUploader
+        GLuint framebuffer = 0, framebuffer_texture = 0, step_texture = 0;
         glm::mat4 projection_matrix = {};
-        client::utils::WideTree view = {};
-        int tree_step_limit = 0, dda_step_limit = 0;
+        client::utils::RegionManager regions;
+        int tree_step_limit = IVY_TREE_STEP_LIMIT, dda_step_limit = IVY_DDA_STEP_LIMIT;
+        std::vector<uint32_t> step_counts;
         int framebuffer_resolution_x = 0, framebuffer_resolution_y = 0;
         glm::vec3 sun_direction = {0.3, 0.3, 1.0};
     };
@@ -10,6 +10,7 @@
 #include "client/gui/debug.h"
 #include "client/gui/chat.h"
 #include "experimental_renderer.h"
+#include "client/renderers/ssbo_uploader.h"
 #include "client/shaders/experiment_1/primary_ray.glsl"
 #include "client/shaders/experiment_1/minpool_horizontal.glsl"
 #include "client/shaders/experiment_1/minpool_vertical.glsl"
@@ -38,7 +39,11 @@ namespace client::renderers {
         auto t0 = time_us();
         server::world_generator->generate_view(0, 0, 0, view);
         info("Generated world view in %.2f ms!", double (time_us()-t0)/1e3);
-        glNamedBufferData(memory_pool_SSBO, (long) memory_pool->size(), memory_pool->to_pointer(0), GL_STATIC_COPY);
+
+        // The SSBO mirrors the pool like the one of WideTreeRenderer, so it is sized by the extent of the pool instead of its whole
+        // reserved address space. Blocks written by other trees are marked too, as the new SSBO has no copy of them yet.
+        max_memory_pool_SSBO_size = SSBOUploader::get_max_buffer_size(memory_pool);
+        memory_pool->mark_dirty(memory_pool->to_pointer(0), memory_pool->extent());
     }
 
     ExperimentalRenderer::~ExperimentalRenderer() {
@@ -57,6 +62,10 @@ namespace client::renderers {
     }
 
     void ExperimentalRenderer::render() {
+        // Uploading the pool blocks modified since the last frame
+        SSBOUploader uploader(memory_pool_SSBO, memory_pool_SSBO_size, max_memory_pool_SSBO_size);
+        memory_pool->upload_dirty_blocks(uploader);
+
         // Low-res depth prepass
         glUseProgram(depth_prepass_shader);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, memory_pool_SSBO);
@@ -94,6 +103,7 @@ namespace client::renderers {
         glUniformMatrix4fv(glGetUniformLocation(main_pass_shader, "view_matrix"), 1, GL_FALSE, &camera::view_matrix[0][0]);
         glUniformMatrix4fv(glGetUniformLocation(main_pass_shader, "projection_matrix"), 1, GL_FALSE, &projection_matrix[0][0]);
         glUniform1ui(glGetUniformLocation(main_pass_shader, "tree_depth"), IVY_REGION_TREE_DEPTH);
+        glUniform1ui(glGetUniformLocation(main_pass_shader, "voxel_size"), sizeof(Voxel));
         glDispatchCompute(GLuint(ceilf(float(framebuffer_resolution_x) / 8.0f)), GLuint(ceilf(float(framebuffer_resolution_y) / 8.0f)), 1);
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
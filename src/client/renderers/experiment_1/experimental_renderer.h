@@ -14,6 +14,7 @@ namespace client::renderers {
     private:
         GLuint main_pass_shader = 0, depth_prepass_shader = 0, minpool_horizontal_shader = 0, minpool_vertical_shader = 0, postprocess_normals_shader = 0;
         GLuint memory_pool_SSBO = 0;
+        size_t memory_pool_SSBO_size = 0, max_memory_pool_SSBO_size = 0;  // The SSBO grows with the extent of the pool, see SSBOUploader
         GLuint framebuffer = 0;
         GLuint framebuffer_texture = 0, voxel_and_normal_texture = 0, depth_texture = 0, intermediate_depth_texture = 0, lowres_depth_texture = 0;
         glm::mat4 projection_matrix = {};
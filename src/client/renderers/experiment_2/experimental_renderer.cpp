@@ -10,6 +10,7 @@
 #include "client/gui/debug.h"
 #include "client/gui/chat.h"
 #include "client/renderers/experiment_2/experimental_renderer.h"
+#include "client/renderers/ssbo_uploader.h"
 #include "client/shaders/experiment_2/primary_ray.glsl"
 #include "client/shaders/experiment_2/secondary_ray.glsl"
 #include "server/server.h"
@@ -31,7 +32,11 @@ namespace client::renderers {
         auto t0 = time_us();
         server::world_generator->generate_view(0, 0, 0, view);
         info("Generated world view in %.2f ms!", double (time_us()-t0)/1e3);
-        glNamedBufferData(memory_pool_SSBO, (long) memory_pool->size(), memory_pool->to_pointer(0), GL_STATIC_COPY);
+
+        // The SSBO mirrors the pool like the one of WideTreeRenderer, so it is sized by the extent of the pool instead of its whole
+        // reserved address space. Blocks written by other trees are marked too, as the new SSBO has no copy of them yet.
+        max_memory_pool_SSBO_size = SSBOUploader::get_max_buffer_size(memory_pool);
+        memory_pool->mark_dirty(memory_pool->to_pointer(0), memory_pool->extent());
     }
 
     ExperimentalRenderer2::~ExperimentalRenderer2() {
@@ -42,6 +47,10 @@ namespace client::renderers {
     }
 
     void ExperimentalRenderer2::render() {
+        // Uploading the pool blocks modified since the last frame
+        SSBOUploader uploader(memory_pool_SSBO, memory_pool_SSBO_size, max_memory_pool_SSBO_size);
+        memory_pool->upload_dirty_blocks(uploader);
+
         // First doing the primary ray
         glUseProgram(primary_ray_shader);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, memory_pool_SSBO);
@@ -14,6 +14,7 @@ namespace client::renderers {
     private:
         GLuint primary_ray_shader = 0, secondary_ray_shader = 0;
         GLuint memory_pool_SSBO = 0;
+        size_t memory_pool_SSBO_size = 0, max_memory_pool_SSBO_size = 0;  // The SSBO grows with the extent of the pool, see SSBOUploader
         GLuint framebuffer = 0, framebuffer_texture = 0, intermediate_texture = 0;
         glm::mat4 projection_matrix = {};
         client::utils::WideTree view = {};
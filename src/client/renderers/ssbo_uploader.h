@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include "glad/gl.h"
+#include "ivy_log.h"
+#include "client/utils/memory_pool.h"
+
+namespace client::renderers {
+    /**
+     * Copies the dirty ranges of the memory pool to the pool SSBO, which mirrors the pool byte for byte up to the extent of the pool.
+     * The pool reserves far more than it uses, so the SSBO grows along with the extent, keeping its content.
+     */
+    class SSBOUploader final: public PoolUploader {
+        GLuint &buffer;
+        size_t &buffer_size;
+        size_t max_buffer_size;
+
+        void grow(size_t size) {
+            size_t new_size = std::min(std::max(size, buffer_size * 2), max_buffer_size);
+            if (size > new_size) fatal("The memory pool needs a %zu bytes SSBO, more than the %zu bytes of the GPU", size, max_buffer_size);
+            GLuint new_buffer;
+            glCreateBuffers(1, &new_buffer);
+            glNamedBufferData(new_buffer, long(new_size), nullptr, GL_DYNAMIC_DRAW);
+            if (buffer_size > 0) glCopyNamedBufferSubData(buffer, new_buffer, 0, 0, long(buffer_size));
+            glDeleteBuffers(1, &buffer);
+            info("Growing the memory pool SSBO from %.2f MiB to %.2f MiB", double(buffer_size) / 1024.0 / 1024.0,
+                 double(new_size) / 1024.0 / 1024.0);
+            buffer = new_buffer;
+            buffer_size = new_size;
+        }
+    public:
+        SSBOUploader(GLuint &buffer, size_t &buffer_size, size_t max_buffer_size)
+                : buffer(buffer), buffer_size(buffer_size), max_buffer_size(max_buffer_size) {}
+
+        void upload(size_t offset, size_t size, const void *data) override {
+            if (offset + size > buffer_size) grow(offset + size);
+            glNamedBufferSubData(buffer, long(offset), long(size), data);
+        }
+
+        /**
+         * @return The largest pool SSBO the GPU can bind, at most the size of the pool, warning when it cannot address all of it.
+         */
+        static size_t get_max_buffer_size(FastMemoryPool *pool) {
+            GLint64 max_block_size = 0;
+            glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+            size_t max_buffer_size = std::min(pool->size(), size_t(max_block_size));
+            if (max_buffer_size < pool->size()) {
+                warn("The GPU only addresses %.2f MiB of the %.2f MiB memory pool", double(max_buffer_size) / 1024.0 / 1024.0,
+                     double(pool->size()) / 1024.0 / 1024.0);
+            }
+            return max_buffer_size;
+        }
+    };
+}
\ No newline at end of file
@@ -1,7 +1,6 @@
 const char main_pass_glsl[] = R""(
 #version 460 core
 
-#define SIZEOF_NODE 12
 #define NODE_WIDTH 4
 #define NODE_WIDTH_SQRT 2
 #define MINI_STEP_SIZE 5e-3f
@@ -21,12 +20,26 @@ struct Node{
  */
 layout (local_size_x = 8, local_size_y = 8) in;
 layout (rgba8, binding = 0) uniform restrict writeonly image2D outImage;
+layout (r32ui, binding = 1) uniform restrict writeonly uimage2D stepImage; // steps of the rays of each pixel, written with the heatmap
 layout (std430, binding = 0) readonly buffer _node_pool { Node node_pool[]; };
+layout (std430, binding = 1) readonly buffer _region_table { uint region_roots[]; }; // root node index + 1 of each region, 0 if not resident
 uniform uvec2 screen_size;
 uniform vec3 camera_position;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 uniform uint world_width;
+uniform ivec2 region_window_origin; // region coordinates (x, z) of the first slot of the region table
+uniform int region_window_width;
+uniform float lod_cone; // width of the footprint of a ray per unit of distance, 0 to trace every ray down to the voxels
+uniform int dda_step_limit; // iterations of the DDA loop a ray may run, 0 for no limit
+uniform int tree_step_limit; // nodes a ray may enter while going down or up the tree, 0 for no limit
+uniform bool is_heatmap_enabled; // shading every pixel with the steps of its rays instead of the color of its voxel
+
+/**
+ * Steps taken by the current ray, reset by raytrace, and how many it may take. A ray running out of steps stops and counts as a miss.
+ */
+uint dda_steps, tree_steps;
+uint dda_step_budget, tree_step_budget;
 
 /**
  * Basic axis-aligned bounding box collision check.
@@ -43,10 +56,12 @@ float AABBIntersect(vec3 bmin, vec3 bmax, vec3 orig, vec3 invdir, out vec3 aabb_
 }
 
 /**
- * Our raytracing function
+ * Our raytracing function, within a single region. The ray position is relative to the region, and the ray distance is the distance
+ * already traveled by the ray before reaching that position, which grows its footprint.
  */
-uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
+uint raytrace_region(inout vec3 ray_pos, vec3 ray_dir, uint root_index, float ray_distance){
     // caching a few commonly used values
+    const vec3 ray_origin = ray_pos;
     const vec3 inverted_ray_dir = 1.0f / ray_dir;
     const vec3 ray_sign_11 = vec3(ray_dir.x < 0. ? -1. : 1., ray_dir.y < 0. ? -1. : 1., ray_dir.z < 0. ? -1. : 1.);
     const vec3 ray_sign_01 = max(ray_sign_11, 0.);
@@ -57,7 +72,7 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
     // ray-box intersection and a big step if the camera is outside the voxel volume
     const vec3 bmin = vec3(MINI_STEP_SIZE), bmax = vec3(world_width-MINI_STEP_SIZE);
     if(any(greaterThanEqual(ray_pos, bmax) || lessThan(ray_pos, bmin))){
-        const float intersect = AABBIntersect(bmin, bmax, camera_position, inverted_ray_dir, step_mask);
+        const float intersect = AABBIntersect(bmin, bmax, ray_pos, inverted_ray_dir, step_mask);
         if (intersect < 0) return 0; // not bothering with rays that will not hit the bbox
         if (intersect > 0) ray_pos += ray_dir * intersect + step_mask * ray_sign_11 * MINI_STEP_SIZE;
     }
@@ -70,7 +85,7 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
     // setting up the stack & recurrent variables that will be used to traverse the 64-tree
     uint stack[7];
     uint depth = 0;
-    uint current_node_index = 0;
+    uint current_node_index = root_index;
     uint bitmask_index;
     Node current_node = node_pool[current_node_index];
     stack[depth] = current_node_index;
@@ -81,6 +96,10 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
          * For the most part, we are doing the classical DDA algorithm in this do-while loop
          */
         do {
+            // check budget
+            if (dda_steps == dda_step_budget) return 0;
+            dda_steps += 1;
+
             // check hit
             uvec3 v = (uvec3(ray_pos) & (node_width * NODE_WIDTH - 1u)) >> findMSB(node_width);
             bitmask_index = v.x + (v.z << NODE_WIDTH_SQRT) + (v.y << NODE_WIDTH);
@@ -104,9 +123,9 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
         if(has_collided){
             do{
                 // if there is a hit on a voxel in a terminal node: return hit color
-                if((current_node.header & (0x1u << 30)) != 0) {
-                    bool is_lod = (current_node.header & (0x1u << 31)) != 0;
-                    uint color_index = is_lod ? (current_node.header & ~(0x3u << 30)) : 1;
+                if((current_node.header >> 30) != 0u) {
+                    bool is_lod = (current_node.header >> 30) == 0x3u;
+                    uint color_index = is_lod ? (current_node.header & 0xffu) : 1;
                     ray_pos -= vec3(MINI_STEP_SIZE)*ray_sign_11;
                     return color_index;
                 }
@@ -115,9 +134,23 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
                 uint filtered_low, filtered_high;
                 if (bitmask_index < 32) { filtered_low = current_node.bitmask_low & ((1u << bitmask_index) - 1u); filtered_high = 0u; }
                 else { filtered_low = current_node.bitmask_low; filtered_high = current_node.bitmask_high & ((1u << (bitmask_index - 32)) - 1u); }
-                uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + uint((current_node.header & ~(0x3u << 30))/SIZEOF_NODE);
+                uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + (current_node.header & ~(0x3u << 30));
 
-                // going down
+                // if the hit node is no wider than the footprint of the ray, no need to go down: returning its LOD color, which inner nodes
+                // keep in the LOD slot following their children
+                if (float(node_width) <= lod_cone * (ray_distance + distance(ray_pos, ray_origin))) {
+                    Node hit_node = node_pool[hit_index];
+                    if ((hit_node.header >> 30) == 0u) {
+                        hit_node = node_pool[(hit_node.header & ~(0x3u << 30)) + bitCount(hit_node.bitmask_low) + bitCount(hit_node.bitmask_high)];
+                    }
+                    bool is_lod = (hit_node.header >> 30) == 0x3u;
+                    ray_pos -= vec3(MINI_STEP_SIZE)*ray_sign_11;
+                    return is_lod ? (hit_node.header & 0xffu) : 1;
+                }
+
+                // going down, if the budget allows it
+                if (tree_steps == tree_step_budget) return 0;
+                tree_steps += 1;
                 depth += 1;
                 stack[depth] = current_node_index;
                 current_node_index = hit_index;
@@ -141,7 +174,9 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
          */
         else if(exited_local && !exited_global){
             do {
-                // go up
+                // go up, if the budget allows it
+                if (tree_steps == tree_step_budget) return 0;
+                tree_steps += 1;
                 current_node_index = stack[depth];
                 current_node = node_pool[current_node_index];
                 depth -= 1;
@@ -161,6 +196,45 @@ uint raytrace(inout vec3 ray_pos, vec3 ray_dir){
     return 0;
 }
 
+/**
+ * Walking through the regions of the region table crossed by the ray, and tracing the resident ones. The world is a single region high,
+ * so regions are only laid out along the x and z axes. The ray distance is the distance from the camera to the ray position, see
+ * raytrace_region. Every call starts a new ray, with its own step budget.
+ */
+uint raytrace(inout vec3 ray_pos, vec3 ray_dir, float ray_distance){
+    const vec3 ray_origin = ray_pos;
+    dda_steps = 0u;
+    tree_steps = 0u;
+    const vec2 ray_sign_01 = vec2(ray_dir.x < 0. ? 0. : 1., ray_dir.z < 0. ? 0. : 1.);
+    const float region_width = float(world_width);
+    for (int i = 0; i < 2 * region_window_width; i++) {
+        // finding the slot of the current region, knowing that nothing is resident outside of the table
+        const ivec2 region = ivec2(floor(ray_pos.xz / region_width));
+        const ivec2 slot = region - region_window_origin;
+        if (any(lessThan(slot, ivec2(0))) || any(greaterThanEqual(slot, ivec2(region_window_width)))) return 0;
+
+        // tracing the region in its own coordinates
+        const vec3 region_offset = vec3(region.x, 0, region.y) * region_width;
+        const uint root = region_roots[slot.x + slot.y * region_window_width];
+        if (root != 0) {
+            vec3 local_ray_pos = ray_pos - region_offset;
+            const uint color_index = raytrace_region(local_ray_pos, ray_dir, root - 1u, ray_distance + distance(ray_pos, ray_origin));
+            if (color_index != 0) {
+                ray_pos = local_ray_pos + region_offset;
+                return color_index;
+            }
+            if (dda_steps == dda_step_budget || tree_steps == tree_step_budget) return 0;
+        }
+
+        // then jumping to the next region, with a mini-step to make sure we are in it
+        const vec2 side_dist = (region_offset.xz + region_width * ray_sign_01 - ray_pos.xz) / ray_dir.xz;
+        const float ray_step = min(side_dist.x, side_dist.y);
+        ray_pos += ray_dir * ray_step;
+        ray_pos.xz += MINI_STEP_SIZE * (ray_sign_01 * 2. - 1.) * vec2(equal(vec2(ray_step), side_dist));
+    }
+    return 0;
+}
+
 /**
  * Doing some maths to get the ray dir given the camera position, direction, and the target pixel on-screen coordinates
  */
@@ -185,6 +259,14 @@ const vec3 colors[] = {
     vec3(0.30, 0.59, 0.31)  // GRASS
 };
 
+/**
+ * Heatmap color of a step count, from blue for no step to red for the given maximum, on a logarithmic scale.
+ */
+vec3 getHeatColor(uint steps, uint max_steps) {
+    const float heat = clamp(log2(1.0 + float(steps)) / log2(1.0 + float(max_steps)), 0.0, 1.0);
+    return clamp(1.5 - abs(4.0 * heat - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);
+}
+
 /**
  * Main function!
  */
@@ -196,15 +278,26 @@ void main() {
     const vec3 ray_dir = getRayDir(ivec2(gl_GlobalInvocationID.xy));
 
     // primary ray
+    dda_step_budget = dda_step_limit > 0 ? uint(dda_step_limit) : 0xffffffffu;
+    tree_step_budget = tree_step_limit > 0 ? uint(tree_step_limit) : 0xffffffffu;
     vec3 ray_pos = camera_position;
-    uint voxel_index = raytrace(ray_pos, ray_dir);
+    uint voxel_index = raytrace(ray_pos, ray_dir, 0.0);
     vec3 voxel_color = colors[voxel_index];
+    uint pixel_steps = dda_steps + tree_steps;
 
     // secondary ray with fixed sun direction
     const vec3 sun_direction = normalize(vec3(0.4, 0.4, 1.0));
     if (voxel_index != 0) {
-        uint sun_voxel_index = raytrace(ray_pos, sun_direction);
+        uint sun_voxel_index = raytrace(ray_pos, sun_direction, distance(ray_pos, camera_position));
         if(sun_voxel_index!=0) voxel_color *= 0.5; // Reduced brightness for shadows
+        pixel_steps += dda_steps + tree_steps;
+    }
+
+    // the heatmap replaces the colors, scaled to the budget of both rays when there is one
+    if (is_heatmap_enabled) {
+        const uint max_steps = dda_step_limit > 0 && tree_step_limit > 0 ? 2u * uint(dda_step_limit + tree_step_limit) : 4096u;
+        voxel_color = getHeatColor(pixel_steps, max_steps);
+        imageStore(stepImage, ivec2(gl_GlobalInvocationID.xy), uvec4(pixel_steps));
     }
 
     // writing to the framebuffer
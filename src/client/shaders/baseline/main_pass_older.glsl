@@ -2,7 +2,6 @@ const char main_pass_glsl[] = R""(
 #version 460 core
 #extension GL_ARB_shader_clock : enable
 
-#define SIZEOF_NODE 12
 #define NODE_WIDTH 4
 #define NODE_WIDTH_SQRT 2
 #define MINI_STEP_SIZE 5e-3f
@@ -154,14 +153,14 @@ void main() {
             if(has_collided){
                 do{
                     // if there is a hit on a voxel in a terminal node: return hit color
-                    bool is_terminal = (current_node.header & (0x1u << 30)) != 0;
+                    bool is_terminal = (current_node.header >> 30) != 0u;
                     if(is_terminal){
 
                         // Extracting the base surface color from the tree
                         uint color_index = 0;
-                        bool is_lod = (current_node.header & (0x1u << 31)) != 0;
+                        bool is_lod = (current_node.header >> 30) == 0x3u;
                         if(is_lod){
-                            color_index = current_node.header & ~(0x3u << 30);
+                            color_index = current_node.header & 0xffu;
                         }else{
                             // Not implemented. We return DEBUG_RED
                         }
@@ -190,7 +189,7 @@ void main() {
                         filtered_low = current_node.bitmask_low;
                         filtered_high = current_node.bitmask_high & ((1u << (bitmask_index - 32)) - 1u);
                     }
-                    uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + uint((current_node.header & ~(0x3u << 30))/SIZEOF_NODE);
+                    uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + (current_node.header & ~(0x3u << 30));
 
                     // going down
                     depth += 1;
@@ -1,7 +1,6 @@
 const char depth_prepass_glsl[] = R""(
 #version 460 core
 
-#define SIZEOF_NODE 12
 #define NODE_WIDTH 4
 #define NODE_WIDTH_SQRT 2
 #define MINI_STEP_SIZE 5e-3f
@@ -133,7 +132,7 @@ void main() {
             if(has_collided){
                 do{
                     // if there is a hit on a voxel in a terminal node: return hit color
-                    bool is_terminal = (current_node.header & (0x1u << 30)) != 0;
+                    bool is_terminal = (current_node.header >> 30) != 0u;
                     if(is_terminal){
                         float depth = length(ray_pos - camera_position);
                         imageStore(lowres_depth_texture, ivec2(gl_GlobalInvocationID.xy), vec4(depth, 0, 0, 1));
@@ -149,7 +148,7 @@ void main() {
                         filtered_low = current_node.bitmask_low;
                         filtered_high = current_node.bitmask_high & ((1u << (bitmask_index - 32)) - 1u);
                     }
-                    uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + uint((current_node.header & ~(0x3u << 30))/SIZEOF_NODE);
+                    uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + (current_node.header & ~(0x3u << 30));
 
                     // going down
                     depth += 1;
@@ -44,26 +44,18 @@ vec3 snapNormal(vec3 normal, float threshold, float hardness) {
     return (normal*(1-hardness)+snappedNormal*(1+hardness))/2.;
 }
 
-void main() {
-    // Getting raw color and normal
-    ivec2 screen_coordinates = ivec2(gl_GlobalInvocationID.xy);
-    vec4 voxel_and_normal = imageLoad(voxel_and_normal_texture, screen_coordinates);
-    vec3 raw_color = colors[int(voxel_and_normal.r * 10)].rgb;
-    vec3 normal = voxel_and_normal.gba;
-
-    float depth = imageLoad(fullres_depth_texture, screen_coordinates).r;
+// Reconstructs the normal of a pixel from the depth of its neighbours
+vec3 reconstructNormal(ivec2 screen_coordinates, float depth) {
     float depthRight = imageLoad(fullres_depth_texture, screen_coordinates + ivec2(1, 0)).r;
     float depthLeft = imageLoad(fullres_depth_texture, screen_coordinates + ivec2(-1, 0)).r;
     float depthUp = imageLoad(fullres_depth_texture, screen_coordinates + ivec2(0, 1)).r;
     float depthDown = imageLoad(fullres_depth_texture, screen_coordinates + ivec2(0, -1)).r;
 
-    vec3 forward = getRayDir(screen_coordinates);
     vec3 forward_right = getRayDir(screen_coordinates + ivec2(1, 0));
     vec3 forward_left = getRayDir(screen_coordinates + ivec2(-1, 0));
     vec3 forward_up = getRayDir(screen_coordinates + ivec2(0, 1));
     vec3 forward_down = getRayDir(screen_coordinates + ivec2(0, -1));
 
-    vec3 worldPos = camera_position + depth * forward;
     vec3 worldPosRight = camera_position + depthRight * forward_right;
     vec3 worldPosLeft = camera_position + depthLeft * forward_left;
     vec3 worldPosUp = camera_position + depthUp * forward_up;
@@ -72,8 +64,25 @@ void main() {
     vec3 tangentU = (worldPosRight - worldPosLeft) * 0.5;
     vec3 tangentV = (worldPosUp - worldPosDown) * 0.5;
 
-    normal = normalize(cross(tangentU, tangentV));
-    normal = snapNormal(normal, 0.9, max(0, 1-depth*depth/4000.));
+    vec3 normal = normalize(cross(tangentU, tangentV));
+    return snapNormal(normal, 0.9, max(0, 1-depth*depth/4000.));
+}
+
+void main() {
+    // Getting raw color and normal
+    ivec2 screen_coordinates = ivec2(gl_GlobalInvocationID.xy);
+    vec4 voxel_and_normal = imageLoad(voxel_and_normal_texture, screen_coordinates);
+    vec3 raw_color = colors[int(voxel_and_normal.r * 10)].rgb;
+    vec3 normal = voxel_and_normal.gba;
+    float depth = imageLoad(fullres_depth_texture, screen_coordinates).r;
+
+    // Voxels with a normal give it directly, the normal of the others is reconstructed from the depth of their neighbours. Like the
+    // light direction, reconstructed normals point into the surface, so voxel normals are flipped.
+    if (normal != vec3(0)) {
+        normal = -normalize(normal * 2.0 - 1.0);
+    } else {
+        normal = reconstructNormal(screen_coordinates, depth);
+    }
 
     // Getting the final color
     vec3 light_dir = normalize(vec3(-0.9, -0.7, -0.4));
@@ -2,7 +2,6 @@ const char primary_ray_glsl[] = R""(
 #version 460 core
 #extension GL_ARB_shader_clock : enable
 
-#define SIZEOF_NODE 12
 #define NODE_WIDTH 4
 #define NODE_WIDTH_SQRT 2
 #define MINI_STEP_SIZE 5e-3f
@@ -17,6 +16,7 @@ uniform vec3 camera_position;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 uniform uint tree_depth;
+uniform uint voxel_size; // 1 for 8-bit voxels, 2 for voxels with a normal, see voxel.h
 
 struct Node{
     uint bitmask_low;
@@ -28,6 +28,41 @@ layout (std430, binding = 0) restrict readonly buffer _node_pool{
     Node node_pool[];
 };
 
+// Reads a byte of the pool, which is bound as an array of 12-byte nodes
+uint read_pool_byte(uint byte_offset) {
+    Node node = node_pool[byte_offset / 12u];
+    uint word_offset = byte_offset % 12u;
+    uint word = word_offset < 4u ? node.bitmask_low : (word_offset < 8u ? node.bitmask_high : node.header);
+    return (word >> ((word_offset % 4u) * 8u)) & 0xffu;
+}
+
+// Decodes a voxel of a terminal node, as its material on the low 8 bits and its normal on the next 8 bits, see wide_tree.h
+uint read_leaf_voxel(Node node, int bitmask_index) {
+    if ((node.header >> 30) == 0x3u) return node.header & 0xffffu;
+    uint child_id;
+    if (bitmask_index < 32) child_id = uint(bitCount(node.bitmask_low & ((1u << bitmask_index) - 1u)));
+    else child_id = uint(bitCount(node.bitmask_low) + bitCount(node.bitmask_high & ((1u << (bitmask_index - 32)) - 1u)));
+    uint array_offset = (node.header & ~(0x3u << 30)) * 12u, voxel_offset;
+    if ((node.header >> 30) == 0x1u) {
+        voxel_offset = array_offset + child_id * voxel_size;
+    } else {
+        uint palette_size = read_pool_byte(array_offset);
+        uint bits = palette_size <= 4u ? 2u : 4u;
+        uint packed_index = read_pool_byte(array_offset + 1u + palette_size * voxel_size + child_id * bits / 8u);
+        voxel_offset = array_offset + 1u + ((packed_index >> (child_id * bits % 8u)) & ((1u << bits) - 1u)) * voxel_size;
+    }
+    uint voxel = read_pool_byte(voxel_offset);
+    if (voxel_size == 2u) voxel |= read_pool_byte(voxel_offset + 1u) << 8;
+    return voxel;
+}
+
+// Decodes the spherical coordinates of a voxel normal into a unit vector, y being up. A null normal gives vec3(0).
+vec3 decode_normal(uint normal) {
+    if (normal == 0u) return vec3(0);
+    float polar = float(normal >> 4) / 15.0 * 3.14159265, azimuth = float(normal & 0xfu) / 8.0 * 3.14159265;
+    return vec3(sin(polar) * cos(azimuth), cos(polar), sin(polar) * sin(azimuth));
+}
+
 vec3 getRayDir(ivec2 screen_position) {
     vec2 screen_space = (screen_position + vec2(0.5)) / vec2(screen_size);
     screen_space.y = 1.0 - screen_space.y;
@@ -126,20 +161,18 @@ void main() {
             if(has_collided){
                 do{
                     // if there is a hit on a voxel in a terminal node: return hit color
-                    bool is_terminal = (current_node.header & (0x1u << 30)) != 0;
+                    bool is_terminal = (current_node.header >> 30) != 0u;
                     if(is_terminal){
 
-                        // Extracting the base surface color from the tree
-                        uint color_index = 0;
-                        bool is_lod = (current_node.header & (0x1u << 31)) != 0;
-                        if(is_lod){
-                            color_index = current_node.header & ~(0x3u << 30);
-                        }else{
-                            // Not implemented. We return DEBUG_RED
-                        }
+                        // Extracting the base surface color and the normal from the tree. Voxels without a normal leave it null, so
+                        // that the postprocess reconstructs it from the depth.
+                        uint voxel = read_leaf_voxel(current_node, bitmask_index);
+                        uint color_index = voxel & 0xffu;
+                        vec3 normal = decode_normal(voxel >> 8);
+                        vec3 encoded_normal = normal == vec3(0) ? vec3(0) : normal * 0.5 + 0.5;
 
                         // Calculating the final surface color && applying it :)
-                        imageStore(voxel_and_normal_texture, ivec2(gl_GlobalInvocationID.xy), vec4(color_index/10., step_mask));
+                        imageStore(voxel_and_normal_texture, ivec2(gl_GlobalInvocationID.xy), vec4(color_index/10., encoded_normal));
                         imageStore(fullres_depth_texture, ivec2(gl_GlobalInvocationID.xy), vec4(length(ray_pos - camera_position), 0, 0, 0));
                         return;
                     }
@@ -153,7 +186,7 @@ void main() {
                         filtered_low = current_node.bitmask_low;
                         filtered_high = current_node.bitmask_high & ((1u << (bitmask_index - 32)) - 1u);
                     }
-                    uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + uint((current_node.header & ~(0x3u << 30))/SIZEOF_NODE);
+                    uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + (current_node.header & ~(0x3u << 30));
 
                     // going down
                     depth += 1;
@@ -1,7 +1,6 @@
 const char secondary_ray_glsl[] = R""(
 #version 460 core
 
-#define SIZEOF_NODE 12
 #define NODE_WIDTH 4
 #define NODE_WIDTH_SQRT 2
 #define MINI_STEP_SIZE 5e-3f
@@ -130,9 +129,9 @@ void main() {
         if(has_collided){
             do{
                 // if there is a hit on a voxel in a terminal node: return hit color
-                if((current_node.header & (0x1u << 30)) != 0) {
-                    bool is_lod = (current_node.header & (0x1u << 31)) != 0;
-                    uint color_index = is_lod ? (current_node.header & ~(0x3u << 30))-1 : 0;
+                if((current_node.header >> 30) != 0u) {
+                    bool is_lod = (current_node.header >> 30) == 0x3u;
+                    uint color_index = is_lod ? (current_node.header & 0xffu)-1 : 0;
                     vec3 color = colors[color_index]*dot(step_mask*vec3(0.9, 0.7, 0.4), vec3(1));
                     imageStore(outImage, ivec2(gl_GlobalInvocationID.xy), vec4(color, 1));
                     return;
@@ -142,7 +141,7 @@ void main() {
                 uint filtered_low, filtered_high;
                 if (bitmask_index < 32) { filtered_low = current_node.bitmask_low & ((1u << bitmask_index) - 1u); filtered_high = 0u; }
                 else { filtered_low = current_node.bitmask_low; filtered_high = current_node.bitmask_high & ((1u << (bitmask_index - 32)) - 1u); }
-                uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + uint((current_node.header & ~(0x3u << 30))/SIZEOF_NODE);
+                uint hit_index = uint(bitCount(filtered_low) + bitCount(filtered_high)) + (current_node.header & ~(0x3u << 30));
 
                 // going down
                 depth += 1;
@@ -0,0 +1,523 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include "glm/geometric.hpp"
+#include "glm/matrix.hpp"
+#include "glm/vec4.hpp"
+#include "ivy_thread.h"
+#include "client/client.h"
+#include "client/utils/cpu_tracer.h"
+#include "server/generators/generator.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define MINI_STEP_SIZE 5e-3f
+
+namespace client::utils {
+    namespace {
+        const float world_min = MINI_STEP_SIZE, world_max = float(IVY_REGION_WIDTH) - MINI_STEP_SIZE;
+
+        /**
+         * Same as AABBIntersect in main_pass.glsl, against the world bounding box.
+         */
+        float aabb_intersect(const float origin[3], const float inverted_direction[3], float step_mask[3]) {
+            float vmin[3], vmax[3];
+            for (int a = 0; a < 3; a++) {
+                float t0 = (world_min - origin[a]) * inverted_direction[a];
+                float t1 = (world_max - origin[a]) * inverted_direction[a];
+                vmin[a] = std::min(t0, t1);
+                vmax[a] = std::max(t0, t1);
+            }
+            float tmin = std::max(vmin[0], std::max(vmin[1], vmin[2]));
+            float tmax = std::min(vmax[0], std::min(vmax[1], vmax[2]));
+            if (tmax < tmin || tmax < 0.0f) return -1.0f;
+            for (int a = 0; a < 3; a++) step_mask[a] = tmin >= vmin[a] ? 1.0f : 0.0f;
+            return std::max(0.0f, tmin);
+        }
+
+        bool is_outside(const float position[3], const float box_min[3], const float box_max[3]) {
+            return position[0] >= box_max[0] || position[1] >= box_max[1] || position[2] >= box_max[2] ||
+                   position[0] < box_min[0] || position[1] < box_min[1] || position[2] < box_min[2];
+        }
+
+        bool is_outside_world(const float position[3]) {
+            const float box_min[3] = {world_min, world_min, world_min}, box_max[3] = {world_max, world_max, world_max};
+            return is_outside(position, box_min, box_max);
+        }
+
+        /**
+         * @return The index, in the bitmap of a node of children of the given width, of the child containing the given position. Like in
+         * the shader, the y axis of the world is the z axis of the tree.
+         */
+        uint32_t bitmask_index_at(const float position[3], uint32_t node_width) {
+            uint32_t mask = node_width * IVY_NODE_WIDTH - 1u;
+            int shift = __builtin_ctz(node_width);
+            uint32_t vx = (uint32_t(position[0]) & mask) >> shift, vy = (uint32_t(position[1]) & mask) >> shift, vz = (uint32_t(position[2]) & mask) >> shift;
+            return vx + (vz << IVY_NODE_WIDTH_SQRT) + (vy << IVY_NODE_WIDTH);
+        }
+
+        const Node *child_at(const Node *node, uint32_t bitmask_index) {
+            auto *child_array = (const Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            return &child_array[__builtin_popcountll(node->bitmap & ~(UINT64_MAX << bitmask_index))];
+        }
+
+        Material material_at(const Node *node, uint32_t bitmask_index) {
+            return get_leaf_voxel(*node, int(bitmask_index)).material;
+        }
+
+        /**
+         * @return Whether a hit on a child of the given width, at the given position, is shaded with the LOD voxel of the child rather
+         * than going down to it, that is whether the child is no wider than the footprint of the ray there.
+         */
+        bool is_below_footprint(uint32_t node_width, const float position[3], const float origin[3], float lod_cone) {
+            float x = position[0] - origin[0], y = position[1] - origin[1], z = position[2] - origin[2];
+            return float(node_width) <= lod_cone * std::sqrt(x * x + y * y + z * z);
+        }
+
+        /**
+         * Same as getRayDir in main_pass.glsl.
+         */
+        glm::vec3 ray_direction(int x, int y, const CpuImage &image, const glm::mat4 &inverse_view_matrix, const glm::mat4 &inverse_projection_matrix) {
+            float screen_x = (float(x) + 0.5f) / float(image.width), screen_y = 1.0f - (float(y) + 0.5f) / float(image.height);
+            glm::vec4 clip_space = {screen_x * 2.0f - 1.0f, screen_y * 2.0f - 1.0f, -1.0f, 1.0f};
+            glm::vec4 eye_space = inverse_projection_matrix * clip_space;
+            eye_space = {eye_space.x, eye_space.y, -1.0f, 0.0f};
+            return glm::normalize(glm::vec3(inverse_view_matrix * eye_space));
+        }
+
+#if defined(__x86_64__)
+        /**
+         * The packet version of CpuTracer::trace. Every ray of the packet does one DDA step per iteration, in the AVX2 lanes. The rays that
+         * hit something or left their node are then handled one by one, the same way as in the scalar version, before the next iteration.
+         */
+        __attribute__((target("avx2")))
+        void trace_packet_avx2(const Node *root, float lod_cone, uint32_t dda_step_limit, uint32_t tree_step_limit, glm::vec3 *ray_positions,
+                               const glm::vec3 *ray_directions, Material *materials, int ray_count, TraceStats &stats, uint32_t *step_counts) {
+            alignas(32) float origin[3][8], position[3][8], direction[3][8], inverted_direction[3][8], sign_11[3][8], sign_01[3][8];
+            alignas(32) float lbmin[3][8], lbmax[3][8];
+            alignas(32) uint32_t node_width[8], node_shift[8], bitmap_low[8], bitmap_high[8], dda_steps[8], tree_steps[8] = {};
+            const Node *node[8], *stack[8][IVY_REGION_TREE_DEPTH + 1];
+            int depth[8];
+            uint32_t active = 0;
+
+            auto load_node = [&](int lane, const Node *new_node, uint32_t new_node_width) {
+                node[lane] = new_node;
+                node_width[lane] = new_node_width;
+                node_shift[lane] = __builtin_ctz(new_node_width);
+                bitmap_low[lane] = uint32_t(new_node->bitmap);
+                bitmap_high[lane] = uint32_t(new_node->bitmap >> 32);
+            };
+
+            // Setting up the rays one by one, including the jump to the world bounding box. Unused lanes get harmless values.
+            stats.ray_count += ray_count;
+            for (int lane = 0; lane < 8; lane++) {
+                glm::vec3 ray_position = lane < ray_count ? ray_positions[lane] : glm::vec3(1.0f);
+                glm::vec3 ray_direction = lane < ray_count ? ray_directions[lane] : glm::vec3(1.0f);
+                float lane_origin[3], inverted[3], step_mask[3];
+                for (int a = 0; a < 3; a++) {
+                    lane_origin[a] = origin[a][lane] = position[a][lane] = ray_position[a];
+                    direction[a][lane] = ray_direction[a];
+                    inverted[a] = inverted_direction[a][lane] = 1.0f / ray_direction[a];
+                    sign_11[a][lane] = ray_direction[a] < 0.0f ? -1.0f : 1.0f;
+                    sign_01[a][lane] = std::max(sign_11[a][lane], 0.0f);
+                    lbmin[a][lane] = 0.0f;
+                    lbmax[a][lane] = float(IVY_REGION_WIDTH);
+                }
+                load_node(lane, root, uint32_t(IVY_REGION_WIDTH) >> IVY_NODE_WIDTH_SQRT);
+                stack[lane][0] = root;
+                depth[lane] = 0;
+                if (lane >= ray_count) continue;
+                materials[lane] = AIR;
+                if (is_outside_world(lane_origin)) {
+                    float intersect = aabb_intersect(lane_origin, inverted, step_mask);
+                    if (intersect < 0) continue;
+                    for (int a = 0; a < 3; a++) {
+                        if (intersect > 0) position[a][lane] += direction[a][lane] * intersect + step_mask[a] * sign_11[a][lane] * MINI_STEP_SIZE;
+                    }
+                }
+                stats.node_visits += 1;
+                active |= 0x1u << lane;
+            }
+
+            // Going down the tree until a voxel is hit, or until a node with no hit at the current position is found
+            auto descend = [&](int lane) {
+                float lane_position[3] = {position[0][lane], position[1][lane], position[2][lane]};
+                float lane_origin[3] = {origin[0][lane], origin[1][lane], origin[2][lane]};
+                const Node *current_node = node[lane];
+                uint32_t current_node_width = node_width[lane];
+                uint32_t bitmask_index = bitmask_index_at(lane_position, current_node_width);
+                do {
+                    if ((current_node->header >> 30) != 0b00u) {
+                        materials[lane] = material_at(current_node, bitmask_index);
+                        for (int a = 0; a < 3; a++) position[a][lane] -= MINI_STEP_SIZE * sign_11[a][lane];
+                        stats.hit_count += 1;
+                        active &= ~(0x1u << lane);
+                        return;
+                    }
+                    if (is_below_footprint(current_node_width, lane_position, lane_origin, lod_cone)) {
+                        materials[lane] = get_lod_voxel(*child_at(current_node, bitmask_index)).material;
+                        for (int a = 0; a < 3; a++) position[a][lane] -= MINI_STEP_SIZE * sign_11[a][lane];
+                        stats.hit_count += 1;
+                        stats.lod_hit_count += 1;
+                        active &= ~(0x1u << lane);
+                        return;
+                    }
+                    if (tree_steps[lane] == tree_step_limit) {
+                        stats.truncated_count += 1;
+                        active &= ~(0x1u << lane);
+                        return;
+                    }
+                    tree_steps[lane] += 1;
+                    depth[lane] += 1;
+                    stack[lane][depth[lane]] = current_node;
+                    current_node = child_at(current_node, bitmask_index);
+                    current_node_width = current_node_width >> IVY_NODE_WIDTH_SQRT;
+                    stats.node_visits += 1;
+                    bitmask_index = bitmask_index_at(lane_position, current_node_width);
+                } while ((current_node->bitmap & (0x1ul << bitmask_index)) != 0);
+                load_node(lane, current_node, current_node_width);
+                for (int a = 0; a < 3; a++) {
+                    lbmin[a][lane] = float(uint32_t(lane_position[a]) & ~(current_node_width * IVY_NODE_WIDTH - 1u));
+                    lbmax[a][lane] = lbmin[a][lane] + float(current_node_width * IVY_NODE_WIDTH);
+                }
+            };
+
+            // Going up the tree until the node containing the current position is found
+            auto ascend = [&](int lane) {
+                float lane_position[3] = {position[0][lane], position[1][lane], position[2][lane]};
+                float box_min[3], box_max[3];
+                const Node *current_node;
+                uint32_t current_node_width = node_width[lane];
+                do {
+                    if (tree_steps[lane] == tree_step_limit) {
+                        stats.truncated_count += 1;
+                        active &= ~(0x1u << lane);
+                        return;
+                    }
+                    tree_steps[lane] += 1;
+                    current_node = stack[lane][depth[lane]];
+                    depth[lane] -= 1;
+                    stats.node_visits += 1;
+                    current_node_width = current_node_width << IVY_NODE_WIDTH_SQRT;
+                    for (int a = 0; a < 3; a++) {
+                        box_min[a] = lbmin[a][lane] = float(uint32_t(lbmin[a][lane]) & ~(current_node_width * IVY_NODE_WIDTH - 1u));
+                        box_max[a] = lbmax[a][lane] = lbmin[a][lane] + float(current_node_width * IVY_NODE_WIDTH);
+                    }
+                } while (is_outside(lane_position, box_min, box_max));
+                load_node(lane, current_node, current_node_width);
+            };
+
+            const __m256 mini_step = _mm256_set1_ps(MINI_STEP_SIZE), world_min_8 = _mm256_set1_ps(world_min), world_max_8 = _mm256_set1_ps(world_max);
+            const __m256i one = _mm256_set1_epi32(1), low_bits = _mm256_set1_epi32(31), zero = _mm256_setzero_si256();
+            const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128), dda_step_limit_8 = _mm256_set1_epi32(int(dda_step_limit));
+            __m256i dda_step_count = _mm256_setzero_si256();
+            __m256 ray_dir[3], inverted_ray_dir[3], ray_sign_11[3], ray_sign_01[3];
+            for (int a = 0; a < 3; a++) {
+                ray_dir[a] = _mm256_load_ps(direction[a]);
+                inverted_ray_dir[a] = _mm256_load_ps(inverted_direction[a]);
+                ray_sign_11[a] = _mm256_load_ps(sign_11[a]);
+                ray_sign_01[a] = _mm256_load_ps(sign_01[a]);
+            }
+
+            while (active != 0) {
+                // Stopping the rays that are out of budget, then counting the DDA step of the others
+                __m256i is_active = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(active)), lane_bits), lane_bits);
+                uint32_t exhausted = active & uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(dda_step_count, dda_step_limit_8))));
+                if (exhausted != 0) {
+                    stats.truncated_count += __builtin_popcount(exhausted);
+                    active &= ~exhausted;
+                    if (active == 0) break;
+                    is_active = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(active)), lane_bits), lane_bits);
+                }
+                dda_step_count = _mm256_sub_epi32(dda_step_count, is_active);
+
+                // Check hit, for every ray at once
+                __m256 ray_pos[3];
+                __m256i v[3];
+                __m256i width = _mm256_load_si256((const __m256i *) node_width), shift = _mm256_load_si256((const __m256i *) node_shift);
+                __m256i mask = _mm256_sub_epi32(_mm256_slli_epi32(width, IVY_NODE_WIDTH_SQRT), one);
+                for (int a = 0; a < 3; a++) {
+                    ray_pos[a] = _mm256_load_ps(position[a]);
+                    v[a] = _mm256_srlv_epi32(_mm256_and_si256(_mm256_cvttps_epi32(ray_pos[a]), mask), shift);
+                }
+                __m256i bitmask_index = _mm256_add_epi32(v[0], _mm256_add_epi32(_mm256_slli_epi32(v[2], IVY_NODE_WIDTH_SQRT), _mm256_slli_epi32(v[1], IVY_NODE_WIDTH)));
+                __m256i bitmap = _mm256_blendv_epi8(_mm256_load_si256((const __m256i *) bitmap_low), _mm256_load_si256((const __m256i *) bitmap_high),
+                                                    _mm256_cmpgt_epi32(bitmask_index, low_bits));
+                __m256i bit = _mm256_sllv_epi32(one, _mm256_and_si256(bitmask_index, low_bits));
+                __m256i missed = _mm256_cmpeq_epi32(_mm256_and_si256(bitmap, bit), zero);
+                __m256 moving = _mm256_castsi256_ps(_mm256_and_si256(missed, is_active));
+                uint32_t hits = active & ~uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(missed)));
+
+                // DDA step for the rays that did not hit anything
+                __m256 node_width_8 = _mm256_cvtepi32_ps(width), side_dist[3];
+                for (int a = 0; a < 3; a++) {
+                    __m256 node_offset = _mm256_sub_ps(ray_pos[a], _mm256_mul_ps(node_width_8, _mm256_floor_ps(_mm256_div_ps(ray_pos[a], node_width_8))));
+                    side_dist[a] = _mm256_mul_ps(inverted_ray_dir[a], _mm256_sub_ps(_mm256_mul_ps(node_width_8, ray_sign_01[a]), node_offset));
+                }
+                __m256 ray_step = _mm256_min_ps(_mm256_min_ps(side_dist[0], side_dist[1]), side_dist[2]);
+                __m256 exited_local = _mm256_setzero_ps(), exited_global = _mm256_setzero_ps();
+                for (int a = 0; a < 3; a++) {
+                    __m256 step_mask = _mm256_cmp_ps(ray_step, side_dist[a], _CMP_EQ_OQ);
+                    __m256 mini_step_offset = _mm256_and_ps(step_mask, _mm256_mul_ps(mini_step, ray_sign_11[a]));
+                    __m256 stepped = _mm256_add_ps(_mm256_add_ps(ray_pos[a], _mm256_mul_ps(ray_dir[a], ray_step)), mini_step_offset);
+                    ray_pos[a] = _mm256_blendv_ps(ray_pos[a], stepped, moving);
+                    _mm256_store_ps(position[a], ray_pos[a]);
+
+                    // check bbox
+                    exited_local = _mm256_or_ps(exited_local, _mm256_or_ps(_mm256_cmp_ps(ray_pos[a], _mm256_load_ps(lbmax[a]), _CMP_GE_OQ),
+                                                                           _mm256_cmp_ps(ray_pos[a], _mm256_load_ps(lbmin[a]), _CMP_LT_OQ)));
+                    exited_global = _mm256_or_ps(exited_global, _mm256_or_ps(_mm256_cmp_ps(ray_pos[a], world_max_8, _CMP_GE_OQ),
+                                                                             _mm256_cmp_ps(ray_pos[a], world_min_8, _CMP_LT_OQ)));
+                }
+                uint32_t moved = uint32_t(_mm256_movemask_ps(moving));
+                uint32_t exits_global = moved & uint32_t(_mm256_movemask_ps(exited_global));
+                uint32_t exits_local = moved & uint32_t(_mm256_movemask_ps(exited_local)) & ~exits_global;
+                stats.dda_steps += __builtin_popcount(active);
+
+                // Then going down or up the tree for the rays that need it, one at a time
+                active &= ~exits_global;
+                for (uint32_t lanes = hits; lanes != 0; lanes &= lanes - 1) descend(__builtin_ctz(lanes));
+                for (uint32_t lanes = exits_local; lanes != 0; lanes &= lanes - 1) ascend(__builtin_ctz(lanes));
+            }
+
+            _mm256_store_si256((__m256i *) dda_steps, dda_step_count);
+            for (int lane = 0; lane < ray_count; lane++) {
+                ray_positions[lane] = glm::vec3(position[0][lane], position[1][lane], position[2][lane]);
+                if (step_counts != nullptr) step_counts[lane] = dda_steps[lane] + tree_steps[lane];
+            }
+        }
+#endif
+    }
+
+    TraceStats &TraceStats::operator+=(const TraceStats &other) {
+        ray_count += other.ray_count;
+        dda_steps += other.dda_steps;
+        node_visits += other.node_visits;
+        hit_count += other.hit_count;
+        lod_hit_count += other.lod_hit_count;
+        truncated_count += other.truncated_count;
+        return *this;
+    }
+
+    CpuTracer::CpuTracer(const WideTree &tree) : root((const Node *) memory_pool->to_pointer(tree.get_root_node())) {}
+
+    void CpuTracer::set_lod_cone(float cone) {
+        lod_cone = cone;
+    }
+
+    void CpuTracer::set_step_limits(int dda_step_limit, int tree_step_limit) {
+        this->dda_step_limit = dda_step_limit > 0 ? uint32_t(dda_step_limit) : UINT32_MAX;
+        this->tree_step_limit = tree_step_limit > 0 ? uint32_t(tree_step_limit) : UINT32_MAX;
+    }
+
+    float CpuTracer::get_lod_cone(const glm::mat4 &projection_matrix, int image_height, float pixel_size) {
+        // The vertical field of view spans 2 / projection_matrix[1][1] units of distance per unit of depth
+        return pixel_size * 2.0f / (projection_matrix[1][1] * float(image_height));
+    }
+
+    Material CpuTracer::trace(glm::vec3 &ray_position, glm::vec3 ray_direction, TraceStats &stats, uint32_t *step_count) const {
+        // caching a few commonly used values
+        float origin[3], position[3], direction[3], inverted_direction[3], sign_11[3], sign_01[3];
+        for (int a = 0; a < 3; a++) {
+            origin[a] = position[a] = ray_position[a];
+            direction[a] = ray_direction[a];
+            inverted_direction[a] = 1.0f / direction[a];
+            sign_11[a] = direction[a] < 0.0f ? -1.0f : 1.0f;
+            sign_01[a] = std::max(sign_11[a], 0.0f);
+        }
+        stats.ray_count += 1;
+
+        // a variable used to know which direction we have to mini-step to after each step (including the AABB jump step)
+        float step_mask[3] = {};
+
+        // the work done by the ray so far, written back whichever way the ray ends
+        uint32_t dda_steps = 0, tree_steps = 0;
+        auto end_ray = [&](Material material) {
+            ray_position = glm::vec3(position[0], position[1], position[2]);
+            if (step_count != nullptr) *step_count = dda_steps + tree_steps;
+            return material;
+        };
+
+        // ray-box intersection and a big step if the camera is outside the voxel volume
+        if (is_outside_world(position)) {
+            float intersect = aabb_intersect(position, inverted_direction, step_mask);
+            if (intersect < 0) return end_ray(AIR);
+            for (int a = 0; a < 3; a++) {
+                if (intersect > 0) position[a] += direction[a] * intersect + step_mask[a] * sign_11[a] * MINI_STEP_SIZE;
+            }
+        }
+
+        // creating variables to track the size and bounding box of the **current** node, as well as the state of the current step
+        float lbmin[3] = {0.0f, 0.0f, 0.0f}, lbmax[3] = {float(IVY_REGION_WIDTH), float(IVY_REGION_WIDTH), float(IVY_REGION_WIDTH)};
+        uint32_t node_width = uint32_t(IVY_REGION_WIDTH) >> IVY_NODE_WIDTH_SQRT;
+        bool has_collided, exited_local = false, exited_global = false;
+
+        // setting up the stack & recurrent variables that will be used to traverse the 64-tree
+        const Node *stack[IVY_REGION_TREE_DEPTH + 1];
+        int depth = 0;
+        const Node *node = root;
+        uint32_t bitmask_index;
+        stack[depth] = node;
+        stats.node_visits += 1;
+
+        // Doing the actual traversal!
+        do {
+            // For the most part, we are doing the classical DDA algorithm in this do-while loop
+            do {
+                // stop there if the ray is out of budget
+                if (dda_steps == dda_step_limit) {
+                    stats.truncated_count += 1;
+                    return end_ray(AIR);
+                }
+
+                // check hit
+                stats.dda_steps += 1;
+                dda_steps += 1;
+                bitmask_index = bitmask_index_at(position, node_width);
+                has_collided = (node->bitmap & (0x1ul << bitmask_index)) != 0;
+                if (has_collided) break;
+
+                // dda step, normal extraction, and mini-step
+                float side_dist[3];
+                for (int a = 0; a < 3; a++) {
+                    float node_offset = position[a] - float(node_width) * std::floor(position[a] / float(node_width));
+                    side_dist[a] = inverted_direction[a] * (float(node_width) * sign_01[a] - node_offset);
+                }
+                float ray_step = std::min(std::min(side_dist[0], side_dist[1]), side_dist[2]);
+                for (int a = 0; a < 3; a++) {
+                    step_mask[a] = ray_step == side_dist[a] ? 1.0f : 0.0f;
+                    position[a] += direction[a] * ray_step + MINI_STEP_SIZE * sign_11[a] * step_mask[a];
+                }
+
+                // check bbox
+                exited_local = is_outside(position, lbmin, lbmax);
+                exited_global = is_outside_world(position);
+            } while (!exited_local && !exited_global);
+
+            // First possible reason for exiting the DDA main loop: we hit something, so we need to either go down or return a color
+            if (has_collided) {
+                do {
+                    // if there is a hit on a voxel in a terminal node: return hit color
+                    if ((node->header >> 30) != 0b00u) {
+                        Material material = material_at(node, bitmask_index);
+                        for (int a = 0; a < 3; a++) position[a] -= MINI_STEP_SIZE * sign_11[a];
+                        stats.hit_count += 1;
+                        return end_ray(material);
+                    }
+
+                    // if the hit child is no wider than the footprint of the ray, shading it as a whole with its LOD voxel
+                    if (is_below_footprint(node_width, position, origin, lod_cone)) {
+                        Material material = get_lod_voxel(*child_at(node, bitmask_index)).material;
+                        for (int a = 0; a < 3; a++) position[a] -= MINI_STEP_SIZE * sign_11[a];
+                        stats.hit_count += 1;
+                        stats.lod_hit_count += 1;
+                        return end_ray(material);
+                    }
+
+                    // going down, if the ray is not out of budget
+                    if (tree_steps == tree_step_limit) {
+                        stats.truncated_count += 1;
+                        return end_ray(AIR);
+                    }
+                    tree_steps += 1;
+                    depth += 1;
+                    stack[depth] = node;
+                    node = child_at(node, bitmask_index);
+                    node_width = node_width >> IVY_NODE_WIDTH_SQRT;
+                    stats.node_visits += 1;
+
+                    // check hit
+                    bitmask_index = bitmask_index_at(position, node_width);
+                    has_collided = (node->bitmap & (0x1ul << bitmask_index)) != 0;
+                } while (has_collided);
+
+                // update lbb
+                for (int a = 0; a < 3; a++) {
+                    lbmin[a] = float(uint32_t(position[a]) & ~(node_width * IVY_NODE_WIDTH - 1u));
+                    lbmax[a] = lbmin[a] + float(node_width * IVY_NODE_WIDTH);
+                }
+            }
+
+            // Second possible reason for exiting the DDA main loop: we exited the current node, we have to go up
+            else if (exited_local && !exited_global) {
+                do {
+                    // go up, if the ray is not out of budget
+                    if (tree_steps == tree_step_limit) {
+                        stats.truncated_count += 1;
+                        return end_ray(AIR);
+                    }
+                    tree_steps += 1;
+                    node = stack[depth];
+                    depth -= 1;
+                    stats.node_visits += 1;
+
+                    // update node width
+                    node_width = node_width << IVY_NODE_WIDTH_SQRT;
+
+                    // update lbb
+                    for (int a = 0; a < 3; a++) {
+                        lbmin[a] = float(uint32_t(lbmin[a]) & ~(node_width * IVY_NODE_WIDTH - 1u));
+                        lbmax[a] = lbmin[a] + float(node_width * IVY_NODE_WIDTH);
+                    }
+
+                    // check if we're good to resume the DDA
+                    exited_local = is_outside(position, lbmin, lbmax);
+                } while (exited_local);
+            }
+        } while (!exited_global);
+        return end_ray(AIR);
+    }
+
+    void CpuTracer::trace_packet(glm::vec3 *ray_positions, const glm::vec3 *ray_directions, Material *materials, int ray_count, TraceStats &stats,
+                                 uint32_t *step_counts) const {
+#if defined(__x86_64__)
+        if (has_packet_support()) {
+            trace_packet_avx2(root, lod_cone, dda_step_limit, tree_step_limit, ray_positions, ray_directions, materials, ray_count, stats,
+                              step_counts);
+            return;
+        }
+#endif
+        for (int i = 0; i < ray_count; i++) materials[i] = trace(ray_positions[i], ray_directions[i], stats, step_counts ? &step_counts[i] : nullptr);
+    }
+
+    TraceStats CpuTracer::render(CpuImage &image, glm::vec3 camera_position, const glm::mat4 &view_matrix, const glm::mat4 &projection_matrix,
+                                 bool use_packets, int thread_count) const {
+        glm::mat4 inverse_view_matrix = glm::inverse(view_matrix), inverse_projection_matrix = glm::inverse(projection_matrix);
+        image.materials.assign(size_t(image.width) * size_t(image.height), AIR);
+        image.step_counts.assign(size_t(image.width) * size_t(image.height), 0);
+        TraceStats stats;
+        std::mutex stats_guard;
+        parallel_for(image.height, [&](int y) {
+            TraceStats row_stats;
+            glm::vec3 ray_positions[8], ray_directions[8];
+            Material materials[8];
+            for (int x = 0; x < image.width; x += 8) {
+                int ray_count = std::min(8, image.width - x);
+                for (int i = 0; i < ray_count; i++) {
+                    ray_positions[i] = camera_position;
+                    ray_directions[i] = ray_direction(x + i, y, image, inverse_view_matrix, inverse_projection_matrix);
+                }
+                uint32_t *step_counts = &image.step_counts[x + size_t(y) * image.width];
+                if (use_packets) {
+                    trace_packet(ray_positions, ray_directions, materials, ray_count, row_stats, step_counts);
+                } else {
+                    for (int i = 0; i < ray_count; i++) materials[i] = trace(ray_positions[i], ray_directions[i], row_stats, &step_counts[i]);
+                }
+                std::copy(materials, materials + ray_count, &image.materials[x + size_t(y) * image.width]);
+            }
+            std::lock_guard<std::mutex> lock(stats_guard);
+            stats += row_stats;
+        }, thread_count);
+        return stats;
+    }
+
+    bool CpuTracer::has_packet_support() {
+#if defined(__x86_64__)
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "glm/vec3.hpp"
+#include "glm/mat4x4.hpp"
+#include "client/utils/wide_tree.h"
+#include "common/world/voxel.h"
+
+namespace client::utils {
+    struct TraceStats {
+        uint64_t ray_count = 0;
+        uint64_t dda_steps = 0;  // Iterations of the DDA loop, summed over every ray
+        uint64_t node_visits = 0;  // Nodes entered while going down or up the tree, the root included
+        uint64_t hit_count = 0;
+        uint64_t lod_hit_count = 0;  // Hits on nodes narrower than the footprint of the ray, shaded with their LOD voxel
+        uint64_t truncated_count = 0;  // Rays stopped by a step limit before hitting anything or leaving the world
+
+        TraceStats &operator+=(const TraceStats &other);
+    };
+
+    struct CpuImage {
+        int width = 0, height = 0;
+        std::vector<uint8_t> materials;  // One material per pixel, row by row from the top, AIR where the ray escaped the world
+        std::vector<uint32_t> step_counts;  // DDA steps plus tree steps of the ray of each pixel, in the same order
+    };
+
+    /**
+     * A C++ port of the raytrace() function of baseline/main_pass.glsl, so that the traversal of a WideTree can be benchmarked and
+     * regression-tested without a GPU. It follows the shader step by step, with the same single-precision maths, except that hits on
+     * voxel arrays return the actual voxel material where the shader uses a placeholder color.
+     */
+    class CpuTracer {
+        const Node *root;
+        float lod_cone = 0.0f;
+        uint32_t dda_step_limit = UINT32_MAX, tree_step_limit = UINT32_MAX;
+    public:
+        explicit CpuTracer(const WideTree &tree);
+
+        /**
+         * Set the width of the footprint of a ray per unit of distance traveled. Once a ray hits a node no wider than its footprint, the
+         * node is shaded as a whole with its LOD voxel instead of being traversed, like main_pass.glsl does. 0, the default, traces every
+         * ray down to the voxels.
+         */
+        void set_lod_cone(float cone);
+
+        /**
+         * @return The LOD cone for which the footprint of a ray is the given number of pixels, with the given projection and image height.
+         */
+        static float get_lod_cone(const glm::mat4 &projection_matrix, int image_height, float pixel_size);
+
+        /**
+         * Cap the work of every ray, like the uniforms of the same names do in main_pass.glsl: a ray runs at most dda_step_limit
+         * iterations of the DDA loop, and takes at most tree_step_limit tree steps, that is nodes entered while going down or up the
+         * tree. A ray reaching either limit stops there and counts as a miss. 0, the default, means no limit.
+         */
+        void set_step_limits(int dda_step_limit, int tree_step_limit);
+
+        /**
+         * Trace a single ray through the tree.
+         * @param ray_position The ray origin, moved to the hit position if something was hit.
+         * @param ray_direction The normalized ray direction.
+         * @param step_count If not null, set to the DDA steps plus tree steps of the ray.
+         * @return The material that was hit, or AIR.
+         */
+        Material trace(glm::vec3 &ray_position, glm::vec3 ray_direction, TraceStats &stats, uint32_t *step_count = nullptr) const;
+
+        /**
+         * Trace up to 8 rays at once, using AVX2 to run the DDA steps of every ray of the packet in lockstep. Going down and up the tree
+         * is done ray by ray. Falls back on trace() when AVX2 is not available.
+         * @param ray_positions Ray origins, moved to the hit positions.
+         * @param materials Output materials, AIR for the rays that hit nothing.
+         * @param step_counts If not null, set to the DDA steps plus tree steps of each ray.
+         */
+        void trace_packet(glm::vec3 *ray_positions, const glm::vec3 *ray_directions, Material *materials, int ray_count, TraceStats &stats,
+                          uint32_t *step_counts = nullptr) const;
+
+        /**
+         * Render a frame the same way main_pass.glsl builds its primary rays, rows being spread over several threads. The step count of
+         * every pixel is written along with its material.
+         * @param use_packets Whether to trace rays 8 by 8 with trace_packet, or one by one with trace.
+         * @param thread_count Number of threads, 0 meaning one per hardware thread.
+         */
+        TraceStats render(CpuImage &image, glm::vec3 camera_position, const glm::mat4 &view_matrix, const glm::mat4 &projection_matrix,
+                          bool use_packets = true, int thread_count = 0) const;
+
+        /**
+         * @return Whether trace_packet actually runs on AVX2 on this machine.
+         */
+        static bool has_packet_support();
+    };
+}
\ No newline at end of file
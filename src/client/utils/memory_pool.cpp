@@ -1,19 +1,23 @@
+#include <cassert>
+#include <cstdio>
 #include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "ivy_log.h"
 #include "client/utils/memory_pool.h"
 
 MemoryPoolClient::MemoryPoolClient(FastMemoryPool *src) : source(src), pools() {}
 
 MemoryPoolClient::~MemoryPoolClient() {
-    for (int i = 0; i < 64; ++i) {
-        for (void *block: pools[i].blocks) {
-            source->deallocate(block);
-        }
-    }
+    // Giving back the blocks of every size class, then the spans, each with a single push on the free block stack
+    std::vector<void *> blocks;
+    for (const auto &pool: pools) blocks.insert(blocks.end(), pool.blocks.begin(), pool.blocks.end());
+    source->deallocate_blocks(blocks);
+    source->deallocate_blocks(span_blocks, true);
 }
 
 void *MemoryPoolClient::allocate(int size) {
-    if (size < 1 || (size > 64 && size % 12 != 0) || size > 64 * 12) {
+    if (size < 1 || (size > 64 && size % 12 != 0) || size > 65 * 12) {
         fatal("Invalid size: %d", size);
     }
 
@@ -21,9 +25,21 @@ void *MemoryPoolClient::allocate(int size) {
     SubPool &pool = pools[idx];
     pool.allocated += size;
 
-    if (!pool.holes.empty()) {
-        void *ptr = pool.holes.front();
-        pool.holes.pop_front();
+    // Reusing the last deallocated slot first. Slots are not aligned, hence the copies of their next address.
+    if (pool.holes != nullptr) {
+        void *ptr = pool.holes;
+        memcpy(&pool.holes, ptr, sizeof(void *));
+        pool.hole_count--;
+        source->count_live_bytes(ptr, size, true);
+        source->mark_dirty(ptr, size);
+        return ptr;
+    }
+    if (!pool.small_holes.empty()) {
+        void *ptr = pool.small_holes.back();
+        pool.small_holes.pop_back();
+        pool.hole_count--;
+        source->count_live_bytes(ptr, size, true);
+        source->mark_dirty(ptr, size);
         return ptr;
     }
 
@@ -40,12 +56,14 @@ void *MemoryPoolClient::allocate(int size) {
 
     void *ptr = pool.next_alloc;
     pool.next_alloc = (char *) pool.next_alloc + size;
+    source->count_live_bytes(ptr, size, true);
+    source->mark_dirty(ptr, size);
 
     return ptr;
 }
 
 void MemoryPoolClient::deallocate(void *ptr, int size) {
-    if (size < 1 || (size > 64 && size % 12 != 0) || size > 64 * 12) {
+    if (size < 1 || (size > 64 && size % 12 != 0) || size > 65 * 12) {
         fatal("Invalid size");
     }
 
@@ -55,15 +73,258 @@ void MemoryPoolClient::deallocate(void *ptr, int size) {
 
     int idx = size > 64 ? int(size / 12) - 6 + 64 : size - 1;
     pools[idx].allocated -= size;
-    pools[idx].holes.push_back(ptr);
+    source->count_live_bytes(ptr, size, false);
+
+    // Slots overlapping evacuated blocks are not reused, the blocks are given back to the pool once empty instead. While free slots are
+    // being swept, the blocks may still hold some of them, so they are given back at the end of the sweep.
+    if (!evacuated_blocks.empty()) {
+        bool is_evacuated_slot = false;
+        for_each_block(ptr, size, [&](void *block, size_t) {
+            auto it = evacuated_blocks.find(block);
+            if (it == evacuated_blocks.end()) return;
+            is_evacuated_slot = true;
+            if (!is_sweeping && source->get_live_bytes(block) == 0) release_evacuated_block(it);
+        });
+        if (is_evacuated_slot) return;
+    }
+
+    pools[idx].hole_count++;
+    if (size >= int(sizeof(void *))) {
+        memcpy(ptr, &pools[idx].holes, sizeof(void *));
+        pools[idx].holes = ptr;
+    } else {
+        pools[idx].small_holes.push_back(ptr);
+    }
+}
+
+void *MemoryPoolClient::allocate_span(size_t size) {
+    size_t block_count = (size + source->chunk_size - 1) / source->chunk_size;
+    void *span = source->allocate_contiguous(block_count);
+    if (!span) {
+        fatal("Out of memory");
+    }
+    for (size_t i = 0; i < block_count; i++) span_blocks.push_back((char *) span + i * source->chunk_size);
+    if (size % source->chunk_size != 0) span_tail_bytes[span_blocks.back()] = size % source->chunk_size;
+    source->mark_dirty(span, size);
+    return span;
+}
+
+void *MemoryPoolClient::map_span(int fd, size_t offset, size_t size) {
+    void *span = allocate_span(size);
+    size_t span_size = (size + source->chunk_size - 1) / source->chunk_size * source->chunk_size;
+    size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    size_t mapped_size = (size + page_size - 1) / page_size * page_size;
+    if ((uintptr_t) span % page_size == 0 && offset % page_size == 0 && mapped_size <= span_size) {
+        if (mmap(span, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off_t(offset)) != MAP_FAILED) {
+            return span;
+        }
+    }
+
+    for (size_t read_size = 0; read_size < size;) {
+        ssize_t result = pread(fd, (char *) span + read_size, size - read_size, off_t(offset + read_size));
+        if (result <= 0) {
+            fatal("Could not read %zu bytes at offset %zu", size, offset);
+        }
+        read_size += size_t(result);
+    }
+    return span;
+}
+
+void *MemoryPoolClient::allocate_in_span(char *&cursor, int size) {
+    if (size < 1 || (size > 64 && size % 12 != 0) || size > 65 * 12) {
+        fatal("Invalid size: %d", size);
+    }
+
+    int idx = size > 64 ? int(size / 12) - 6 + 64 : size - 1;
+    pools[idx].allocated += size;
+    void *ptr = cursor;
+    cursor += size;
+    source->count_live_bytes(ptr, size, true);
+    source->mark_dirty(ptr, size);
+    return ptr;
 }
 
 uint32_t MemoryPoolClient::to_index(void *ptr) {
-    return uint32_t((char *) ptr - (char *) source->base_addr);
+    return source->to_index(ptr);
 }
 
 void *MemoryPoolClient::to_pointer(uint32_t index) {
-    return (char *) source->base_addr + index;
+    return source->to_pointer(index);
+}
+
+void MemoryPoolClient::mark_dirty() {
+    for (const auto &pool: pools) {
+        for (void *block: pool.blocks) {
+            source->mark_dirty(block, source->chunk_size);
+        }
+    }
+    for (void *block: span_blocks) {
+        source->mark_dirty(block, source->chunk_size);
+    }
+}
+
+void *MemoryPoolClient::get_block(const void *ptr) const {
+    size_t offset = size_t((const char *) ptr - (const char *) source->base_addr);
+    return (char *) source->base_addr + offset / source->chunk_size * source->chunk_size;
+}
+
+template<typename F> void MemoryPoolClient::for_each_block(const void *ptr, int size, F &&function) const {
+    for (const char *start = (const char *) ptr, *end = start + size; start < end;) {
+        auto *block = (char *) get_block(start);
+        size_t bytes = std::min(size_t(end - start), size_t(block + source->chunk_size - start));
+        function(block, bytes);
+        start += bytes;
+    }
+}
+
+std::unordered_map<void *, MemoryPoolClient::EvacuatedBlock>::iterator
+MemoryPoolClient::release_evacuated_block(std::unordered_map<void *, EvacuatedBlock>::iterator it) {
+    bool is_span_block = it->second.pool_index < 0;
+    std::vector<void *> &blocks = is_span_block ? span_blocks : pools[it->second.pool_index].blocks;
+    blocks.erase(std::find(blocks.begin(), blocks.end(), it->first));
+    if (is_span_block) span_tail_bytes.erase(it->first);
+    source->deallocate(it->first, is_span_block);
+    return evacuated_blocks.erase(it);
+}
+
+size_t MemoryPoolClient::begin_evacuation(float max_occupancy) {
+    assert(!is_sweeping && emptied_blocks.empty());
+    auto is_sparse = [&](void *block, size_t capacity) {
+        return float(source->get_live_bytes(block)) < max_occupancy * float(capacity) && evacuated_blocks.count(block) == 0;
+    };
+
+    // The allocated bytes of every block are known, so the sparse ones are selected without looking at their free slots
+    size_t selected_count = 0;
+    for (int idx = 0; idx < int(sizeof(pools) / sizeof(SubPool)); idx++) {
+        for (void *block: pools[idx].blocks) {
+            if (block == pools[idx].current_chunk || !is_sparse(block, source->chunk_size)) continue;
+            evacuated_blocks[block] = {idx};
+            selected_count++;
+        }
+    }
+    for (void *block: span_blocks) {
+        auto it = span_tail_bytes.find(block);
+        if (!is_sparse(block, it != span_tail_bytes.end() ? it->second : source->chunk_size)) continue;
+        evacuated_blocks[block] = {-1};
+        selected_count++;
+    }
+    if (selected_count == 0) return 0;
+
+    // The free slots of the selected blocks lie anywhere in the free lists, which are set aside to be swept a few at a time. Free slots
+    // can also lie in spans, so every free list is swept.
+    for (SubPool &pool: pools) {
+        pool.unswept_holes = pool.holes;
+        pool.holes = nullptr;
+        pool.unswept_small_holes.swap(pool.small_holes);
+    }
+    is_sweeping = true;
+    return selected_count;
+}
+
+bool MemoryPoolClient::sweep_free_slots(int &budget) {
+    for (int idx = 0; is_sweeping && idx < int(sizeof(pools) / sizeof(SubPool)); idx++) {
+        SubPool &pool = pools[idx];
+        int size = idx >= 64 ? (idx - 64 + 6) * 12 : idx + 1;
+        for (; pool.unswept_holes != nullptr && budget > 0; budget--) {
+            void *hole = pool.unswept_holes;
+            memcpy(&pool.unswept_holes, hole, sizeof(void *));
+            if (is_evacuated(hole, size)) {
+                pool.hole_count--;
+                continue;
+            }
+            memcpy(hole, &pool.holes, sizeof(void *));
+            pool.holes = hole;
+        }
+        for (; !pool.unswept_small_holes.empty() && budget > 0; budget--) {
+            void *hole = pool.unswept_small_holes.back();
+            pool.unswept_small_holes.pop_back();
+            if (is_evacuated(hole, size)) pool.hole_count--;
+            else pool.small_holes.push_back(hole);
+        }
+        if (pool.unswept_holes != nullptr || !pool.unswept_small_holes.empty()) return true;
+
+        // No free slot points into the evacuated blocks anymore once the last subpool is swept, so the empty ones can be given back
+        if (idx == int(sizeof(pools) / sizeof(SubPool)) - 1) {
+            is_sweeping = false;
+            for (auto &[block, evacuated_block]: evacuated_blocks) {
+                if (source->get_live_bytes(block) == 0) emptied_blocks.push_back(block);
+            }
+        }
+    }
+
+    // Each block given back takes a system call, which costs about as much as sweeping 32 free slots
+    for (; !emptied_blocks.empty() && budget > 0; budget = std::max(budget - 32, 0)) {
+        release_evacuated_block(evacuated_blocks.find(emptied_blocks.back()));
+        emptied_blocks.pop_back();
+    }
+    return is_sweeping || !emptied_blocks.empty();
+}
+
+bool MemoryPoolClient::is_evacuated(const void *ptr, int size) const {
+    if (evacuated_blocks.empty()) return false;
+    bool is_evacuated_slot = false;
+    for_each_block(ptr, size, [&](void *block, size_t) { is_evacuated_slot |= evacuated_blocks.count(block) != 0; });
+    return is_evacuated_slot;
+}
+
+size_t MemoryPoolClient::get_evacuated_count() const {
+    return evacuated_blocks.size();
+}
+
+void MemoryPoolClient::merge(MemoryPoolClient *client) {
+    assert(client->source == source && !is_sweeping && !client->is_sweeping);
+    for (int idx = 0; idx < int(sizeof(pools) / sizeof(SubPool)); idx++) {
+        SubPool &pool = pools[idx], &other = client->pools[idx];
+        int size = idx >= 64 ? (idx - 64 + 6) * 12 : idx + 1;
+        pool.allocated += other.allocated;
+        pool.blocks.insert(pool.blocks.end(), other.blocks.begin(), other.blocks.end());
+
+        // Keeping the block with the most room to fill, and turning the unfilled end of the other one into free slots
+        auto get_unfilled_bytes = [&](const SubPool &subpool) {
+            return subpool.next_alloc ? size_t((char *) subpool.current_chunk + source->chunk_size - (char *) subpool.next_alloc) : 0;
+        };
+        if (get_unfilled_bytes(other) > get_unfilled_bytes(pool)) {
+            std::swap(pool.next_alloc, other.next_alloc);
+            std::swap(pool.current_chunk, other.current_chunk);
+        }
+        for (size_t i = get_unfilled_bytes(other) / size; i > 0; i--) {
+            other.hole_count++;
+            if (size >= int(sizeof(void *))) {
+                memcpy(other.next_alloc, &other.holes, sizeof(void *));
+                other.holes = other.next_alloc;
+            } else {
+                other.small_holes.push_back(other.next_alloc);
+            }
+            other.next_alloc = (char *) other.next_alloc + size;
+        }
+
+        // Then appending the free slots of the other client to the ones of this client
+        if (other.holes != nullptr) {
+            void *tail = other.holes;
+            for (void *hole = other.holes; hole != nullptr; memcpy(&hole, hole, sizeof(void *))) tail = hole;
+            memcpy(tail, &pool.holes, sizeof(void *));
+            pool.holes = other.holes;
+        }
+        pool.small_holes.insert(pool.small_holes.end(), other.small_holes.begin(), other.small_holes.end());
+        pool.hole_count += other.hole_count;
+        other = SubPool();
+    }
+
+    span_blocks.insert(span_blocks.end(), client->span_blocks.begin(), client->span_blocks.end());
+    span_tail_bytes.merge(client->span_tail_bytes);
+    evacuated_blocks.merge(client->evacuated_blocks);
+    client->span_blocks.clear();
+}
+
+void MemoryPoolClient::add_stats(PoolStats &stats) const {
+    for (int idx = 0; idx < int(sizeof(pools) / sizeof(SubPool)); idx++) {
+        stats.size_classes[idx].live_bytes += pools[idx].allocated;
+        stats.size_classes[idx].hole_count += pools[idx].hole_count;
+        stats.size_classes[idx].block_count += pools[idx].blocks.size();
+        if (pools[idx].next_alloc) stats.unfilled_bytes += (char *) pools[idx].current_chunk + source->chunk_size - (char *) pools[idx].next_alloc;
+    }
+    stats.used += get_used_memory();
+    stats.span_block_count += span_blocks.size();
 }
 
 size_t MemoryPoolClient::get_used_memory() const {
@@ -77,12 +338,26 @@ size_t MemoryPoolClient::get_used_memory() const {
 // FastMemoryPool Implementation
 
 FastMemoryPool::FastMemoryPool(size_t max_size, size_t chunk_size)
-        : base_addr(nullptr), next(nullptr), max_size(max_size), chunk_size(chunk_size), allocated_blocks(0) {
+        : base_addr(nullptr), max_size(max_size), chunk_size(chunk_size), is_hugetlb(false), bumped_blocks(0), free_head(0), free_block_count(0) {
+    if (max_size > IVY_POOL_MAX_SIZE || chunk_size % IVY_POOL_INDEX_UNIT != 0) {
+        fatal("Invalid memory pool layout: %zu bytes in blocks of %zu bytes", max_size, chunk_size);
+    }
 
-    base_addr = std::aligned_alloc(64, max_size);
-    memset(base_addr, 0, max_size);
-    if (!base_addr) throw std::bad_alloc();
-    next = base_addr;
+    // Reserving the address space only: anonymous pages are zeroed and committed by the OS on first write. The mapping is page-aligned,
+    // so that files can be mapped in the pool blocks.
+    void *addr = MAP_FAILED;
+    if (IVY_POOL_HUGE_PAGES == 2) {
+        addr = mmap(nullptr, max_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_HUGETLB, -1, 0);
+        if (addr == MAP_FAILED) warn("Could not back the memory pool with huge pages, falling back to regular pages");
+        is_hugetlb = addr != MAP_FAILED;
+    }
+    if (addr == MAP_FAILED) addr = mmap(nullptr, max_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) throw std::bad_alloc();
+    if (IVY_POOL_HUGE_PAGES == 1) madvise(addr, max_size, MADV_HUGEPAGE);
+    base_addr = addr;
+    free_next = std::make_unique<std::atomic<uint32_t>[]>(max_size / chunk_size);
+    dirty_blocks = std::make_unique<std::atomic<uint64_t>[]>((max_size / chunk_size + 63) / 64);
+    live_bytes = std::make_unique<std::atomic<uint32_t>[]>(max_size / chunk_size);
 }
 
 FastMemoryPool::~FastMemoryPool() {
@@ -90,57 +365,162 @@ FastMemoryPool::~FastMemoryPool() {
         delete client;
     }
     if (base_addr) {
-        free(base_addr);
+        munmap(base_addr, max_size);
     }
 }
 
+void FastMemoryPool::push_free_blocks(uint32_t first, uint32_t last, size_t count) {
+    // Counted before being pushed, so that the count never falls below the size of the stack
+    free_block_count.fetch_add(count, std::memory_order_relaxed);
+    uint64_t head = free_head.load(std::memory_order_relaxed);
+    do {
+        free_next[last].store(uint32_t(head), std::memory_order_relaxed);
+    } while (!free_head.compare_exchange_weak(head, (((head >> 32) + 1) << 32) | (first + 1), std::memory_order_release, std::memory_order_relaxed));
+}
+
 void *FastMemoryPool::allocate() {
-    std::lock_guard<std::mutex> lock(guard);
+    // Popping a deallocated block first. The tag of the head changes on every update, so that a block popped and pushed back in the
+    // meantime cannot be mistaken for the one we read.
+    uint64_t head = free_head.load(std::memory_order_acquire);
+    while (uint32_t(head) != 0) {
+        uint32_t block = uint32_t(head) - 1;
+        uint64_t next = (((head >> 32) + 1) << 32) | free_next[block].load(std::memory_order_relaxed);
+        if (free_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+            free_block_count.fetch_sub(1, std::memory_order_relaxed);
+            return (char *) base_addr + block * chunk_size;
+        }
+    }
+
+    // Or bumping from the end of the pool
+    size_t block = bumped_blocks.load(std::memory_order_relaxed);
+    do {
+        if ((block + 1) * chunk_size > max_size) return nullptr;
+    } while (!bumped_blocks.compare_exchange_weak(block, block + 1, std::memory_order_relaxed));
+    return (char *) base_addr + block * chunk_size;
+}
+
+void *FastMemoryPool::allocate_contiguous(size_t block_count) {
+    std::lock_guard<std::mutex> lock(span_guard);
+
+    // Looking for a run of contiguous free blocks first, such as the span of a freed region. The whole stack is taken for that, so
+    // concurrent allocations bump new blocks in the meantime rather than waiting.
+    uint64_t head = free_head.load(std::memory_order_acquire);
+    while (uint32_t(head) != 0 && !free_head.compare_exchange_weak(head, ((head >> 32) + 1) << 32, std::memory_order_acquire)) {}
+    std::vector<uint32_t> free_blocks;
+    for (uint32_t block = uint32_t(head); block != 0; block = free_next[block - 1].load(std::memory_order_relaxed)) {
+        free_blocks.push_back(block - 1);
+    }
+    free_block_count.fetch_sub(free_blocks.size(), std::memory_order_relaxed);
 
+    void *allocated = nullptr;
+    if (free_blocks.size() >= block_count) {
+        std::sort(free_blocks.begin(), free_blocks.end());
+        size_t run_start = 0;
+        for (size_t i = 1; i <= free_blocks.size(); i++) {
+            if (i - run_start == block_count) {
+                allocated = (char *) base_addr + free_blocks[run_start] * chunk_size;
+                free_blocks.erase(free_blocks.begin() + long(run_start), free_blocks.begin() + long(i));
+                break;
+            }
+            if (i < free_blocks.size() && free_blocks[i] != free_blocks[i - 1] + 1) run_start = i;
+        }
+    }
+
+    // Giving the other blocks back, lowest first so that allocations stay packed at the start of the pool
     if (!free_blocks.empty()) {
-        void *reused_block = free_blocks.front();
-        free_blocks.pop_front();
-        return reused_block;
+        for (size_t i = 0; i + 1 < free_blocks.size(); i++) free_next[free_blocks[i]].store(free_blocks[i + 1] + 1, std::memory_order_relaxed);
+        push_free_blocks(free_blocks.front(), free_blocks.back(), free_blocks.size());
     }
+    if (allocated) return allocated;
 
-    if (next && ((char *) next - (char *) base_addr) + chunk_size <= max_size) {
-        void *allocated = next;
-        next = (char *) next + chunk_size;
-        ++allocated_blocks;  // Increment the number of allocated blocks
-        return allocated;
+    size_t block = bumped_blocks.load(std::memory_order_relaxed);
+    do {
+        if ((block + block_count) * chunk_size > max_size) return nullptr;
+    } while (!bumped_blocks.compare_exchange_weak(block, block + block_count, std::memory_order_relaxed));
+    return (char *) base_addr + block * chunk_size;
+}
+
+void FastMemoryPool::release_pages(void *ptr, size_t size, bool is_mapped) {
+    if (is_mapped && !is_hugetlb) {
+        if (mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            fatal("Could not unmap a block of the memory pool");
+        }
+    } else if (!is_hugetlb) {
+        madvise(ptr, size, MADV_DONTNEED);
     }
+}
 
-    return nullptr;
+void FastMemoryPool::deallocate(void *ptr, bool is_mapped) {
+    // Releasing the pages before the block can be handed out again
+    release_pages(ptr, chunk_size, is_mapped);
+    auto block = uint32_t(size_t((char *) ptr - (char *) base_addr) / chunk_size);
+    live_bytes[block].store(0, std::memory_order_relaxed);
+    push_free_blocks(block, block, 1);
 }
 
-void FastMemoryPool::deallocate(void *ptr) {
-    std::lock_guard<std::mutex> lock(guard);
-    free_blocks.push_back(ptr);
+void FastMemoryPool::deallocate_blocks(const std::vector<void *> &blocks, bool is_mapped) {
+    if (blocks.empty()) return;
+
+    // Releasing the pages of each run of adjacent blocks at once, such as spans or blocks bumped one after the other
+    for (size_t run_start = 0, i = 1; i <= blocks.size(); i++) {
+        if (i < blocks.size() && blocks[i] == (char *) blocks[i - 1] + chunk_size) continue;
+        release_pages(blocks[run_start], (i - run_start) * chunk_size, is_mapped);
+        run_start = i;
+    }
+
+    // Then chaining the blocks in their order, and pushing the chain on the free block stack
+    auto to_block = [this](void *ptr) { return uint32_t(size_t((char *) ptr - (char *) base_addr) / chunk_size); };
+    for (void *block: blocks) live_bytes[to_block(block)].store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i + 1 < blocks.size(); i++) free_next[to_block(blocks[i])].store(to_block(blocks[i + 1]) + 1, std::memory_order_relaxed);
+    push_free_blocks(to_block(blocks.front()), to_block(blocks.back()), blocks.size());
+}
+
+void FastMemoryPool::count_live_bytes(const void *ptr, int size, bool is_allocated) {
+    size_t offset = size_t((const char *) ptr - (const char *) base_addr), block = offset / chunk_size;
+    auto bytes = uint32_t(std::min(size_t(size), (block + 1) * chunk_size - offset));
+    for (; size > 0; size -= int(bytes), bytes = uint32_t(size), block++) {
+        if (is_allocated) live_bytes[block].fetch_add(bytes, std::memory_order_relaxed);
+        else live_bytes[block].fetch_sub(bytes, std::memory_order_relaxed);
+    }
+}
+
+uint32_t FastMemoryPool::get_live_bytes(const void *block) const {
+    return live_bytes[size_t((const char *) block - (const char *) base_addr) / chunk_size].load(std::memory_order_relaxed);
 }
 
 MemoryPoolClient *FastMemoryPool::create_client() {
     auto *client = new MemoryPoolClient(this);
+    std::lock_guard<std::mutex> lock(guard);
     clients.push_back(client);
     return client;
 }
 
 void FastMemoryPool::free_client(MemoryPoolClient *client) {
-    auto it = std::remove(clients.begin(), clients.end(), client);
-    if (it != clients.end()) {
-        clients.erase(it);
+    {
+        std::lock_guard<std::mutex> lock(guard);
+        auto it = std::remove(clients.begin(), clients.end(), client);
+        if (it != clients.end()) {
+            clients.erase(it);
+        }
     }
-    delete client;
+    delete client;  // Outside of the lock, since the client gives its blocks back through deallocate
 }
 
 size_t FastMemoryPool::size() {
     return max_size;
 }
 
+size_t FastMemoryPool::extent() {
+    return std::min(bumped_blocks.load(std::memory_order_relaxed) * chunk_size, max_size);
+}
+
 size_t FastMemoryPool::allocated() {
-    return allocated_blocks * chunk_size;
+    size_t free_blocks = free_block_count.load(std::memory_order_relaxed);
+    return (bumped_blocks.load(std::memory_order_relaxed) - free_blocks) * chunk_size;
 }
 
 size_t FastMemoryPool::used() {
+    std::lock_guard<std::mutex> lock(guard);
     if(clients.empty()) return 0;
     size_t used_memory = 0;
     for (const auto &client: clients) {
@@ -150,12 +530,82 @@ size_t FastMemoryPool::used() {
 }
 
 uint32_t FastMemoryPool::to_index(void *ptr) {
-    return uint32_t((char *) ptr - (char *) base_addr);
+    size_t offset = size_t((char *) ptr - (char *) base_addr);
+    assert(offset % IVY_POOL_INDEX_UNIT == 0);
+    return uint32_t(offset / IVY_POOL_INDEX_UNIT);
 }
 
 void *FastMemoryPool::to_pointer(uint32_t index) {
-    return (char *) base_addr + index;
+    return (char *) base_addr + size_t(index) * IVY_POOL_INDEX_UNIT;
 }
 size_t FastMemoryPool::get_chunk_size() const {
     return chunk_size;
 }
+
+PoolStats FastMemoryPool::get_stats() {
+    PoolStats stats = {};
+    stats.allocated = allocated();
+    stats.free_block_count = free_block_count.load(std::memory_order_relaxed);
+    stats.size_classes.resize(sizeof(MemoryPoolClient::pools) / sizeof(MemoryPoolClient::SubPool));
+    for (int idx = 0; idx < int(stats.size_classes.size()); idx++) stats.size_classes[idx].size = idx >= 64 ? (idx - 64 + 6) * 12 : idx + 1;
+    {
+        std::lock_guard<std::mutex> lock(guard);
+        stats.client_count = clients.size();
+        for (const auto &client: clients) client->add_stats(stats);
+    }
+
+    for (PoolSizeClassStats &size_class: stats.size_classes) {
+        size_t hole_bytes = size_class.hole_count * size_class.size;
+        if (hole_bytes > 0) size_class.fragmentation = double(hole_bytes) / double(size_class.live_bytes + hole_bytes);
+    }
+    std::erase_if(stats.size_classes, [](const PoolSizeClassStats &size_class) {
+        return size_class.block_count == 0 && size_class.live_bytes == 0 && size_class.hole_count == 0;
+    });
+    return stats;
+}
+
+std::string PoolStats::to_json() const {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             R"({"allocated":%zu,"used":%zu,"free_block_count":%zu,"span_block_count":%zu,"unfilled_bytes":%zu,"client_count":%zu,"size_classes":[)",
+             allocated, used, free_block_count, span_block_count, unfilled_bytes, client_count);
+    std::string json = buffer;
+    for (size_t i = 0; i < size_classes.size(); i++) {
+        const PoolSizeClassStats &size_class = size_classes[i];
+        snprintf(buffer, sizeof(buffer), R"(%s{"size":%d,"live_bytes":%zu,"hole_count":%zu,"block_count":%zu,"fragmentation":%.4f})",
+                 i == 0 ? "" : ",", size_class.size, size_class.live_bytes, size_class.hole_count, size_class.block_count, size_class.fragmentation);
+        json += buffer;
+    }
+    return json + "]}";
+}
+
+void FastMemoryPool::mark_dirty(const void *ptr, size_t size) {
+    if (size == 0 || ptr < base_addr || (const char *) ptr + size > (const char *) base_addr + max_size) return;
+    size_t first_block = size_t((const char *) ptr - (const char *) base_addr) / chunk_size;
+    size_t last_block = (size_t((const char *) ptr - (const char *) base_addr) + size - 1) / chunk_size;
+    for (size_t block = first_block; block <= last_block; block++) {
+        dirty_blocks[block / 64].fetch_or(0x1ul << (block % 64), std::memory_order_relaxed);
+    }
+}
+
+size_t FastMemoryPool::upload_dirty_blocks(PoolUploader &uploader) {
+    size_t uploaded_size = 0, range_start = 0, range_end = 0;
+    size_t word_count = (max_size / chunk_size + 63) / 64;
+    for (size_t word = 0; word < word_count; word++) {
+        if (dirty_blocks[word].load(std::memory_order_relaxed) == 0) continue;
+        uint64_t bits = dirty_blocks[word].exchange(0, std::memory_order_acquire);
+        for (; bits != 0; bits &= bits - 1) {
+            size_t block = word * 64 + __builtin_ctzll(bits);
+
+            // Consecutive dirty blocks are merged in a single range
+            if (range_end != block * chunk_size) {
+                if (range_end != range_start) uploader.upload(range_start, range_end - range_start, (char *) base_addr + range_start);
+                uploaded_size += range_end - range_start;
+                range_start = block * chunk_size;
+            }
+            range_end = block * chunk_size + chunk_size;
+        }
+    }
+    if (range_end != range_start) uploader.upload(range_start, range_end - range_start, (char *) base_addr + range_start);
+    return uploaded_size + range_end - range_start;
+}
\ No newline at end of file
@@ -1,56 +1,163 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <mutex>
-#include <deque>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <stdexcept>
 #include <sys/param.h>
 
+/**
+ * Huge pages backing the memory pool: 0 for regular pages, 1 for transparent huge pages, 2 for pre-reserved huge pages (MAP_HUGETLB),
+ * falling back to regular pages when none are available. Blocks are only released back to the OS with regular or transparent pages.
+ */
+#define IVY_POOL_HUGE_PAGES (0)
+
+/**
+ * Granularity of pool indices, in bytes, matching the size of a tree node. 32-bit indices can then address up to 48 GiB, and the 30 bits
+ * of a node header up to 12 GiB. Memory converted to an index has to be aligned on this unit, which holds for every block, and for
+ * every allocation whose size is a multiple of it.
+ */
+#define IVY_POOL_INDEX_UNIT (12)
+
+/**
+ * Largest pool the trees can address, limited by the 30 bits of index of a node header.
+ */
+#define IVY_POOL_MAX_SIZE ((size_t(1) << 30) * IVY_POOL_INDEX_UNIT)
+
 class MemoryPoolClient;
 
+/**
+ * Telemetry of a size class over all the clients of a pool, see FastMemoryPool::get_stats.
+ */
+struct PoolSizeClassStats {
+    int size;  // Size of the allocations of the class, in bytes
+    size_t live_bytes;  // Bytes currently allocated
+    size_t hole_count;  // Deallocated slots waiting to be reused
+    size_t block_count;  // Blocks filled by the class, excluding spans
+    double fragmentation;  // Share of the slots handed out by the class which are deallocated, from 0 to 1
+};
+
+/**
+ * Snapshot of the memory pool usage, see FastMemoryPool::get_stats.
+ */
+struct PoolStats {
+    size_t allocated;  // Bytes of the blocks currently handed out, see FastMemoryPool::allocated
+    size_t used;  // Bytes currently allocated by the clients
+    size_t free_block_count;  // Blocks handed out then given back, waiting in the pool to be reused
+    size_t span_block_count;  // Blocks held by the spans of the clients
+    size_t unfilled_bytes;  // Bytes at the end of the blocks the subpools are filling, not handed out yet
+    size_t client_count;
+    std::vector<PoolSizeClassStats> size_classes;  // Size classes with blocks or live allocations, by increasing size
+
+    /**
+     * @return The snapshot as a JSON object, with the same field names.
+     */
+    std::string to_json() const;
+};
+
+/**
+ * Receives the parts of the pool that have to be copied to the GPU, see FastMemoryPool::upload_dirty_blocks.
+ */
+class PoolUploader {
+public:
+    virtual ~PoolUploader() = default;
+
+    /**
+     * @param offset Offset of the range from the start of the pool, in bytes.
+     * @param data Pointer to the start of the range.
+     */
+    virtual void upload(size_t offset, size_t size, const void *data) = 0;
+};
+
 class FastMemoryPool {
 private:
     void *base_addr;  // Base address of the large memory block
-    void *next;       // Pointer to the next free address in the pool
     size_t max_size;  // Maximum size of the memory pool
-    size_t chunk_size;
+    size_t chunk_size;  // Size of each chunk within the pool
+    bool is_hugetlb;  // Whether the pool is backed by pre-reserved huge pages, which cannot be partially released
 private:
-    // Size of each chunk within the pool
-    size_t allocated_blocks;  // Total number of allocated blocks
-    std::mutex guard;  // Mutex for thread-safe operations
-    std::deque<void *> free_blocks;  // Deque to store deallocated blocks for reuse
+    // Blocks are handed out lock-free: from a Treiber stack of deallocated blocks first, then from the end of the pool
+    std::atomic<size_t> bumped_blocks;  // Number of blocks handed out from the end of the pool
+    std::atomic<uint64_t> free_head;  // Top of the free block stack: a tag against ABA in the high half, the block index + 1 in the low half
+    std::atomic<size_t> free_block_count;  // Number of blocks in the free block stack, or briefly more while they are being pushed
+    std::unique_ptr<std::atomic<uint32_t>[]> free_next;  // For each free block, the index + 1 of the next one in the stack, 0 at the bottom
+    std::mutex span_guard;  // Serializes the searches for runs of free blocks, which take the whole stack for themselves
+    std::mutex guard;  // Mutex for the list of clients
     std::vector<MemoryPoolClient *> clients;  // List of all created clients
+    std::unique_ptr<std::atomic<uint64_t>[]> dirty_blocks;  // One bit per block, set when the block may differ from its GPU copy
+    std::unique_ptr<std::atomic<uint32_t>[]> live_bytes;  // Bytes allocated by the clients in each block, so that sparse ones are found quickly
 
     /**
-     * Allocate a chunk of memory from the pool.
-     * @return A pointer to the allocated memory or nullptr if out of memory.
+     * Account an allocation, or a deallocation, in the allocated bytes of the blocks it overlaps. Allocations of spans may cross the
+     * boundary between two blocks. Atomic, as the threads of a concurrent build may free arrays of the same block.
      */
-    void *allocate();
+    void count_live_bytes(const void *ptr, int size, bool is_allocated);
+
+    uint32_t get_live_bytes(const void *block) const;
 
     /**
-     * Deallocate a chunk of memory, adding it back to the pool's free blocks.
-     * @param ptr Pointer to the memory to deallocate.
+     * Push a chain of free blocks, already linked through free_next from first to last, on top of the free block stack.
+     * @param count Number of blocks in the chain.
+     */
+    void push_free_blocks(uint32_t first, uint32_t last, size_t count);
+
+    /**
+     * Give the pages of a range of blocks back to the OS, see deallocate.
      */
-    void deallocate(void *ptr);
+    void release_pages(void *ptr, size_t size, bool is_mapped);
+
+    /**
+     * Allocate contiguous chunks of memory, reusing a run of deallocated blocks if there is one, or from the end of the pool otherwise.
+     * @param block_count Number of contiguous chunks to allocate.
+     * @return A pointer to the first chunk or nullptr if out of memory.
+     */
+    void *allocate_contiguous(size_t block_count);
 
     friend class MemoryPoolClient;
 
 public:
     /**
-     * Constructor for FastMemoryPool.
-     * @param max_size Maximum size of the memory pool. Defaults to 1 GB.
+     * Constructor for FastMemoryPool. The address space of the pool is only reserved, pages are committed by the OS as they are first
+     * written, so the memory footprint follows what is actually allocated.
+     * @param max_size Maximum size of the memory pool, at most IVY_POOL_MAX_SIZE, which is the default. Only address space is reserved,
+     * see RegionManager::get_pool_size for the size the client needs.
      * @param chunk_size Size of each chunk to allocate. Defaults to 12 KB.
      */
-    explicit FastMemoryPool(size_t max_size = 1ULL * 1024 * 1024 * 1024, size_t chunk_size = 12 * 1024);
+    explicit FastMemoryPool(size_t max_size = IVY_POOL_MAX_SIZE, size_t chunk_size = 12 * 1024);
 
     /**
      * Destructor for FastMemoryPool. Frees all allocated clients and the main memory block.
      */
     ~FastMemoryPool();
 
+    /**
+     * Allocate a chunk of memory from the pool. Lock-free, so that threads building trees concurrently do not wait on each other.
+     * @return A pointer to the allocated memory or nullptr if out of memory.
+     */
+    void *allocate();
+
+    /**
+     * Deallocate a chunk of memory, adding it back to the pool's free blocks. Its pages are given back to the OS, and read as zeros
+     * until they are written again. Lock-free, apart from the system call releasing the pages.
+     * @param ptr Pointer to the memory to deallocate.
+     * @param is_mapped Whether the chunk may have a file mapped over it, which then has to be replaced by anonymous memory.
+     */
+    void deallocate(void *ptr, bool is_mapped = false);
+
+    /**
+     * Deallocate many chunks at once, like deallocate but in O(blocks): the pages of adjacent chunks are released together, and the
+     * chunks are pushed back to the free blocks in a single step.
+     * @param blocks Pointers to the chunks to deallocate, in any order, preferably ascending.
+     * @param is_mapped Whether the chunks may have a file mapped over them.
+     */
+    void deallocate_blocks(const std::vector<void *> &blocks, bool is_mapped = false);
+
     /**
      * Create a new MemoryPoolClient associated with this pool.
      * @return A pointer to the newly created MemoryPoolClient.
@@ -69,7 +176,13 @@ public:
     size_t size();
 
     /**
-     * @return The total allocated memory (in bytes, allocations made by clients in the memory pool).
+     * @return The size of the part of the pool blocks were ever handed out from (in bytes, from the base address). Anything beyond is
+     * untouched, so a copy of the pool only needs that much.
+     */
+    size_t extent();
+
+    /**
+     * @return The total allocated memory (in bytes, blocks currently handed out to clients or through allocate).
      */
     size_t allocated();
 
@@ -80,6 +193,27 @@ public:
 
     size_t get_chunk_size() const;
 
+    /**
+     * Gather the usage of every size class over all the clients. Clients are read without synchronization, so the snapshot is only
+     * exact when no tree is being built or modified concurrently.
+     */
+    PoolStats get_stats();
+
+    /**
+     * Mark the blocks overlapping a range of the pool as modified. Blocks are already marked when clients hand out memory, so this is
+     * only needed when writing in place to memory that was allocated earlier. Can be called from any thread.
+     */
+    void mark_dirty(const void *ptr, size_t size);
+
+    /**
+     * Hand every range of consecutive dirty blocks to the uploader, and mark them clean.
+     * @return The number of bytes uploaded.
+     */
+    size_t upload_dirty_blocks(PoolUploader &uploader);
+
+    /**
+     * Convert between pointers and indices, in units of IVY_POOL_INDEX_UNIT from the base address of the pool.
+     */
     void *to_pointer(uint32_t index);
     uint32_t to_index(void *ptr);
 };
@@ -88,16 +222,49 @@ class MemoryPoolClient {
 private:
     struct SubPool {
         void *next_alloc, *current_chunk;  // Pointer to the next allocation point within this subpool
-        std::deque<void *> holes;  // Deque to store deallocated blocks for reuse
+        void *holes;  // Last deallocated slot, whose first bytes hold the address of the previous one, and so on
+        std::vector<void *> small_holes;  // Deallocated slots too small to hold an address, for sizes below sizeof(void *)
+        void *unswept_holes;  // Free slots set aside by begin_evacuation, chained like holes, until sweep_free_slots hands them back
+        std::vector<void *> unswept_small_holes;
+        size_t hole_count;  // Number of deallocated slots, in both holes and small_holes
         std::vector<void *> blocks;  // Vector to store allocated blocks
         size_t allocated;
 
-        SubPool() : next_alloc(nullptr), current_chunk(nullptr), holes(), blocks(), allocated() {}
+        SubPool() : next_alloc(nullptr), current_chunk(nullptr), holes(nullptr), small_holes(), unswept_holes(nullptr), unswept_small_holes(),
+                    hole_count(), blocks(), allocated() {}
         ~SubPool() = default;
     };
 
+    struct EvacuatedBlock {
+        int pool_index;  // Subpool holding the block, or -1 for a block of a span
+    };
+
     FastMemoryPool *source;  // Source memory pool
-    SubPool pools[64 + 64 - 5];  // Array of subpools for different allocation sizes (1 to 64 bytes or multiples of 12 bytes up to 64*12)
+    SubPool pools[64 + 65 - 5];  // Array of subpools for different allocation sizes (1 to 64 bytes or multiples of 12 bytes up to 65*12)
+    std::vector<void *> span_blocks;  // Blocks allocated through allocate_span, released with the client unless evacuated
+    std::unordered_map<void *, size_t> span_tail_bytes;  // Bytes of each span in its last block, when the span does not fill it
+    std::unordered_map<void *, EvacuatedBlock> evacuated_blocks;  // Blocks selected by begin_evacuation, by address
+    bool is_sweeping = false;  // Whether free slots set aside by begin_evacuation are still to be swept, see sweep_free_slots
+    std::vector<void *> emptied_blocks;  // Evacuated blocks emptied before the end of the sweep, waiting to be given back
+
+    void *get_block(const void *ptr) const;
+
+    /**
+     * Call a function with each block overlapped by an allocation, and the number of bytes of the allocation in it. Allocations of spans
+     * may cross the boundary between two blocks.
+     */
+    template<typename F> void for_each_block(const void *ptr, int size, F &&function) const;
+
+    /**
+     * Give an evacuated block back to the pool, once its last allocation is gone.
+     * @return The iterator following the block in evacuated_blocks.
+     */
+    std::unordered_map<void *, EvacuatedBlock>::iterator release_evacuated_block(std::unordered_map<void *, EvacuatedBlock>::iterator it);
+
+    /**
+     * Add the usage of the subpools of this client to the size classes of the snapshot, which are indexed like the subpools.
+     */
+    void add_stats(PoolStats &stats) const;
 
     MemoryPoolClient(FastMemoryPool *src);
     ~MemoryPoolClient();
@@ -107,7 +274,8 @@ private:
 public:
     /**
      * Allocate a memory block of the specified size.
-     * @param size Size of the memory block to allocate (1 to 64 bytes or multiples of 12 bytes up to 64*12).
+     * @param size Size of the memory block to allocate (1 to 64 bytes or multiples of 12 bytes up to 65*12, a full node array with its
+     * LOD slot).
      * @return A pointer to the allocated memory block.
      */
     void *allocate(int size);
@@ -119,20 +287,91 @@ public:
      */
     void deallocate(void *ptr, int size);
 
+    /**
+     * Allocate contiguous memory spanning as many blocks as needed, for callers that want to control the layout of their allocations.
+     * The span is then split with allocate_in_span, and is only released along with the client.
+     * @param size Size of the span, in bytes.
+     * @return A pointer to the start of the span.
+     */
+    void *allocate_span(size_t size);
+
+    /**
+     * Allocate a memory block of the specified size at the cursor position within a span, and move the cursor past it. The block is
+     * accounted for like any other allocation of its size, and can be deallocated the same way.
+     * @param cursor Current position within a span obtained through allocate_span.
+     * @param size Size of the memory block to allocate (1 to 64 bytes or multiples of 12 bytes up to 65*12).
+     * @return A pointer to the allocated memory block.
+     */
+    void *allocate_in_span(char *&cursor, int size);
+
+    /**
+     * Allocate a span like allocate_span, and fill it with the content of a file. When the span and the file offset are page-aligned,
+     * the file is memory-mapped in place (privately, so writes to the span never reach the file) and pages are only read on first
+     * access. Otherwise, the file is read into the span.
+     * @param fd File descriptor to read from.
+     * @param offset Offset of the content in the file, in bytes.
+     * @param size Size of the content, in bytes.
+     * @return A pointer to the start of the span.
+     */
+    void *map_span(int fd, size_t offset, size_t size);
+
     /**
      * Convert a pointer to an index relative to the base address of the pool.
-     * @param ptr Pointer to convert.
-     * @return Index relative to the base address.
+     * @param ptr Pointer to convert, aligned on IVY_POOL_INDEX_UNIT.
+     * @return Index relative to the base address, in units of IVY_POOL_INDEX_UNIT.
      */
     uint32_t to_index(void *ptr);
 
     /**
      * Convert an index to a pointer relative to the base address of the pool.
-     * @param index Index to convert.
+     * @param index Index to convert, in units of IVY_POOL_INDEX_UNIT.
      * @return Pointer relative to the base address.
      */
     void *to_pointer(uint32_t index);
 
+    /**
+     * Mark every block of this client as modified, for instance once a tree built on another thread is ready to be uploaded.
+     */
+    void mark_dirty();
+
+    /**
+     * Select the sparse blocks of the subpools and of the spans for evacuation, in time proportional to the number of blocks: their free
+     * slots are no longer handed out, and each of them is given back to the pool once its last allocation is deallocated. The caller is
+     * then expected to move the allocations out of them, see is_evacuated. The block each subpool is currently filling is never selected,
+     * nor is the partly filled last block of a span, unless its own end is sparse.
+     * Every free slot is set aside until sweep_free_slots has dropped the ones of the selected blocks, and no block is given back before.
+     * @param max_occupancy Blocks with a lower ratio of allocated bytes are selected.
+     * @return The number of blocks selected.
+     */
+    size_t begin_evacuation(float max_occupancy);
+
+    /**
+     * Hand the free slots set aside by begin_evacuation back to the free lists, unless they lie in an evacuated block, then give back the
+     * evacuated blocks which are already empty once every slot has been swept.
+     * @param budget Number of free slots that may be swept, decremented by the number swept. A block given back counts for 32 of them.
+     * @return Whether work remains, for the next calls.
+     */
+    bool sweep_free_slots(int &budget);
+
+    /**
+     * @return Whether the allocation overlaps a block selected by begin_evacuation, which still holds allocations.
+     * @param size Size of the allocation, which may cross the boundary between two blocks when it lies in a span.
+     */
+    bool is_evacuated(const void *ptr, int size = 1) const;
+
+    /**
+     * @return The number of blocks selected by begin_evacuation which still hold allocations.
+     */
+    size_t get_evacuated_count() const;
+
+    /**
+     * Take over every allocation and block of another client, which is left empty and can then be freed without releasing them. The
+     * unfilled end of the block a subpool of the other client was filling becomes free slots, unless it has more room than the block this
+     * client is filling, which is then the one whose end becomes free slots.
+     * @param client Client to empty, of the same pool.
+     */
+    void merge(MemoryPoolClient *client);
+
     /**
      * Get the amount of memory currently used by this client. Always inferior or equals to the total memory allocated to this client.
      * @return The size of the used memory in bytes.
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "ivy_log.h"
+#include "ivy_time.h"
+#include "client/client.h"
+#include "client/utils/region_manager.h"
+#include "server/server.h"
+
+namespace client::utils {
+    namespace {
+        /**
+         * Fill a view with a region, from its region file when a previous run saved one, or from the world generator. Generators work in
+         * voxel coordinates with the height on their z axis, so the region at (x, z) starts at (x * width, z * width, 0) for them.
+         */
+        void load_region(int x, int z, WideTree &view) {
+            int rx = int(x * IVY_REGION_WIDTH), ry = int(z * IVY_REGION_WIDTH), rz = 0;
+            char region_path[256];
+            snprintf(region_path, sizeof(region_path), "%s_%d_%d_%d.ivy", server::world_generator->get_name(), rx, ry, rz);
+            auto t0 = time_us();
+            if (view.load(region_path)) {
+                info("Loaded region (%d; %d) from %s in %.2f ms", x, z, region_path, double(time_us() - t0) / 1e3);
+            } else {
+                // Rewriting the region in depth-first order once generated, to improve the memory locality of the traversal
+                server::world_generator->generate_view(rx, ry, rz, view);
+                view.compact();
+                info("Generated region (%d; %d) in %.2f ms", x, z, double(time_us() - t0) / 1e3);
+                if (view.save(region_path)) info("Saved region (%d; %d) to %s", x, z, region_path);
+            }
+
+            if (IVY_REGION_DEDUPLICATION) {
+                t0 = time_us();
+                size_t saved_bytes = view.deduplicate();
+                info("Deduplicated region (%d; %d) in %.2f ms, saving %.2f MiB", x, z, double(time_us() - t0) / 1e3, (double) saved_bytes / 1024.0 / 1024.0);
+            }
+        }
+    }
+
+    RegionManager::RegionManager(int radius) : radius(radius), window_width(2 * radius + 1), region_table(window_width * window_width, 0) {
+        worker = std::thread([this]() { run_worker(); });
+    }
+
+    size_t RegionManager::get_pool_size(int radius) {
+        size_t region_count = size_t(2 * radius + 1) * size_t(2 * radius + 1) + 1;
+        return std::min(region_count * IVY_REGION_POOL_SIZE, IVY_POOL_MAX_SIZE);
+    }
+
+    RegionManager::~RegionManager() {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            is_stopping = true;
+        }
+        wakeup.notify_all();
+        worker.join();
+        for (Region &region: regions) delete region.view;
+        for (Region &region: completed) delete region.view;
+    }
+
+    bool RegionManager::is_in_window(int x, int z) const {
+        return std::abs(x - center_x) <= radius && std::abs(z - center_z) <= radius;
+    }
+
+    void RegionManager::run_worker() {
+        std::unique_lock<std::mutex> lock(guard);
+        while (true) {
+            wakeup.wait(lock, [this]() { return is_stopping || !requests.empty(); });
+            if (is_stopping) return;
+            loading = requests.front();
+            requests.pop_front();
+            is_loading = true;
+
+            // The region is loaded without holding the lock, so that the render thread never waits for it
+            lock.unlock();
+            loading.view = new WideTree();
+            load_region(loading.x, loading.z, *loading.view);
+            lock.lock();
+            completed.push_back(loading);
+            is_loading = false;
+        }
+    }
+
+    bool RegionManager::update(glm::vec3 camera_position) {
+        int x = int(std::floor(camera_position.x / float(IVY_REGION_WIDTH))), z = int(std::floor(camera_position.z / float(IVY_REGION_WIDTH)));
+        bool has_changed = false;
+        std::unique_lock<std::mutex> lock(guard);
+
+        // When the camera enters another region, the window moves along: far regions are evicted, and missing ones are requested
+        if (!is_initialized || x != center_x || z != center_z) {
+            is_initialized = true;
+            center_x = x;
+            center_z = z;
+            auto evicted = std::remove_if(regions.begin(), regions.end(), [this](const Region &region) { return !is_in_window(region.x, region.z); });
+            for (auto it = evicted; it != regions.end(); it++) delete it->view;
+            has_changed = true;  // the slots of the region table are relative to the center, so they move even if no region is evicted
+            regions.erase(evicted, regions.end());
+
+            requests.clear();
+            for (int dz = -radius; dz <= radius; dz++) {
+                for (int dx = -radius; dx <= radius; dx++) {
+                    auto is_requested_region = [&](const Region &region) { return region.x == x + dx && region.z == z + dz; };
+                    if (std::any_of(regions.begin(), regions.end(), is_requested_region)) continue;
+                    if (std::any_of(completed.begin(), completed.end(), is_requested_region)) continue;
+                    if (is_loading && is_requested_region(loading)) continue;
+                    requests.push_back({x + dx, z + dz, nullptr});
+                }
+            }
+            std::stable_sort(requests.begin(), requests.end(), [&](const Region &a, const Region &b) {
+                return std::max(std::abs(a.x - x), std::abs(a.z - z)) < std::max(std::abs(b.x - x), std::abs(b.z - z));
+            });
+            wakeup.notify_one();
+        }
+
+        // Publishing the regions the worker loaded, unless the window moved away from them in the meantime
+        for (Region &region: completed) {
+            if (is_in_window(region.x, region.z)) {
+                region.view->mark_dirty();
+                regions.push_back(region);
+                has_changed = true;
+            } else {
+                delete region.view;
+            }
+        }
+        completed.clear();
+        lock.unlock();
+
+        // Spreading the defragmentation of the resident regions over frames, moving to the next region once a pass is over. Resident
+        // regions are only touched by the render thread, so the worker is not kept waiting meanwhile.
+        if (!regions.empty() && !regions[defragmented_region % regions.size()].view->defragment_step()) defragmented_region++;
+
+        if (has_changed) {
+            std::fill(region_table.begin(), region_table.end(), 0);
+            for (Region &region: regions) {
+                int slot = (region.x - center_x + radius) + (region.z - center_z + radius) * window_width;
+                region_table[slot] = region.view->get_root_node() + 1;
+            }
+        }
+        return has_changed;
+    }
+
+    const std::vector<uint32_t> &RegionManager::get_region_table() const {
+        return region_table;
+    }
+
+    int RegionManager::get_window_origin_x() const {
+        return center_x - radius;
+    }
+
+    int RegionManager::get_window_origin_z() const {
+        return center_z - radius;
+    }
+
+    int RegionManager::get_window_width() const {
+        return window_width;
+    }
+
+    size_t RegionManager::get_resident_count() const {
+        return regions.size();
+    }
+}
\ No newline at end of file
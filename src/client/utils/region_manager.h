@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "glm/vec3.hpp"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+
+/**
+ * Number of regions kept resident on each side of the region of the camera, along the x and z axes.
+ */
+#define IVY_REGION_WINDOW_RADIUS (1)
+
+/**
+ * Whether regions are deduplicated into DAGs once loaded, see WideTree::deduplicate. Off by default, as procedural regions share few
+ * subtrees beyond their LOD leaves.
+ */
+#define IVY_REGION_DEDUPLICATION (0)
+
+/**
+ * Pool memory budgeted for a region, see RegionManager::get_pool_size. The ground of a region grows with its surface, and a procedural
+ * region takes about 3 bytes per column while it is built, so this leaves room for rougher terrain.
+ */
+#define IVY_REGION_POOL_SIZE (size_t(8) * IVY_REGION_WIDTH * IVY_REGION_WIDTH)
+
+namespace client::utils {
+    /**
+     * Keeps a square window of regions resident around the camera. The world is a single region high, so the window only spans the
+     * x and z axes. Missing regions are loaded from their region file or generated on a background thread, nearest first, and regions
+     * that leave the window are freed back to the memory pool.
+     */
+    class RegionManager {
+        struct Region {
+            int x, z;
+            WideTree *view;
+        };
+
+        int radius, window_width;
+        int center_x = 0, center_z = 0;
+        bool is_initialized = false;
+        std::vector<Region> regions;  // Resident regions, only touched by the render thread
+        size_t defragmented_region = 0;  // Resident region defragmented a step at a time, in turn
+        std::vector<uint32_t> region_table;
+
+        // State shared with the worker thread
+        std::mutex guard;
+        std::condition_variable wakeup;
+        std::deque<Region> requests;  // Regions to load, nearest first, without their view
+        std::vector<Region> completed;  // Regions loaded by the worker, waiting to be published by update
+        bool is_loading = false, is_stopping = false;
+        Region loading = {};
+        std::thread worker;
+
+        void run_worker();
+        bool is_in_window(int x, int z) const;
+    public:
+        /**
+         * @param radius Number of regions kept resident on each side of the region of the camera.
+         */
+        explicit RegionManager(int radius = IVY_REGION_WINDOW_RADIUS);
+        ~RegionManager();
+
+        /**
+         * @return The size of the memory pool needed by a window of the given radius: IVY_REGION_POOL_SIZE for each of its regions and for
+         * the one being loaded, up to IVY_POOL_MAX_SIZE. Deeper region trees need 16 times as much per level, and a single region of
+         * depth 8 already fills the largest pool.
+         */
+        static size_t get_pool_size(int radius = IVY_REGION_WINDOW_RADIUS);
+
+        /**
+         * Move the window to the region of the camera, evicting the regions that left it and requesting the missing ones, then publish
+         * the regions loaded since the last call, and run a defragmentation step on one of the resident regions, within the budget of
+         * IVY_DEFRAGMENTATION_STEP_BUDGET. Must be called from the render thread.
+         * @return Whether the set of resident regions changed, in which case the region table has to be uploaded again. The blocks of newly
+         * resident regions are marked dirty in the memory pool.
+         */
+        bool update(glm::vec3 camera_position);
+
+        /**
+         * @return For each slot of the window, x + z * width, the node index of the region root plus one, or 0 if the region is not resident.
+         */
+        const std::vector<uint32_t> &get_region_table() const;
+
+        /**
+         * @return The region coordinates of the first slot of the window.
+         */
+        int get_window_origin_x() const;
+        int get_window_origin_z() const;
+
+        /**
+         * @return The number of slots on each side of the window.
+         */
+        int get_window_width() const;
+
+        size_t get_resident_count() const;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "client/utils/step_histogram.h"
+
+namespace client::utils {
+    void StepHistogram::add(uint32_t steps) {
+        int bucket = steps == 0 ? 0 : std::min(IVY_STEP_HISTOGRAM_SIZE - 1, 32 - __builtin_clz(steps));
+        counts[bucket] += 1;
+        pixel_count += 1;
+        step_count += steps;
+        max_steps = std::max(max_steps, steps);
+    }
+
+    void StepHistogram::add(const uint32_t *steps, size_t count) {
+        for (size_t i = 0; i < count; i++) add(steps[i]);
+    }
+
+    uint32_t StepHistogram::get_percentile(float percentile) const {
+        uint64_t rank = uint64_t(std::ceil(double(percentile) / 100.0 * double(pixel_count))), cumulated_count = 0;
+        for (int bucket = 0; bucket < IVY_STEP_HISTOGRAM_SIZE - 1; bucket++) {
+            cumulated_count += counts[bucket];
+            if (cumulated_count >= std::max<uint64_t>(1, rank)) return std::min(max_steps, get_bucket_min(bucket + 1) - 1);
+        }
+        return max_steps;
+    }
+
+    uint32_t StepHistogram::get_bucket_min(int bucket) {
+        return bucket == 0 ? 0 : 0x1u << (bucket - 1);
+    }
+
+    std::string StepHistogram::to_json() const {
+        char buffer[256];
+        double mean = pixel_count == 0 ? 0.0 : double(step_count) / double(pixel_count);
+        snprintf(buffer, sizeof(buffer), R"({"pixel_count":%lu,"mean":%.4f,"p50":%u,"p90":%u,"p99":%u,"max":%u,"buckets":[)", pixel_count, mean,
+                 get_percentile(50), get_percentile(90), get_percentile(99), max_steps);
+        std::string json = buffer;
+        for (int bucket = 0; bucket < IVY_STEP_HISTOGRAM_SIZE; bucket++) {
+            snprintf(buffer, sizeof(buffer), R"(%s{"min_steps":%u,"count":%lu})", bucket == 0 ? "" : ",", get_bucket_min(bucket), counts[bucket]);
+            json += buffer;
+        }
+        return json + "]}";
+    }
+}
\ No newline at end of file
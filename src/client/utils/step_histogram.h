@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Number of buckets of a StepHistogram. The last bucket also counts every larger step count.
+ */
+#define IVY_STEP_HISTOGRAM_SIZE (16)
+
+namespace client::utils {
+    /**
+     * Distribution of the traversal steps per pixel of a frame, DDA steps plus tree steps, whether it was traced on the CPU or read back
+     * from the step image of the shader. Buckets grow exponentially: the first one counts pixels with no step, and bucket i the pixels
+     * with 2^(i-1) to 2^i - 1 steps.
+     */
+    struct StepHistogram {
+        uint64_t counts[IVY_STEP_HISTOGRAM_SIZE] = {};
+        uint64_t pixel_count = 0, step_count = 0;
+        uint32_t max_steps = 0;
+
+        void add(uint32_t steps);
+        void add(const uint32_t *steps, size_t count);
+
+        /**
+         * @return An upper bound of the given percentile of the step counts, that is the last step count of the bucket it falls in.
+         * @param percentile Between 0 and 100.
+         */
+        uint32_t get_percentile(float percentile) const;
+
+        /**
+         * @return The smallest step count of the given bucket.
+         */
+        static uint32_t get_bucket_min(int bucket);
+
+        std::string to_json() const;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cstdio>
+#include "ivy_log.h"
+#include "ivy_time.h"
+#include "client/client.h"
+#include "client/utils/traversal_profiler.h"
+#include "server/generators/generator.h"
+
+namespace client::utils {
+    CacheModel::CacheModel(int size, int way_count, int line_size)
+            : line_size(line_size), way_count(way_count), set_count(size / (way_count * line_size)), tags(size / line_size, UINT64_MAX) {}
+
+    int CacheModel::read(const void *address, size_t size) {
+        int missed_lines = 0;
+        uint64_t first_line = uint64_t(address) / line_size, last_line = (uint64_t(address) + size - 1) / line_size;
+        for (uint64_t line = first_line; line <= last_line; line++) {
+            uint64_t *set = &tags[(line % set_count) * way_count];
+            uint64_t *way = std::find(set, set + way_count, line);
+            accesses += 1;
+            if (way == set + way_count) {
+                missed_lines += 1;
+                way = set + way_count - 1;
+            }
+            std::move_backward(set, way, way + 1);
+            set[0] = line;
+        }
+        misses += missed_lines;
+        return missed_lines;
+    }
+
+    TraversalStats profile_traversal(const WideTree &tree, int resolution) {
+        TraversalStats stats;
+        CacheModel l1(32 * 1024, 8), l2(1024 * 1024, 16);
+        auto read = [&](const void *address, size_t size) {
+            stats.node_reads += 1;
+            if (l1.read(address, size) != 0) l2.read(address, size);
+        };
+
+        auto t0 = time_us();
+        const Node *root = (const Node *) memory_pool->to_pointer(tree.get_root_node());
+        for (int j = 0; j < resolution; j++) {
+            for (int i = 0; i < resolution; i++) {
+                int x = int((i * IVY_REGION_WIDTH) / resolution), y = int((j * IVY_REGION_WIDTH) / resolution), z = IVY_REGION_WIDTH - 1;
+                stats.ray_count += 1;
+
+                // Going down from the root to the deepest node containing the current position, then either stopping on a hit, or skipping
+                // the empty child we ended in.
+                while (z >= 0) {
+                    const Node *node = root;
+                    read(node, sizeof(Node));
+                    int node_width = IVY_REGION_WIDTH;
+                    bool has_hit = false;
+                    while (true) {
+                        node_width /= IVY_NODE_WIDTH;
+                        int child_xyz = int((x / node_width) % IVY_NODE_WIDTH + ((y / node_width) % IVY_NODE_WIDTH) * IVY_NODE_WIDTH +
+                                            ((z / node_width) % IVY_NODE_WIDTH) * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
+                        if ((node->bitmap & (0x1ul << child_xyz)) == 0) break;
+                        if ((node->header >> 30) != 0b00u) {
+                            has_hit = true;
+                            int child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
+                            auto *child_array = (const uint8_t *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+                            if ((node->header >> 30) == 0b01u) {
+                                read(child_array + child_id * sizeof(Voxel), sizeof(Voxel));
+                            } else if ((node->header >> 30) == 0b10u) {
+                                // Palette leaves read the size of the palette, the packed index, then the palette itself
+                                int palette_size = child_array[0], bits = palette_size <= 4 ? 2 : 4;
+                                read(child_array, 1);
+                                read(child_array + 1 + palette_size * sizeof(Voxel) + child_id * bits / 8, 1);
+                                read(child_array + 1, palette_size * sizeof(Voxel));
+                            }
+                            break;
+                        }
+                        auto *child_array = (const Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+                        node = &child_array[__builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz))];
+                        read(node, sizeof(Node));
+                    }
+                    if (has_hit) break;
+                    z = (z / node_width) * node_width - 1;
+                }
+            }
+        }
+        stats.duration_ms = double(time_us() - t0) / 1e3;
+        stats.l1_misses = l1.misses;
+        stats.l2_misses = l2.misses;
+        return stats;
+    }
+
+    std::string TraversalStats::to_json() const {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), R"({"rays":%lu,"node_reads_per_ray":%.4f,"l1_miss_rate":%.6f,"l2_miss_rate":%.6f,"duration_ms":%.3f})",
+                 ray_count, double(node_reads) / double(std::max(ray_count, 1ul)), double(l1_misses) / double(std::max(node_reads, 1ul)),
+                 double(l2_misses) / double(std::max(node_reads, 1ul)), duration_ms);
+        return buffer;
+    }
+
+    void log_traversal_stats(const char *label, const TraversalStats &stats) {
+        info("%s: %lu rays, %.2f node reads per ray, %.2f%% L1 misses, %.2f%% L2 misses, %.2f ms", label, stats.ray_count,
+             double(stats.node_reads) / double(std::max(stats.ray_count, 1ul)),
+             100.0 * double(stats.l1_misses) / double(std::max(stats.node_reads, 1ul)),
+             100.0 * double(stats.l2_misses) / double(std::max(stats.node_reads, 1ul)), stats.duration_ms);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "client/utils/wide_tree.h"
+
+namespace client::utils {
+    /**
+     * A model of a set-associative LRU cache, fed with the addresses read during a CPU traversal. Unlike hardware counters, it gives
+     * the same statistics on every machine, which makes layouts easy to compare.
+     */
+    class CacheModel {
+        int line_size, way_count, set_count;
+        std::vector<uint64_t> tags;  // way_count tags per set, most recently used first
+    public:
+        uint64_t accesses = 0, misses = 0;
+
+        CacheModel(int size, int way_count, int line_size = 64);
+
+        /**
+         * Simulate a read of the given memory range, one access per cache line.
+         * @return The number of lines that missed.
+         */
+        int read(const void *address, size_t size);
+    };
+
+    struct TraversalStats {
+        uint64_t ray_count = 0;
+        uint64_t node_reads = 0;
+        uint64_t l1_misses = 0, l2_misses = 0;
+        double duration_ms = 0;
+
+        /**
+         * @return The statistics as a JSON object, with the miss rates relative to the node reads.
+         */
+        std::string to_json() const;
+    };
+
+    /**
+     * Cast rays straight down on a regular grid of columns covering the tree, in scanline order, and feed every node read to a model of
+     * a 32 KiB L1 and a 1 MiB L2 cache. Each ray skips empty nodes the same way the shaders do, so the access pattern is close to a render
+     * of the world seen from above.
+     * @param resolution Number of rays along each side of the grid.
+     */
+    TraversalStats profile_traversal(const WideTree &tree, int resolution = 256);
+
+    void log_traversal_stats(const char *label, const TraversalStats &stats);
+}
\ No newline at end of file
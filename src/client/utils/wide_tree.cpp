@@ -1,179 +1,1215 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ivy_log.h"
 #include "client/utils/wide_tree.h"
 #include "common/world/voxel.h"
 #include "common/world/chunk.h"
+#include "common/world/region_archive.h"
 #include "server/generators/generator.h"
 #include "client/client.h"
 
 namespace client::utils {
     namespace {
-        struct __attribute__((packed)) Node {
-            /**
-             * 4x4x4 bit, one per subnode. Can be used for faster traversal than a list of u32.
-             * An empty bitmap with value 0x0000 means that the node data has not been generated yet.
-             */
-            uint64_t bitmap = 0;
+        /**
+         * Size of the allocation of a voxel array, padded so that the next arrays of a span stay aligned on the pool index unit.
+         */
+        int voxel_array_size(int child_count) {
+            return (child_count * int(sizeof(Voxel)) + IVY_POOL_INDEX_UNIT - 1) / IVY_POOL_INDEX_UNIT * IVY_POOL_INDEX_UNIT;
+        }
+
+        /**
+         * Number of bits of each packed index of a palette array, for a palette of the given size.
+         */
+        int palette_index_bits(int palette_size) {
+            return palette_size <= 4 ? 2 : 4;
+        }
+
+        /**
+         * Size of the allocation of a palette array: the size of the palette on one byte, the palette, then the packed palette index of
+         * each voxel, padded like voxel arrays.
+         */
+        int palette_array_size(int palette_size, int child_count) {
+            int size = 1 + palette_size * int(sizeof(Voxel)) + (child_count * palette_index_bits(palette_size) + 7) / 8;
+            return (size + IVY_POOL_INDEX_UNIT - 1) / IVY_POOL_INDEX_UNIT * IVY_POOL_INDEX_UNIT;
+        }
+
+        /**
+         * @return Whether the node has a child array, that is whether it is neither empty nor a LOD leaf.
+         */
+        bool has_array(const Node *node) {
+            return node->bitmap != 0 && (node->header >> 30) != 0b11u;
+        }
+
+        /**
+         * Size of the allocation of the child array of a node, see Node::header. Arrays of inner nodes end with their LOD slot.
+         */
+        int child_array_size(const Node *node, const void *child_array) {
+            int child_count = __builtin_popcountll(node->bitmap);
+            switch (node->header >> 30) {
+                case 0b00u: return (child_count + 1) * int(sizeof(Node));
+                case 0b01u: return voxel_array_size(child_count);
+                default: return palette_array_size(*(const uint8_t *) child_array, child_count);
+            }
+        }
+
+        /**
+         * Same as child_array_size, but without the padding of voxel arrays, whose content is undefined. Palette arrays are zeroed
+         * when allocated, so their padding is part of their content.
+         */
+        int child_array_content_size(const Node *node, const void *child_array) {
+            if ((node->header >> 30) == 0b01u) return __builtin_popcountll(node->bitmap) * int(sizeof(Voxel));
+            return child_array_size(node, child_array);
+        }
+
+        /**
+         * Gather the distinct voxels of a leaf into a palette.
+         * @param indices Output palette index of each voxel.
+         * @return The size of the palette, or 0 if the voxels do not fit in IVY_LEAF_PALETTE_SIZE entries.
+         */
+        int build_palette(const Voxel *voxels, int child_count, Voxel *palette, uint8_t *indices) {
+            int palette_size = 0;
+            for (int i = 0; i < child_count; i++) {
+                int index = 0;
+                while (index < palette_size && memcmp(&palette[index], &voxels[i], sizeof(Voxel)) != 0) index++;
+                if (index == palette_size) {
+                    if (palette_size == IVY_LEAF_PALETTE_SIZE) return 0;
+                    palette[palette_size++] = voxels[i];
+                }
+                indices[i] = uint8_t(index);
+            }
+            return palette_size;
+        }
+
+        /**
+         * Write a chunk in a terminal node that has no allocation. Uniform chunks, whose voxels are all identical, are stored as a LOD
+         * color, the others get a palette array when they have few distinct voxels and it is smaller, and a voxel array otherwise.
+         */
+        void write_leaf(MemoryPoolClient *memory_subpool, Node *node, const Chunk *chunk) {
+            // First, we assemble the bitmask, and gather the non-empty voxels in bitmap order...
+            auto uniform_material = Voxel{AIR};
+            bool is_uniform = true;
+            Voxel voxels[IVY_NODE_WIDTH_CUBED];
+            int child_count = 0;
+            for (int child_z = 0; child_z < IVY_NODE_WIDTH; child_z++) {
+                for (int child_y = 0; child_y < IVY_NODE_WIDTH; child_y++) {
+                    for (int child_x = 0; child_x < IVY_NODE_WIDTH; child_x++) {
+                        Voxel voxel = chunk->get(child_x, child_y, child_z);
+                        if (voxel.material != AIR) {
+                            // Whole voxels are compared, like in build_palette, so that leaves with different normals are not merged
+                            if (uniform_material.material == AIR) {
+                                uniform_material = voxel;
+                            } else if (memcmp(&uniform_material, &voxel, sizeof(Voxel)) != 0) {
+                                is_uniform = false;
+                            }
+                            node->bitmap = node->bitmap | (0x1ul << (child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH));
+                            voxels[child_count++] = voxel;
+                        }
+                    }
+                }
+            }
+
+            if (is_uniform) {
+                // If the node is uniform, we apply the lod color & the terminal & lod bits
+                uint32_t lod_voxel = 0;
+                memcpy(&lod_voxel, &uniform_material, sizeof(Voxel));
+                node->header = lod_voxel | (0b11u << 30);
+                return;
+            }
+
+            // If it's not, we try to pack the voxels as indices in a palette
+            Voxel palette[IVY_LEAF_PALETTE_SIZE];
+            uint8_t indices[IVY_NODE_WIDTH_CUBED];
+            int palette_size = build_palette(voxels, child_count, palette, indices);
+            if (palette_size != 0 && palette_array_size(palette_size, child_count) < voxel_array_size(child_count)) {
+                int array_size = palette_array_size(palette_size, child_count);
+                auto *child_array = (uint8_t *) memory_subpool->allocate(array_size);
+                memset(child_array, 0, array_size);
+                child_array[0] = uint8_t(palette_size);
+                memcpy(child_array + 1, palette, palette_size * sizeof(Voxel));
+                uint8_t *packed_indices = child_array + 1 + palette_size * sizeof(Voxel);
+                int bits = palette_index_bits(palette_size);
+                for (int i = 0; i < child_count; i++) packed_indices[i * bits / 8] |= uint8_t(indices[i] << (i * bits % 8));
+
+                // Palette leaves are marked with the terminal bits 0b10
+                node->header = memory_subpool->to_index(child_array) | (0b10u << 30);
+                return;
+            }
+
+            // Otherwise, we allocate a voxel array, place it in the header, and set the voxels.
+            auto *child_array = (Voxel *) memory_subpool->allocate(voxel_array_size(child_count));
+            memcpy(child_array, voxels, child_count * sizeof(Voxel));
+
+            // And again we don't forget to mark the node as terminal
+            node->header = memory_subpool->to_index(child_array) | (0b01u << 30);
+        }
+
+        /**
+         * Weights of the materials found below a node, from which its LOD voxel is elected.
+         */
+        struct LodHistogram {
+            uint32_t weights[256] = {};
+            float normal_x = 0, normal_y = 0, normal_z = 0;
+
+            void add(Voxel voxel, uint32_t weight) {
+                weights[voxel.material] += weight;
+                float x, y, z;
+                if (!voxel.get_normal(x, y, z)) return;
+                normal_x += x * float(weight);
+                normal_y += y * float(weight);
+                normal_z += z * float(weight);
+            }
 
             /**
-             * The header starts with two bits encoding the LOD status:
-             * - If the first bits are 0b00, the last 30 bits are the address of the first non-empty subnode.
-             * - If the first bits are 0b01, the node is terminal and the last 30 bits are the address of the first non-empty voxel.
-             * - If the first bits are Ob11, the node is terminal and the last 8 bits are the LOD color of the non-empty subnodes.
+             * Add every voxel of a terminal node, with a weight of one.
              */
-            uint32_t header = 0;
+            void add_leaf(const Node &leaf) {
+                int voxel_count = __builtin_popcountll(leaf.bitmap);
+                if ((leaf.header >> 30) == 0b11u) {
+                    add(get_leaf_voxel(leaf, 0), voxel_count);
+                    return;
+                }
+
+                // Arrays are walked directly rather than through get_leaf_voxel, as this runs for every leaf below an updated node
+                Voxel voxel;
+                auto *child_array = (const uint8_t *) memory_pool->to_pointer(leaf.header & ~(0b11u << 30));
+                if ((leaf.header >> 30) == 0b01u) {
+                    for (int i = 0; i < voxel_count; i++) {
+                        memcpy(&voxel, child_array + i * sizeof(Voxel), sizeof(Voxel));
+                        add(voxel, 1);
+                    }
+                    return;
+                }
+                int palette_size = child_array[0], bits = palette_index_bits(palette_size);
+                const uint8_t *packed_indices = child_array + 1 + palette_size * sizeof(Voxel);
+                uint32_t palette_weights[IVY_LEAF_PALETTE_SIZE] = {};
+                for (int i = 0; i < voxel_count; i++) palette_weights[(packed_indices[i * bits / 8] >> (i * bits % 8)) & ((1 << bits) - 1)]++;
+                for (int i = 0; i < palette_size; i++) {
+                    memcpy(&voxel, child_array + 1 + i * sizeof(Voxel), sizeof(Voxel));
+                    add(voxel, palette_weights[i]);
+                }
+            }
+
+            Voxel get_dominant() const {
+                Voxel voxel{Material(std::max_element(weights, weights + 256) - weights)};
+                voxel.set_normal(normal_x, normal_y, normal_z);
+                return voxel;
+            }
         };
 
-        void delete_node_recursively(MemoryPoolClient *memory_subpool, Node *node, int depth) {
-            depth += 1;
-            if (depth != IVY_REGION_TREE_DEPTH) {
-                Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+        /**
+         * Elect the LOD voxel of an inner node from its children, and write it in the LOD slot at the end of its child array. The voxels
+         * of terminal children are counted one by one, and other children count for their LOD voxel, weighted by their number of
+         * children, so that their LOD slots must already be up to date.
+         */
+        void update_lod(Node *node) {
+            assert((node->header >> 30) == 0b00u && node->bitmap != 0);
+            Node *child_array = (Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            int child_count = __builtin_popcountll(node->bitmap);
+            LodHistogram histogram;
+            for (int i = 0; i < child_count; i++) {
+                if ((child_array[i].header >> 30) != 0b00u) histogram.add_leaf(child_array[i]);
+                else histogram.add(get_lod_voxel(child_array[i]), __builtin_popcountll(child_array[i].bitmap));
+            }
+            Voxel dominant_voxel = histogram.get_dominant();
+            uint32_t lod_voxel = 0;
+            memcpy(&lod_voxel, (const uint8_t *) &dominant_voxel, sizeof(Voxel));
+            Node &lod_slot = child_array[child_count];
+            lod_slot.bitmap = 0;
+            lod_slot.header = lod_voxel | (0b11u << 30);
+            memory_pool->mark_dirty(&lod_slot, sizeof(Node));
+        }
+
+        /**
+         * Update the LOD slots of a whole subtree, bottom-up, for instance once it has been built without maintaining them.
+         */
+        void update_subtree_lods(Node *node) {
+            if (!has_array(node) || (node->header >> 30) != 0b00u) return;
+            Node *child_array = (Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            for (int i = 0; i < __builtin_popcountll(node->bitmap); i++) update_subtree_lods(&child_array[i]);
+            update_lod(node);
+        }
+
+        /**
+         * Give a node its own copy of its array if the array is shared with other nodes, so that the array can be modified in place. The
+         * children of the copy then have one more parent.
+         * @param reference_counts Number of parents of the shared arrays, see WideTree::deduplicate.
+         */
+        void unshare_array(MemoryPoolClient *memory_subpool, std::unordered_map<uint32_t, uint32_t> &reference_counts, Node *node) {
+            if (reference_counts.empty() || !has_array(node)) return;
+            auto it = reference_counts.find(node->header & ~(0b11u << 30));
+            if (it == reference_counts.end()) return;
+            if (--it->second == 1) reference_counts.erase(it);
+
+            void *previous_child_array = memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+            int array_size = child_array_size(node, previous_child_array);
+            void *child_array = memory_subpool->allocate(array_size);
+            memcpy(child_array, previous_child_array, array_size);
+            node->header = (node->header & (0b11u << 30)) | memory_subpool->to_index(child_array);
+            memory_pool->mark_dirty(node, sizeof(Node));
+            if ((node->header >> 30) != 0b00u) return;
+            for (int i = 0; i < __builtin_popcountll(node->bitmap); i++) {
+                Node &child = ((Node *) child_array)[i];
+                if (!has_array(&child)) continue;
+                reference_counts.try_emplace(child.header & ~(0b11u << 30), 1).first->second++;
+            }
+        }
+
+        /**
+         * Free the child array of a node, or only drop one of its references if it is shared with other nodes. The node is left as is.
+         */
+        void release_array(MemoryPoolClient *memory_subpool, std::unordered_map<uint32_t, uint32_t> &reference_counts, Node *node) {
+            if (!has_array(node)) return;
+            auto it = reference_counts.find(node->header & ~(0b11u << 30));
+            if (it == reference_counts.end()) {
+                void *child_array = memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+                memory_subpool->deallocate(child_array, child_array_size(node, child_array));
+            } else if (--it->second == 1) {
+                reference_counts.erase(it);
+            }
+        }
+
+        /**
+         * @return What the parent of an inner node elects its LOD voxel from, see update_lod: the LOD slot of the node and its number of
+         * children, or 0 if the node is empty.
+         */
+        uint64_t get_lod_signature(const Node *node) {
+            if (node->bitmap == 0) return 0;
+            auto *child_array = (const Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            return uint64_t(__builtin_popcountll(node->bitmap)) << 32 | child_array[__builtin_popcountll(node->bitmap)].header;
+        }
+
+        /**
+         * Write a chunk in the subtree of the given node, creating the missing nodes on the way down. Shared arrays met on the way are
+         * copied first, so that the other nodes referencing them are left untouched.
+         * @param depth The depth of the given node, 0 being the root.
+         * @param node_width The width of the given node, in voxels.
+         * @param is_lod_updated Whether to update the LOD slots on the way back up. Otherwise, they are left stale until the next call to
+         * update_subtree_lods.
+         */
+        void insert_chunk(MemoryPoolClient *memory_subpool, std::unordered_map<uint32_t, uint32_t> &reference_counts, Node *node, int depth,
+                          int node_width, int dx, int dy, int dz, Chunk *chunk, bool is_lod_updated) {
+            int child_x, child_y, child_z, child_xyz;
+            Node *path[IVY_REGION_TREE_DEPTH];
+            uint64_t lod_signatures[IVY_REGION_TREE_DEPTH];
+            int path_length = 0;
+
+            // While we have not reached the target bottom level node, we go down the tree
+            while (++depth != IVY_REGION_TREE_DEPTH) {
+                unshare_array(memory_subpool, reference_counts, node);
+
+                // The node we traverse is not supposed to be terminal, or even weirder a LOD node
+                assert((node->header >> 30) == 0b00u);
+                if (is_lod_updated) {
+                    path[path_length] = node;
+                    lod_signatures[path_length++] = get_lod_signature(node);
+                }
+
+                // We update node_width to be the width of a child of the current node
+                node_width /= IVY_NODE_WIDTH;
+                child_x = dx / node_width;
+                child_y = dy / node_width;
+                child_z = dz / node_width;
+                dx -= child_x * node_width;
+                dy -= child_y * node_width;
+                dz -= child_z * node_width;
+
+                // If the current node has no child where we want to go, we have to create it
+                child_xyz = int(child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
+                if ((node->bitmap & (0x1ul << child_xyz)) == 0) {
+
+                    //assert((node->header & ~(0b11u << 30)) != 0); //
+
+                    // First, we update the current node bitmap to account for the child that will soon be created
+                    int previous_child_count = __builtin_popcountll(node->bitmap);
+                    int previous_child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
+                    node->bitmap = node->bitmap | (0x1ul << child_xyz);
+
+                    // The while loop guarantee the current node is not supposed to be terminal. As such, the current node children are nodes of size 12.
+
+                    // We extend the child array to have room for the newly created child
+                    Node *previous_child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+                    Node *new_child_array = (Node *) memory_subpool->allocate((previous_child_count + 2) * int(sizeof(Node)));
+
+                    // We copy from the previous child array to the new one, while leaving an empty space for the new child, and keeping
+                    // the LOD slot at the end. Then, we don't forget to free the old child array
+                    if (previous_child_count != 0) {
+                        memcpy(new_child_array, previous_child_array, previous_child_id * sizeof(Node));
+                        memcpy(new_child_array + previous_child_id + 1, previous_child_array + previous_child_id, (previous_child_count - previous_child_id + 1) * sizeof(Node));
+                        memory_subpool->deallocate(previous_child_array, int(sizeof(Node)) * (previous_child_count + 1));
+                    }
+
+                    // We place the child array in the current node header
+                    node->header = (node->header & (0b11u << 30)) | memory_subpool->to_index(new_child_array);
+                    memory_pool->mark_dirty(node, sizeof(Node));
+
+                    // And at last, we use placement new to create the new subnode that is the new "current" node
+                    Node *child = new_child_array + previous_child_id;
+                    child->header = 0;
+                    child->bitmap = 0;
+                    node = child;
+
+                    // If this new node happens to be terminal, we mark it as such
+                    if (depth + 1 == IVY_REGION_TREE_DEPTH) child->header = child->header | (0x1u << 30);
+                } else {
+                    // If a child exist for the volume we want to write to, we just enter it
+                    int previous_child_id = __builtin_popcountll(node->bitmap & ~((~0x0ul) << child_xyz));
+                    Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+                    node = &child_array[previous_child_id];
+                }
+            }
+
+            // Once we have reached this point, the "node" variable should be set to the address we want to write to.
+            // It's now time to actually copy the chunk in the region memory!
+
+            // If the target node has an allocation (non-empty and non-LOD), we first have to free it, unless other nodes still share it
+            release_array(memory_subpool, reference_counts, node);
+            node->bitmap = 0;  // LOD leaves have a bitmap too, which write_leaf would otherwise merge with the new one
+
+            // Now that we know for sure that the node has no existing allocation, we can write into it
+            write_leaf(memory_subpool, node, chunk);
+            memory_pool->mark_dirty(node, sizeof(Node));
+
+            // At last, the LOD slots are updated bottom-up, until one of them is left as it was, as its parent then has nothing new to
+            // elect its own LOD voxel from
+            while (path_length-- > 0) {
+                update_lod(path[path_length]);
+                if (get_lod_signature(path[path_length]) == lod_signatures[path_length]) break;
+            }
+        }
+
+        /**
+         * @return The terminal node holding the chunk at the given position, or nullptr if the tree has no voxel there.
+         */
+        const Node *find_leaf(const Node *root, int dx, int dy, int dz) {
+            const Node *node = root;
+            for (int node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH; node_width >= IVY_NODE_WIDTH; node_width /= IVY_NODE_WIDTH) {
+                int child_xyz = (dx / node_width) % IVY_NODE_WIDTH + (dy / node_width) % IVY_NODE_WIDTH * IVY_NODE_WIDTH +
+                                (dz / node_width) % IVY_NODE_WIDTH * IVY_NODE_WIDTH * IVY_NODE_WIDTH;
+                if ((node->bitmap & (0x1ul << child_xyz)) == 0) return nullptr;
+                auto *child_array = (const Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+                node = &child_array[__builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz))];
+            }
+            return node->bitmap != 0 ? node : nullptr;
+        }
+
+        /**
+         * Decode the voxels of a terminal node in a chunk, air where the node has no voxel.
+         */
+        void read_leaf(const Node *leaf, Chunk &chunk) {
+            for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+                bool is_set = (leaf->bitmap & (0x1ul << child_xyz)) != 0;
+                chunk.set(child_xyz % IVY_NODE_WIDTH, child_xyz / IVY_NODE_WIDTH % IVY_NODE_WIDTH, child_xyz / IVY_NODE_WIDTH_SQUARED,
+                          is_set ? get_leaf_voxel(*leaf, child_xyz) : Voxel{AIR});
+            }
+        }
+
+        /**
+         * Merge chunk edits sorted by key into the subtree of the given node, see WideTree::apply. Terminal nodes are decoded, edited and
+         * written again as a whole. Existing children of inner nodes are edited in place, and new ones in a local array, so that the child array is
+         * only reallocated once the set of children is known, and only if it changed.
+         * @param depth The depth of the given node, 0 being the root.
+         */
+        void apply_edits(MemoryPoolClient *memory_subpool, std::unordered_map<uint32_t, uint32_t> &reference_counts, Node *node, int depth,
+                         const ChunkEdit *edits, size_t edit_count) {
+            if (depth == IVY_REGION_TREE_DEPTH - 1) {
+                // Keys are distinct, so a terminal node only gets the edits of its own chunk, which are read back unless they cover it
+                assert(edit_count == 1);
+                Chunk chunk;
+                if (edits->mask != UINT64_MAX) read_leaf(node, chunk);
+                for (uint64_t mask = edits->mask; mask != 0; mask &= mask - 1) {
+                    int child_xyz = __builtin_ctzll(mask);
+                    chunk.set(child_xyz % IVY_NODE_WIDTH, child_xyz / IVY_NODE_WIDTH % IVY_NODE_WIDTH, child_xyz / IVY_NODE_WIDTH_SQUARED, edits->voxels[child_xyz]);
+                }
+                release_array(memory_subpool, reference_counts, node);
+                node->bitmap = 0;
+                write_leaf(memory_subpool, node, &chunk);
+                memory_pool->mark_dirty(node, sizeof(Node));
+                return;
+            }
+
+            unshare_array(memory_subpool, reference_counts, node);
+            assert((node->header >> 30) == 0b00u);
+            Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+            Node new_children[IVY_NODE_WIDTH_CUBED];
+            uint64_t bitmap = node->bitmap;
+            int shift = 6 * (IVY_REGION_TREE_DEPTH - 2 - depth);
+            for (size_t begin = 0, end; begin < edit_count; begin = end) {
+                // The edits of each child are contiguous, since they are sorted by key
+                int child_xyz = int(edits[begin].key >> shift) & 0x3f;
+                for (end = begin + 1; end < edit_count && (int(edits[end].key >> shift) & 0x3f) == child_xyz; end++);
+                Node *child = &new_children[child_xyz];
+                if ((node->bitmap & (0x1ul << child_xyz)) != 0) child = &child_array[__builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz))];
+                else *child = {};
+                apply_edits(memory_subpool, reference_counts, child, depth + 1, edits + begin, end - begin);
+                bitmap = child->bitmap != 0 ? bitmap | (0x1ul << child_xyz) : bitmap & ~(0x1ul << child_xyz);
+            }
+
+            // If children were added or removed, the child array is replaced by one with the final set of children
+            if (bitmap != node->bitmap) {
+                int previous_child_count = __builtin_popcountll(node->bitmap), child_count = __builtin_popcountll(bitmap);
+                Node *new_child_array = child_count != 0 ? (Node *) memory_subpool->allocate((child_count + 1) * int(sizeof(Node))) : nullptr;
+                int child_id = 0;
+                for (uint64_t remaining = bitmap; remaining != 0; remaining &= remaining - 1) {
+                    int child_xyz = __builtin_ctzll(remaining);
+                    if ((node->bitmap & (0x1ul << child_xyz)) == 0) new_child_array[child_id++] = new_children[child_xyz];
+                    else new_child_array[child_id++] = child_array[__builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz))];
+                }
+                if (previous_child_count != 0) memory_subpool->deallocate(child_array, (previous_child_count + 1) * int(sizeof(Node)));
+                node->bitmap = bitmap;
+                node->header = child_count != 0 ? memory_subpool->to_index(new_child_array) : 0;
+                memory_pool->mark_dirty(node, sizeof(Node));
+            }
+
+            // Then the children are final, so the LOD voxel of the node can be elected again
+            if (node->bitmap != 0) update_lod(node);
+        }
+
+        void measure_subtree(Node *node, size_t &node_bytes, size_t &voxel_bytes) {
+            if (!has_array(node)) return;
+            Node *child_array = (Node *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            if ((node->header >> 30) != 0b00u) {
+                voxel_bytes += child_array_size(node, child_array);
+                return;
+            }
+            node_bytes += child_array_size(node, child_array);
+            for (int i = 0; i < __builtin_popcountll(node->bitmap); i++) measure_subtree(&child_array[i], node_bytes, voxel_bytes);
+        }
+
+        /**
+         * Copy the arrays of a subtree in depth-first order: first the child array of the node, then the subtree of each child in turn.
+         */
+        void relayout_subtree(MemoryPoolClient *memory_subpool, Node *node, char *&node_cursor, char *&voxel_cursor) {
+            if (!has_array(node)) return;
+            void *previous_child_array = memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            if ((node->header >> 30) != 0b00u) {
+                void *child_array = memory_subpool->allocate_in_span(voxel_cursor, child_array_size(node, previous_child_array));
+                memcpy(child_array, previous_child_array, child_array_content_size(node, previous_child_array));
+                node->header = (node->header & (0b11u << 30)) | memory_subpool->to_index(child_array);
+                return;
+            }
+            int child_count = __builtin_popcountll(node->bitmap), array_size = child_array_size(node, previous_child_array);
+            Node *child_array = (Node *) memory_subpool->allocate_in_span(node_cursor, array_size);
+            memcpy(child_array, previous_child_array, array_size);
+            node->header = memory_subpool->to_index(child_array);
+            for (int i = 0; i < child_count; i++) relayout_subtree(memory_subpool, &child_array[i], node_cursor, voxel_cursor);
+        }
+
+        /**
+         * Hash-consing of the arrays of a tree, see WideTree::deduplicate. Subtrees are visited bottom-up, so that the child arrays of
+         * identical nodes have already been merged, and identical arrays have the same bytes.
+         */
+        class ArrayDeduplicator {
+            struct Array {
+                uint32_t header;
+                int child_count, size;
+            };
+
+            std::unordered_multimap<size_t, Array> arrays;  // Arrays met so far, by hash of their content
+
+        public:
+            size_t total_node_bytes = 0, total_voxel_bytes = 0;  // Bytes of every array met, as stored in a tree
+            size_t node_bytes = 0, voxel_bytes = 0;  // Bytes of the distinct arrays only
+
+            /**
+             * Point the node, and every node of its subtree, to the first array met with the same content.
+             */
+            void deduplicate(Node *node) {
+                if (!has_array(node)) return;
                 int child_count = __builtin_popcountll(node->bitmap);
-                for (int i = 0; i < child_count; i++) {
-                    delete_node_recursively(memory_subpool, &child_array[child_count], depth);
+                bool is_terminal = (node->header >> 30) != 0b00u;
+                char *child_array = (char *) memory_pool->to_pointer(node->header & ~(0b11u << 30));
+                if (!is_terminal) {
+                    for (int i = 0; i < child_count; i++) deduplicate(&((Node *) child_array)[i]);
+                }
+                (is_terminal ? total_voxel_bytes : total_node_bytes) += child_array_size(node, child_array);
+
+                // Voxel arrays are compared without their padding, whose content is undefined
+                int size = child_array_content_size(node, child_array);
+                size_t hash = std::hash<std::string_view>()(std::string_view(child_array, size)) ^ ((node->header >> 30) * 0x9e3779b97f4a7c15ul);
+                auto range = arrays.equal_range(hash);
+                for (auto it = range.first; it != range.second; it++) {
+                    if (it->second.child_count != child_count || it->second.size != size) continue;
+                    if ((it->second.header & (0b11u << 30)) != (node->header & (0b11u << 30))) continue;
+                    if (memcmp(memory_pool->to_pointer(it->second.header & ~(0b11u << 30)), child_array, size) != 0) continue;
+                    node->header = it->second.header;
+                    return;
                 }
+                arrays.insert({hash, {node->header, child_count, size}});
+                (is_terminal ? voxel_bytes : node_bytes) += child_array_size(node, child_array);
+            }
+        };
+
+        /**
+         * Same as relayout_subtree, but copying each array shared by several nodes only once, and counting the parents of such arrays.
+         * @param new_indices Index of the copy of each array already copied, by index of the array.
+         */
+        void relayout_dag(MemoryPoolClient *memory_subpool, Node *node, char *&node_cursor, char *&voxel_cursor,
+                          std::unordered_map<uint32_t, uint32_t> &new_indices, std::unordered_map<uint32_t, uint32_t> &reference_counts) {
+            if (!has_array(node)) return;
+            auto [it, is_new] = new_indices.try_emplace(node->header & ~(0b11u << 30), 0);
+            if (!is_new) {
+                node->header = (node->header & (0b11u << 30)) | it->second;
+                reference_counts.try_emplace(it->second, 1).first->second++;
+                return;
+            }
+            void *previous_child_array = memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            if ((node->header >> 30) != 0b00u) {
+                void *child_array = memory_subpool->allocate_in_span(voxel_cursor, child_array_size(node, previous_child_array));
+                memcpy(child_array, previous_child_array, child_array_content_size(node, previous_child_array));
+                it->second = memory_subpool->to_index(child_array);
+                node->header = (node->header & (0b11u << 30)) | it->second;
+                return;
+            }
+            int child_count = __builtin_popcountll(node->bitmap), array_size = child_array_size(node, previous_child_array);
+            Node *child_array = (Node *) memory_subpool->allocate_in_span(node_cursor, array_size);
+            memcpy(child_array, previous_child_array, array_size);
+            it->second = memory_subpool->to_index(child_array);
+            node->header = it->second;
+            for (int i = 0; i < child_count; i++) relayout_dag(memory_subpool, &child_array[i], node_cursor, voxel_cursor, new_indices, reference_counts);
+        }
+
+        /**
+         * Same as relayout_subtree, but into a standalone image whose addresses are offsets from its start, in pool index units.
+         */
+        void write_subtree(Node *node, char *image, size_t &node_offset, size_t &voxel_offset) {
+            if (!has_array(node)) return;
+            void *child_array = memory_pool->to_pointer(node->header & ~(0b11u << 30));
+            if ((node->header >> 30) != 0b00u) {
+                memcpy(image + voxel_offset, child_array, child_array_content_size(node, child_array));
+                node->header = (node->header & (0b11u << 30)) | uint32_t(voxel_offset / IVY_POOL_INDEX_UNIT);
+                voxel_offset += child_array_size(node, child_array);
+                return;
+            }
+            int child_count = __builtin_popcountll(node->bitmap), array_size = child_array_size(node, child_array);
+            Node *image_child_array = (Node *) (image + node_offset);
+            memcpy(image_child_array, child_array, array_size);
+            node->header = uint32_t(node_offset / IVY_POOL_INDEX_UNIT);
+            node_offset += array_size;
+            for (int i = 0; i < child_count; i++) write_subtree(&image_child_array[i], image, node_offset, voxel_offset);
+        }
+
+        /**
+         * Turn the image offset in the header of a node loaded from a region file into a pool address, and account its array as allocated
+         * by the subpool the image was mapped in.
+         * @return Whether the array fits in the image.
+         */
+        bool rebase_node(MemoryPoolClient *memory_subpool, Node *node, char *image, size_t image_size) {
+            if (!has_array(node)) return true;
+            size_t offset = size_t(node->header & ~(0b11u << 30)) * IVY_POOL_INDEX_UNIT;
+            if (offset >= image_size) return false;  // Palette arrays start with the size of their palette, which must be in the image too
+            int array_size = child_array_size(node, image + offset);
+            if (offset + array_size > image_size) return false;
+            char *cursor = image + offset;
+            node->header = (node->header & (0b11u << 30)) | memory_subpool->to_index(memory_subpool->allocate_in_span(cursor, array_size));
+            return true;
+        }
+
+        /**
+         * Rebase a whole subtree loaded from an image, from the given node down.
+         */
+        bool rebase_subtree(MemoryPoolClient *memory_subpool, Node *node, char *image, size_t image_size) {
+            if (!rebase_node(memory_subpool, node, image, image_size)) return false;
+            if (node->bitmap == 0 || (node->header >> 30) != 0b00u) return true;
+            Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+            for (int i = 0; i < __builtin_popcountll(node->bitmap); i++) {
+                if (!rebase_subtree(memory_subpool, &child_array[i], image, image_size)) return false;
+            }
+            return true;
+        }
+
+        /**
+         * Move the array of a node to a new allocation if it lies in an evacuated block, and patch the header of the node.
+         */
+        void evacuate_array(MemoryPoolClient *memory_subpool, Node *node) {
+            if (!has_array(node)) return;
+            void *child_array = memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+            int array_size = child_array_size(node, child_array);
+            if (!memory_subpool->is_evacuated(child_array, array_size)) return;
+            void *new_child_array = memory_subpool->allocate(array_size);
+            memcpy(new_child_array, child_array, array_size);
+            memory_subpool->deallocate(child_array, array_size);
+            node->header = (node->header & (0b11u << 30)) | memory_subpool->to_index(new_child_array);
+            memory_pool->mark_dirty(node, sizeof(Node));
+        }
+
+        /**
+         * Move the arrays of a subtree that lie in evacuated blocks, depth-first, as long as the budget of visited nodes lasts.
+         * @param path Child indices leading from the root to the next node to visit. The nodes above it were visited already, and the
+         * path is kept by child index rather than by position in the arrays, so that it survives the edits made between two steps.
+         * @param depth Depth of the node, whose child indices start at path[depth].
+         * @param budget Number of nodes that may be visited, decremented by the number visited.
+         * @return Whether the subtree was visited to its end. Otherwise, the path leads to the next node to visit.
+         */
+        bool evacuate_subtree(MemoryPoolClient *memory_subpool, Node *node, std::vector<int> &path, size_t depth, int &budget) {
+            int first_child_xyz = 0;
+            if (depth < path.size()) {
+                first_child_xyz = path[depth];
             } else {
-                auto *child_array = (Voxel *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
-                int child_count = __builtin_popcountll(node->bitmap);
-                for (int i = 0; i < child_count; i++) {
-                    memory_subpool->deallocate(&child_array[child_count], sizeof(Voxel));
+                if (budget <= 0) return false;
+                budget--;
+                evacuate_array(memory_subpool, node);
+            }
+            if (node->bitmap == 0 || (node->header >> 30) != 0b00u) return true;
+
+            Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
+            for (int child_xyz = first_child_xyz; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+                if ((node->bitmap & (0x1ul << child_xyz)) == 0) continue;
+                if (path.size() <= depth || path[depth] != child_xyz) {
+                    path.resize(depth + 1);
+                    path[depth] = child_xyz;
+                }
+                Node *child = &child_array[__builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz))];
+                if (!evacuate_subtree(memory_subpool, child, path, depth + 1, budget)) return false;
+            }
+            return true;
+        }
+
+        #define IVY_REGION_FILE_MAGIC (0x52795669u)  // "iVyR"
+        #define IVY_REGION_FILE_VERSION (4)
+        #define IVY_REGION_FILE_HEADER_SIZE (4096)  // The image starts on a page boundary, so that it can be memory-mapped
+
+        struct RegionFileHeader {
+            uint32_t magic, version, tree_depth, voxel_size;
+            uint64_t node_bytes, voxel_bytes;
+            Node root;
+        };
+
+        /**
+         * Build a tree bottom-up from chunks given in Morton order. Each level keeps the children of its currently open node in a
+         * 64-slot array, and the child array of a node is only allocated once that node is closed, that is once no later chunk can fall in it.
+         */
+        class BulkBuilder {
+            struct Level {
+                uint64_t bitmap = 0;
+                Node children[IVY_NODE_WIDTH_CUBED];
+            };
+
+            MemoryPoolClient *memory_subpool;
+            Level levels[IVY_REGION_TREE_DEPTH - 1];  // The children of the open node at each depth, from the root to the parents of terminal nodes
+            uint64_t previous_key = 0;
+            bool is_empty = true;
+
+            static int child_index(uint64_t key, int depth) {
+                return int(key >> (6 * (IVY_REGION_TREE_DEPTH - 2 - depth))) & 0x3f;
+            }
+
+            // Allocate the final child array of the open node at the given depth with its LOD slot, and reset the level for the next node
+            uint32_t emit(Level &level) {
+                Node *child_array = (Node *) memory_subpool->allocate((__builtin_popcountll(level.bitmap) + 1) * int(sizeof(Node)));
+                int child_id = 0;
+                for (uint64_t bitmap = level.bitmap; bitmap != 0; bitmap &= bitmap - 1) {
+                    child_array[child_id++] = level.children[__builtin_ctzll(bitmap)];
+                }
+                Node node = {level.bitmap, memory_subpool->to_index(child_array)};
+                update_lod(&node);
+                level.bitmap = 0;
+                return node.header;
+            }
+
+            // Turn the open node at the given depth into a child of the open node of its parent level
+            void close(int depth, uint64_t key) {
+                Level &level = levels[depth];
+                if (level.bitmap == 0) return;
+                int child_xyz = child_index(key, depth - 1);
+                Node &node = levels[depth - 1].children[child_xyz];
+                node.bitmap = level.bitmap;
+                node.header = emit(level);
+                levels[depth - 1].bitmap |= 0x1ul << child_xyz;
+            }
+
+        public:
+            explicit BulkBuilder(MemoryPoolClient *memory_subpool) : memory_subpool(memory_subpool) {}
+
+            void push(uint64_t key, const Chunk *chunk) {
+                // Every node of the previous chunk path below the first diverging depth is complete, so we close them
+                if (!is_empty) {
+                    assert(key >= previous_key);
+                    int depth = 0;
+                    while (depth < IVY_REGION_TREE_DEPTH - 2 && child_index(key, depth) == child_index(previous_key, depth)) depth++;
+                    for (int closed_depth = IVY_REGION_TREE_DEPTH - 2; closed_depth > depth; closed_depth--) close(closed_depth, previous_key);
+                }
+                previous_key = key;
+                is_empty = false;
+
+                // Then we write the chunk as a terminal node in the open node of the last level
+                Node leaf = {};
+                write_leaf(memory_subpool, &leaf, chunk);
+                if (leaf.bitmap == 0) return;
+                Level &level = levels[IVY_REGION_TREE_DEPTH - 2];
+                int child_xyz = child_index(key, IVY_REGION_TREE_DEPTH - 2);
+                Node &previous_leaf = level.children[child_xyz];
+                if ((level.bitmap & (0x1ul << child_xyz)) != 0 && has_array(&previous_leaf)) {
+                    void *child_array = memory_subpool->to_pointer(previous_leaf.header & ~(0b11u << 30));
+                    memory_subpool->deallocate(child_array, child_array_size(&previous_leaf, child_array));
                 }
+                previous_leaf = leaf;
+                level.bitmap |= 0x1ul << child_xyz;
             }
+
+            void finish(Node *root) {
+                for (int depth = IVY_REGION_TREE_DEPTH - 2; depth > 0; depth--) close(depth, previous_key);
+                if (levels[0].bitmap == 0) return;
+                root->bitmap = levels[0].bitmap;
+                root->header = emit(levels[0]);
+            }
+        };
+    }
+
+    Voxel get_leaf_voxel(const Node &node, int child_xyz) {
+        Voxel voxel;
+        if ((node.header >> 30) == 0b11u) {
+            uint32_t lod_voxel = node.header & ~(0b11u << 30);
+            memcpy(&voxel, (const uint8_t *) &lod_voxel, sizeof(Voxel));
+            return voxel;
+        }
+        auto *child_array = (const uint8_t *) memory_pool->to_pointer(node.header & ~(0b11u << 30));
+        int child_id = __builtin_popcountll(node.bitmap & ~(UINT64_MAX << child_xyz));
+        if ((node.header >> 30) == 0b01u) {
+            memcpy(&voxel, child_array + child_id * sizeof(Voxel), sizeof(Voxel));
+            return voxel;
+        }
+        int palette_size = child_array[0], bits = palette_index_bits(palette_size);
+        const uint8_t *packed_indices = child_array + 1 + palette_size * sizeof(Voxel);
+        int index = (packed_indices[child_id * bits / 8] >> (child_id * bits % 8)) & ((1 << bits) - 1);
+        memcpy(&voxel, child_array + 1 + index * sizeof(Voxel), sizeof(Voxel));
+        return voxel;
+    }
+
+    Voxel get_lod_voxel(const Node &node) {
+        if ((node.header >> 30) == 0b11u) return get_leaf_voxel(node, 0);
+        if ((node.header >> 30) != 0b00u) {
+            LodHistogram histogram;
+            histogram.add_leaf(node);
+            return histogram.get_dominant();
         }
+        auto *child_array = (const Node *) memory_pool->to_pointer(node.header & ~(0b11u << 30));
+        return get_leaf_voxel(child_array[__builtin_popcountll(node.bitmap)], 0);
     }
 
-    WideTree::WideTree() : memory_subpool{memory_pool->create_client()} {
-        Node *node = (Node *) memory_subpool->allocate(sizeof(Node));
+    WideTree::WideTree() : root_subpool{memory_pool->create_client()}, memory_subpool{memory_pool->create_client()} {
+        Node *node = (Node *) root_subpool->allocate(sizeof(Node));
         node->header = 0;
         node->bitmap = 0;
-        root_node = memory_subpool->to_index(node);
+        root_node = root_subpool->to_index(node);
     }
 
     WideTree::~WideTree() {
-        delete_node_recursively(memory_subpool, (Node *) memory_subpool->to_pointer(root_node), 0);
+        // Every array of the tree belongs to one of its subpools, so freeing the subpools releases the whole tree at once
+        delete[] shards;
+        for (MemoryPoolClient *shard_subpool: shard_subpools) memory_pool->free_client(shard_subpool);
+        memory_pool->free_client(memory_subpool);
+        memory_pool->free_client(root_subpool);
+    }
+
+    void WideTree::mark_dirty() {
+        root_subpool->mark_dirty();
+        memory_subpool->mark_dirty();
+    }
+
+    bool WideTree::defragment_step(int budget) {
+        if (shards != nullptr || !reference_counts.empty()) return false;
+        if (!is_defragmenting) {
+            if (memory_subpool->begin_evacuation(IVY_DEFRAGMENTATION_OCCUPANCY) == 0) return false;
+            is_defragmenting = true;
+            defragmentation_path.clear();
+        }
+
+        // The free slots of the evacuated blocks are dropped first, then the arrays are moved out of them, depth-first from the root
+        if (memory_subpool->sweep_free_slots(budget)) return true;
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        if (memory_subpool->get_evacuated_count() != 0 && !evacuate_subtree(memory_subpool, root, defragmentation_path, 0, budget)) return true;
+        is_defragmenting = false;
+        return false;
     }
 
     uint32_t WideTree::get_root_node() const {
         return root_node;
     }
 
-    void WideTree::add_chunk(int dx, int dy, int dz, Chunk *chunk) {
-        Node *node = (Node *) memory_subpool->to_pointer(root_node);
-        int child_x, child_y, child_z, depth = 0, node_width = IVY_REGION_WIDTH, child_xyz;
+    void WideTree::compact() {
+        assert(shards == nullptr);
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        size_t node_bytes = 0, voxel_bytes = 0;
+        measure_subtree(root, node_bytes, voxel_bytes);
+        if (node_bytes == 0) return;
+
+        // The whole tree is copied in a new subpool, after what the previous subpools only hold garbage and can be freed
+        MemoryPoolClient *layout_subpool = memory_pool->create_client();
+        char *node_cursor = (char *) layout_subpool->allocate_span(node_bytes);
+        char *voxel_cursor = voxel_bytes != 0 ? (char *) layout_subpool->allocate_span(voxel_bytes) : nullptr;
+        relayout_subtree(layout_subpool, root, node_cursor, voxel_cursor);
+        memory_pool->mark_dirty(root, sizeof(Node));
+        memory_pool->free_client(memory_subpool);
+        memory_subpool = layout_subpool;
+        reference_counts.clear();
+    }
+
+    size_t WideTree::deduplicate() {
+        assert(shards == nullptr);
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        ArrayDeduplicator deduplicator;
+        deduplicator.deduplicate(root);
+        if (deduplicator.node_bytes == 0) return 0;
+
+        // Like compact, the distinct arrays are copied in a new subpool, after what the previous subpools only hold garbage
+        MemoryPoolClient *layout_subpool = memory_pool->create_client();
+        char *node_cursor = (char *) layout_subpool->allocate_span(deduplicator.node_bytes);
+        char *voxel_cursor = deduplicator.voxel_bytes != 0 ? (char *) layout_subpool->allocate_span(deduplicator.voxel_bytes) : nullptr;
+        std::unordered_map<uint32_t, uint32_t> new_indices;
+        reference_counts.clear();
+        relayout_dag(layout_subpool, root, node_cursor, voxel_cursor, new_indices, reference_counts);
+        memory_pool->mark_dirty(root, sizeof(Node));
+        memory_pool->free_client(memory_subpool);
+        memory_subpool = layout_subpool;
+        return deduplicator.total_node_bytes + deduplicator.total_voxel_bytes - deduplicator.node_bytes - deduplicator.voxel_bytes;
+    }
+
+    bool WideTree::save(const char *path) const {
+        assert(shards == nullptr);
+        RegionFileHeader header = {IVY_REGION_FILE_MAGIC, IVY_REGION_FILE_VERSION, IVY_REGION_TREE_DEPTH, sizeof(Voxel), 0, 0,
+                                   *(Node *) root_subpool->to_pointer(root_node)};
+        measure_subtree(&header.root, header.node_bytes, header.voxel_bytes);
+        std::vector<char> image(IVY_REGION_FILE_HEADER_SIZE + header.node_bytes + header.voxel_bytes);
+        size_t node_offset = 0, voxel_offset = header.node_bytes;
+        write_subtree(&header.root, image.data() + IVY_REGION_FILE_HEADER_SIZE, node_offset, voxel_offset);
+        memcpy(image.data(), &header, sizeof(header));
+
+        // Writing to a temporary file first, so that a region file mapped by another tree is never truncated
+        std::string temporary_path = std::string(path) + ".tmp";
+        FILE *file = fopen(temporary_path.c_str(), "wb");
+        if (!file) {
+            error("Could not open %s for writing", temporary_path.c_str());
+            return false;
+        }
+        bool is_written = fwrite(image.data(), 1, image.size(), file) == image.size();
+        is_written = fclose(file) == 0 && is_written;
+        if (!is_written || rename(temporary_path.c_str(), path) != 0) {
+            error("Could not write region file %s", path);
+            remove(temporary_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool WideTree::load(const char *path) {
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        if (shards != nullptr || root->bitmap != 0) fatal("Region files can only be loaded in an empty tree");
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return false;
+
+        // Checking that the file is complete, and was written with the same tree layout
+        RegionFileHeader header;
+        struct stat file_stat = {};
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &file_stat) != 0 || header.magic != IVY_REGION_FILE_MAGIC ||
+            header.version != IVY_REGION_FILE_VERSION || header.tree_depth != IVY_REGION_TREE_DEPTH || header.voxel_size != sizeof(Voxel) ||
+            size_t(file_stat.st_size) != IVY_REGION_FILE_HEADER_SIZE + header.node_bytes + header.voxel_bytes) {
+            warn("Ignoring region file %s, as it is truncated or was written with another tree layout", path);
+            close(fd);
+            return false;
+        }
+
+        // Then mapping the image in the pool, and rebasing its addresses. Since the image is in depth-first order with every node array
+        // before every voxel array, the nodes can simply be rebased one after the other.
+        size_t image_size = header.node_bytes + header.voxel_bytes;
+        if (image_size != 0) {
+            char *image = (char *) memory_subpool->map_span(fd, IVY_REGION_FILE_HEADER_SIZE, image_size);
+            Node *nodes = (Node *) image;
+            bool is_valid = rebase_node(memory_subpool, &header.root, image, image_size);
+            for (size_t i = 0; i < header.node_bytes / sizeof(Node); i++) is_valid = is_valid && rebase_node(memory_subpool, &nodes[i], image, image_size);
+            if (!is_valid) fatal("Corrupted region file %s", path);
+        }
+        close(fd);
+        *root = header.root;
+        memory_pool->mark_dirty(root, sizeof(Node));
+        return true;
+    }
+
+    void WideTree::export_subtree(int child_xyz, std::vector<char> &image) const {
+        assert(shards == nullptr);
+        image.clear();
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        if ((root->bitmap & (0x1ul << child_xyz)) == 0) return;
+        Node *child_array = (Node *) memory_pool->to_pointer(root->header & ~(0b11u << 30));
+        Node child = child_array[__builtin_popcountll(root->bitmap & ~(UINT64_MAX << child_xyz))];
+        size_t node_bytes = 0, voxel_bytes = 0;
+        measure_subtree(&child, node_bytes, voxel_bytes);
+        image.resize(sizeof(Node) + node_bytes + voxel_bytes);
+        memcpy(image.data(), &child, sizeof(Node));
+        size_t node_offset = sizeof(Node), voxel_offset = sizeof(Node) + node_bytes;
+        write_subtree((Node *) image.data(), image.data(), node_offset, voxel_offset);
+    }
+
+    bool WideTree::add_subtree(int child_xyz, const char *image, size_t image_size) {
+        assert(shards == nullptr);
+        if (child_xyz < 0 || child_xyz >= IVY_NODE_WIDTH_CUBED || image_size < sizeof(Node)) fatal("Invalid subtree image");
 
-        // While we have not reached the target bottom level node, we go down the tree
-        while (++depth != IVY_REGION_TREE_DEPTH) {
+        // The image is copied as is in a span, then rebased in place
+        char *span = (char *) memory_subpool->allocate_span(image_size);
+        memcpy(span, image, image_size);
+        Node child = *(Node *) span;
+        if (!rebase_subtree(memory_subpool, &child, span, image_size)) fatal("Corrupted subtree image");
+        if (child.bitmap == 0) return true;
+
+        // Then the child is placed in the root, whose child array has to grow if the child is new
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        int child_count = __builtin_popcountll(root->bitmap), child_id = __builtin_popcountll(root->bitmap & ~(UINT64_MAX << child_xyz));
+        Node *child_array = (Node *) memory_subpool->to_pointer(root->header & ~(0b11u << 30));
+        if ((root->bitmap & (0x1ul << child_xyz)) != 0) {
+            child_array[child_id] = child;
+            memory_pool->mark_dirty(&child_array[child_id], sizeof(Node));
+            update_lod(root);
+            return true;
+        }
+        Node *new_child_array = (Node *) memory_subpool->allocate((child_count + 2) * int(sizeof(Node)));
+        if (child_count != 0) {
+            memcpy(new_child_array, child_array, child_id * sizeof(Node));
+            memcpy(new_child_array + child_id + 1, child_array + child_id, (child_count - child_id) * sizeof(Node));
+            memory_subpool->deallocate(child_array, (child_count + 1) * int(sizeof(Node)));
+        }
+        new_child_array[child_id] = child;
+        root->bitmap |= 0x1ul << child_xyz;
+        root->header = memory_subpool->to_index(new_child_array);
+        memory_pool->mark_dirty(root, sizeof(Node));
+        update_lod(root);
+        return true;
+    }
 
-            // The node we traverse is not supposed to be terminal, or even weirder a LOD node
-            assert((node->header & (0b01u << 30)) == 0);
-            assert((node->header & (0b10u << 30)) == 0);
+    bool WideTree::save_archive(const char *path) const {
+        RegionArchiveWriter writer(path, IVY_REGION_ARCHIVE_LAYOUT);
+        std::vector<char> image;
+        for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+            export_subtree(child_xyz, image);
+            if (!image.empty()) writer.add_block(child_xyz, image.data(), image.size());
+        }
+        return writer.finish();
+    }
 
-            // We update node_width to be the width of a child of the current node
-            node_width /= IVY_NODE_WIDTH;
-            child_x = dx / node_width;
-            child_y = dy / node_width;
-            child_z = dz / node_width;
+    uint64_t WideTree::morton_key(int dx, int dy, int dz) {
+        uint64_t key = 0;
+        for (int node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH; node_width >= IVY_NODE_WIDTH; node_width /= IVY_NODE_WIDTH) {
+            int child_x = dx / node_width, child_y = dy / node_width, child_z = dz / node_width;
             dx -= child_x * node_width;
             dy -= child_y * node_width;
             dz -= child_z * node_width;
+            key = (key << 6) | uint64_t(child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
+        }
+        return key;
+    }
 
-            // If the current node has no child where we want to go, we have to create it
-            child_xyz = int(child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
-            if ((node->bitmap & (0x1ul << child_xyz)) == 0) {
+    void WideTree::build(const MortonChunk *chunks, size_t chunk_count) {
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        if (shards != nullptr || root->bitmap != 0) fatal("Bulk builds require an empty tree");
+        BulkBuilder builder(memory_subpool);
+        for (size_t i = 0; i < chunk_count; i++) builder.push(chunks[i].key, &chunks[i].chunk);
+        builder.finish(root);
+        memory_pool->mark_dirty(root, sizeof(Node));
+    }
 
-                //assert((node->header & ~(0b11u << 30)) != 0); //
+    void WideTree::build(int dx, int dy, int dz, int width, const Chunk *chunks) {
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        if (shards != nullptr || root->bitmap != 0) fatal("Bulk builds require an empty tree");
+        if (width < IVY_NODE_WIDTH || (width & (width - 1)) != 0 || (__builtin_ctz(width) & 1) != 0) fatal("Invalid grid width: %d", width);
+        if (dx % width != 0 || dy % width != 0 || dz % width != 0) fatal("Unaligned grid position: (%d; %d; %d)", dx, dy, dz);
 
-                // First, we update the current node bitmap to account for the child that will soon be created
-                int previous_child_count = __builtin_popcountll(node->bitmap);
-                int previous_child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
-                node->bitmap = node->bitmap | (0x1ul << child_xyz);
+        // Since the grid is aligned on its own width, visiting its chunks in local Morton order visits them in global Morton order too
+        int chunk_width = width / IVY_NODE_WIDTH, level_count = __builtin_ctz(chunk_width) / 2;
+        BulkBuilder builder(memory_subpool);
+        for (long local_key = 0; local_key < long(chunk_width) * chunk_width * chunk_width; local_key++) {
+            int x = 0, y = 0, z = 0;
+            for (int level = 0; level < level_count; level++) {
+                int child_xyz = int(local_key >> (6 * level)) & 0x3f;
+                x |= (child_xyz & 0b11) << (2 * level);
+                y |= ((child_xyz >> 2) & 0b11) << (2 * level);
+                z |= (child_xyz >> 4) << (2 * level);
+            }
+            int cx = dx + x * IVY_NODE_WIDTH, cy = dy + y * IVY_NODE_WIDTH, cz = dz + z * IVY_NODE_WIDTH;
+            builder.push(morton_key(cx, cy, cz), &chunks[x + y * chunk_width + z * chunk_width * chunk_width]);
+        }
+        builder.finish(root);
+        memory_pool->mark_dirty(root, sizeof(Node));
+    }
 
-                // The while loop guarantee the current node is not supposed to be terminal. As such, the current node children are nodes of size 12.
+    void WideTree::add_chunk(int dx, int dy, int dz, Chunk *chunk) {
+        if (shards == nullptr) {
+            insert_chunk(memory_subpool, reference_counts, (Node *) root_subpool->to_pointer(root_node), 0, IVY_REGION_WIDTH, dx, dy, dz, chunk, true);
+            return;
+        }
 
-                // We extend the child array to have room for the newly created child
-                Node *previous_child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
-                Node *new_child_array = (Node *) memory_subpool->allocate((previous_child_count + 1) * int(sizeof(Node)));
+        // During a concurrent build, we directly enter the shard of the root child the chunk belongs to. LOD slots are only updated once
+        // the build ends, as the shards are built in any order.
+        int node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH;
+        int child_x = dx / node_width, child_y = dy / node_width, child_z = dz / node_width;
+        int child_xyz = int(child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
+        Shard &shard = shards[child_xyz];
+        std::lock_guard<std::mutex> lock(shard.guard);
+        insert_chunk(shard_subpools[child_xyz], reference_counts, &shard.root, 1, node_width,
+                     dx - child_x * node_width, dy - child_y * node_width, dz - child_z * node_width, chunk, false);
+    }
 
-                // We copy from the previous child array to the new one, while leaving an empty space for the new child.
-                // Then, we don't forget to free the old child array
-                if (previous_child_count != 0) {
-                    memcpy(new_child_array, previous_child_array, previous_child_id * sizeof(Node));
-                    memcpy(new_child_array + previous_child_id + 1, previous_child_array + previous_child_id, (previous_child_count - previous_child_id) * sizeof(Node));
-                    memory_subpool->deallocate(previous_child_array, int(sizeof(Node)) * previous_child_count);
-                }
+    Voxel WideTree::get_voxel(int x, int y, int z) const {
+        if (x < 0 || x >= IVY_REGION_WIDTH || y < 0 || y >= IVY_REGION_WIDTH || z < 0 || z >= IVY_REGION_WIDTH) return Voxel{AIR};
+        const Node *leaf = find_leaf((Node *) root_subpool->to_pointer(root_node), x, y, z);
+        int child_xyz = x % IVY_NODE_WIDTH + y % IVY_NODE_WIDTH * IVY_NODE_WIDTH + z % IVY_NODE_WIDTH * IVY_NODE_WIDTH_SQUARED;
+        if (leaf == nullptr || (leaf->bitmap & (0x1ul << child_xyz)) == 0) return Voxel{AIR};
+        return get_leaf_voxel(*leaf, child_xyz);
+    }
 
-                // We place the child array in the current node header
-                node->header = (node->header & (0b11u << 30)) | memory_subpool->to_index(new_child_array);
+    void WideTree::apply(EditBatch &batch) {
+        assert(shards == nullptr);
+        if (batch.chunks.empty()) return;
+        std::sort(batch.chunks.begin(), batch.chunks.end(), [](const ChunkEdit &a, const ChunkEdit &b) { return a.key < b.key; });
+        apply_edits(memory_subpool, reference_counts, (Node *) root_subpool->to_pointer(root_node), 0, batch.chunks.data(), batch.chunks.size());
+        batch.clear();
+    }
 
-                // And at last, we use placement new to create the new subnode that is the new "current" node
-                Node *child = new_child_array + previous_child_id;
-                child->header = 0;
-                child->bitmap = 0;
-                node = child;
+    void WideTree::set_voxel(int x, int y, int z, Voxel voxel) {
+        EditBatch batch;
+        batch.set_voxel(x, y, z, voxel);
+        apply(batch);
+    }
 
-                // If this new node happens to be terminal, we mark it as such
-                if (depth + 1 == IVY_REGION_TREE_DEPTH) child->header = child->header | (0x1u << 30);
-            } else {
-                // If a child exist for the volume we want to write to, we just enter it
-                int previous_child_id = __builtin_popcountll(node->bitmap & ~((~0x0ul) << child_xyz));
-                Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
-                node = &child_array[previous_child_id];
-            }
-        }
+    void WideTree::fill_box(int min_x, int min_y, int min_z, int max_x, int max_y, int max_z, Voxel voxel) {
+        EditBatch batch;
+        batch.fill_box(min_x, min_y, min_z, max_x, max_y, max_z, voxel);
+        apply(batch);
+    }
 
-        // Once we have reached this point, the "node" variable should be set to the address we want to write to.
-        // It's now time to actually copy the chunk in the region memory!
+    void WideTree::fill_sphere(float center_x, float center_y, float center_z, float radius, Voxel voxel) {
+        EditBatch batch;
+        batch.fill_sphere(center_x, center_y, center_z, radius, voxel);
+        apply(batch);
+    }
 
-        // If the target node has an allocation (non-empty and non-LOD), we first have to free it
-        if (node->bitmap != 0 && (node->header & (0b10u << 30)) == 0) {
-            int child_count = __builtin_popcountll(node->bitmap);
-            node->bitmap = 0;
-            Node *child_array = (Node *) memory_subpool->to_pointer(node->header & ~(0b11u << 30));
-            memory_subpool->deallocate(child_array, int(child_count * sizeof(Voxel)));
-        }
-
-        // Now that we know for sure that the node has no existing allocation, we can write into it. First, we assemble the bitmask...
-        auto uniform_material = Voxel{AIR};
-        bool is_uniform = true;
-        for (child_z = 0; child_z < IVY_NODE_WIDTH; child_z++) {
-            for (child_y = 0; child_y < IVY_NODE_WIDTH; child_y++) {
-                for (child_x = 0; child_x < IVY_NODE_WIDTH; child_x++) {
-                    Voxel voxel = chunk->get(child_x, child_y, child_z);
-                    if (voxel.material != AIR) {
-                        if (uniform_material.material == AIR) {
-                            uniform_material = voxel;
-                        } else if (uniform_material.material != voxel.material) {
-                            is_uniform = false;
+    ChunkEdit &EditBatch::get_chunk(int dx, int dy, int dz) {
+        uint64_t key = WideTree::morton_key(dx, dy, dz);
+        auto [it, is_new] = chunk_ids.try_emplace(key, chunks.size());
+        if (is_new) chunks.emplace_back().key = key;
+        return chunks[it->second];
+    }
+
+    void EditBatch::set(ChunkEdit &chunk, int child_xyz, Voxel voxel) {
+        if ((chunk.mask & (0x1ul << child_xyz)) == 0) voxel_count++;
+        chunk.mask |= 0x1ul << child_xyz;
+        chunk.voxels[child_xyz] = voxel;
+    }
+
+    void EditBatch::set_voxel(int x, int y, int z, Voxel voxel) {
+        fill_box(x, y, z, x, y, z, voxel);
+    }
+
+    void EditBatch::fill_box(int min_x, int min_y, int min_z, int max_x, int max_y, int max_z, Voxel voxel) {
+        min_x = std::max(min_x, 0), min_y = std::max(min_y, 0), min_z = std::max(min_z, 0);
+        max_x = std::min(max_x, int(IVY_REGION_WIDTH) - 1), max_y = std::min(max_y, int(IVY_REGION_WIDTH) - 1), max_z = std::min(max_z, int(IVY_REGION_WIDTH) - 1);
+        for (int dz = min_z & ~(IVY_NODE_WIDTH - 1); dz <= max_z; dz += IVY_NODE_WIDTH) {
+            for (int dy = min_y & ~(IVY_NODE_WIDTH - 1); dy <= max_y; dy += IVY_NODE_WIDTH) {
+                for (int dx = min_x & ~(IVY_NODE_WIDTH - 1); dx <= max_x; dx += IVY_NODE_WIDTH) {
+                    ChunkEdit &chunk = get_chunk(dx, dy, dz);
+                    for (int z = std::max(dz, min_z); z <= std::min(dz + int(IVY_NODE_WIDTH) - 1, max_z); z++) {
+                        for (int y = std::max(dy, min_y); y <= std::min(dy + int(IVY_NODE_WIDTH) - 1, max_y); y++) {
+                            for (int x = std::max(dx, min_x); x <= std::min(dx + int(IVY_NODE_WIDTH) - 1, max_x); x++) {
+                                set(chunk, int(x - dx + (y - dy) * IVY_NODE_WIDTH + (z - dz) * IVY_NODE_WIDTH_SQUARED), voxel);
+                            }
                         }
-                        node->bitmap = node->bitmap | (0x1ul << (child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH));
                     }
                 }
             }
         }
+    }
 
-        if (is_uniform) {
-            // If the node is uniform, we apply the lod color & the terminal & lod bits
-            node->header = uniform_material.material | (0b11u << 30);
-        } else {
-            // If it's not, we allocate a voxel array, place it in the header, and set the voxels.
-            int child_count = __builtin_popcountll(node->bitmap);
-            auto *child_array = (Voxel *) memory_subpool->allocate(int(child_count * sizeof(Voxel)));
-            node->header = memory_subpool->to_index(child_array);
-            int index = 0;
-            for (child_z = 0; child_z < IVY_NODE_WIDTH; child_z++) {
-                for (child_y = 0; child_y < IVY_NODE_WIDTH; child_y++) {
-                    for (child_x = 0; child_x < IVY_NODE_WIDTH; child_x++) {
-                        Voxel voxel = chunk->get(child_x, child_y, child_z);
-                        if (voxel.material != AIR) {
-                            child_array[index] = voxel;
-                            index += 1;
-                        }
+    void EditBatch::fill_sphere(float center_x, float center_y, float center_z, float radius, Voxel voxel) {
+        int min_x = std::max(int(std::floor(center_x - radius)), 0), max_x = std::min(int(std::ceil(center_x + radius)), int(IVY_REGION_WIDTH) - 1);
+        int min_y = std::max(int(std::floor(center_y - radius)), 0), max_y = std::min(int(std::ceil(center_y + radius)), int(IVY_REGION_WIDTH) - 1);
+        int min_z = std::max(int(std::floor(center_z - radius)), 0), max_z = std::min(int(std::ceil(center_z + radius)), int(IVY_REGION_WIDTH) - 1);
+        for (int dz = min_z & ~(IVY_NODE_WIDTH - 1); dz <= max_z; dz += IVY_NODE_WIDTH) {
+            for (int dy = min_y & ~(IVY_NODE_WIDTH - 1); dy <= max_y; dy += IVY_NODE_WIDTH) {
+                for (int dx = min_x & ~(IVY_NODE_WIDTH - 1); dx <= max_x; dx += IVY_NODE_WIDTH) {
+                    // Voxels are in the sphere when their center is, so chunks whose closest voxel center is out of it are skipped
+                    float closest_x = std::floor(std::clamp(center_x, dx + 0.5f, dx + IVY_NODE_WIDTH - 0.5f)) + 0.5f - center_x;
+                    float closest_y = std::floor(std::clamp(center_y, dy + 0.5f, dy + IVY_NODE_WIDTH - 0.5f)) + 0.5f - center_y;
+                    float closest_z = std::floor(std::clamp(center_z, dz + 0.5f, dz + IVY_NODE_WIDTH - 0.5f)) + 0.5f - center_z;
+                    if (closest_x * closest_x + closest_y * closest_y + closest_z * closest_z > radius * radius) continue;
+
+                    ChunkEdit &chunk = get_chunk(dx, dy, dz);
+                    for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+                        int x = child_xyz % IVY_NODE_WIDTH, y = child_xyz / IVY_NODE_WIDTH % IVY_NODE_WIDTH, z = child_xyz / IVY_NODE_WIDTH_SQUARED;
+                        float distance_x = float(dx + x) + 0.5f - center_x, distance_y = float(dy + y) + 0.5f - center_y, distance_z = float(dz + z) + 0.5f - center_z;
+                        if (distance_x * distance_x + distance_y * distance_y + distance_z * distance_z <= radius * radius) set(chunk, child_xyz, voxel);
                     }
                 }
             }
+        }
+    }
 
-            // And again we don't forget to mark the node as terminal
-            node->header = node->header | (0b01u << 30);
+    size_t EditBatch::size() const {
+        return voxel_count;
+    }
+
+    void EditBatch::clear() {
+        chunks.clear();
+        chunk_ids.clear();
+        voxel_count = 0;
+    }
+
+    bool WideTree::begin_concurrent_build() {
+        assert(shards == nullptr);
+        if (!reference_counts.empty()) fatal("Deduplicated trees cannot be built concurrently");
+        for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) shard_subpools.push_back(memory_pool->create_client());
+
+        // Each existing child of the root becomes the root of a shard
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        Node *child_array = (Node *) memory_subpool->to_pointer(root->header & ~(0b11u << 30));
+        shards = new Shard[IVY_NODE_WIDTH_CUBED];
+        for (int child_xyz = 0, child_id = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+            if ((root->bitmap & (0x1ul << child_xyz)) == 0) continue;
+            shards[child_xyz].root = child_array[child_id++];
+        }
+        return true;
+    }
+
+    void WideTree::end_concurrent_build() {
+        assert(shards != nullptr);
+
+        // Assembling the new bitmap of the root from the shards that are not empty
+        Node *root = (Node *) root_subpool->to_pointer(root_node);
+        uint64_t bitmap = 0;
+        for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+            if (shards[child_xyz].root.bitmap != 0) bitmap |= 0x1ul << child_xyz;
+        }
+
+        // Replacing the root child array with one made of the shards roots
+        int previous_child_count = __builtin_popcountll(root->bitmap), child_count = __builtin_popcountll(bitmap);
+        if (previous_child_count != 0) {
+            memory_subpool->deallocate(memory_subpool->to_pointer(root->header & ~(0b11u << 30)), (previous_child_count + 1) * int(sizeof(Node)));
+        }
+        root->bitmap = bitmap;
+        root->header = 0;
+        if (child_count != 0) {
+            Node *child_array = (Node *) memory_subpool->allocate((child_count + 1) * int(sizeof(Node)));
+            for (int child_xyz = 0, child_id = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+                if ((bitmap & (0x1ul << child_xyz)) != 0) child_array[child_id++] = shards[child_xyz].root;
+            }
+            root->header = memory_subpool->to_index(child_array);
+        }
+
+        // The shards were built without maintaining their LOD slots, so they are all updated in a single bottom-up pass
+        update_subtree_lods(root);
+        memory_pool->mark_dirty(root, sizeof(Node));
+        delete[] shards;
+        shards = nullptr;
+
+        // The arrays of the shards then join the ones of the tree, so that the unfilled ends of their blocks are reused by later edits
+        for (MemoryPoolClient *shard_subpool: shard_subpools) {
+            memory_subpool->merge(shard_subpool);
+            memory_pool->free_client(shard_subpool);
         }
+        shard_subpools.clear();
     }
 }
\ No newline at end of file
@@ -1,16 +1,267 @@
 #pragma once
 
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "client/utils/memory_pool.h"
 #include "common/world/chunk.h"
 
+/**
+ * Blocks of a tree with a lower ratio of allocated bytes are emptied by WideTree::defragment_step.
+ */
+#define IVY_DEFRAGMENTATION_OCCUPANCY (0.5f)
+
+/**
+ * Work done by each call to WideTree::defragment_step, counted in tree nodes visited and in free slots swept, which take well under a
+ * millisecond together.
+ */
+#define IVY_DEFRAGMENTATION_STEP_BUDGET (4096)
+
+/**
+ * Maximum number of distinct voxels of a leaf stored as a palette array, see Node::header.
+ */
+#define IVY_LEAF_PALETTE_SIZE (16)
+
 namespace client::utils {
+    struct __attribute__((packed)) Node {
+        /**
+         * 4x4x4 bit, one per subnode. Can be used for faster traversal than a list of u32.
+         * An empty bitmap with value 0x0000 means that the node data has not been generated yet.
+         */
+        uint64_t bitmap = 0;
+
+        /**
+         * The header starts with two bits encoding the LOD status:
+         * - If the first bits are 0b00, the last 30 bits are the address of the first non-empty subnode. The subnodes are followed by a
+         *   LOD slot: a node with an empty bitmap whose header holds the LOD voxel of the whole subtree, encoded like the header of a
+         *   LOD leaf, so that a traversal can stop at any depth, see get_lod_voxel.
+         * - If the first bits are 0b01, the node is terminal and the last 30 bits are the address of the first non-empty voxel.
+         * - If the first bits are 0b10, the node is terminal and the last 30 bits are the address of a palette array: the size of the
+         *   palette on one byte, the up to IVY_LEAF_PALETTE_SIZE distinct voxels of the node, then the index in the palette of each
+         *   non-empty voxel, packed on 2 bits for palettes of up to 4 voxels and on 4 bits otherwise.
+         * - If the first bits are Ob11, the node is terminal and the last bits are the LOD voxel of the non-empty subnodes: their
+         *   material on the last 8 bits, and with 16-bit voxels the average of their normals on the 8 bits before, see NormalVoxel.
+         * Addresses are pool indices, in units of IVY_POOL_INDEX_UNIT bytes, so that up to 12 GiB of the pool can be referenced.
+         * Once the tree is deduplicated, an array can be referenced by several nodes.
+         */
+        uint32_t header = 0;
+    };
+
+    /**
+     * Decode a voxel of a terminal node, whether it is a LOD leaf, a voxel array or a palette array.
+     * @param child_xyz Index of the voxel in the node, x + 4y + 16z. Its bit must be set in the bitmap of the node.
+     */
+    Voxel get_leaf_voxel(const Node &node, int child_xyz);
+
+    /**
+     * Representative voxel of a non-empty node, seen from far away. It is the voxel of LOD leaves, and the dominant voxel of other
+     * terminal nodes, whose voxels are counted one by one. Inner nodes read it from their LOD slot, which the tree keeps up to date with
+     * the dominant LOD voxel of their children, each weighted by the popcount of its bitmap: by its number of non-empty children, not by
+     * the number of voxels below it. With 16-bit voxels, the normal is the average of the normals, with the same weights.
+     */
+    Voxel get_lod_voxel(const Node &node);
+
+    /**
+     * A chunk tagged with its Morton key, see WideTree::morton_key.
+     */
+    struct MortonChunk {
+        uint64_t key;
+        Chunk chunk;
+    };
+
+    /**
+     * The edits of a batch falling in a chunk, tagged with the Morton key of the chunk, see WideTree::morton_key.
+     */
+    struct ChunkEdit {
+        uint64_t key;
+        uint64_t mask = 0;  // One bit per edited voxel, x + 4y + 16z
+        Voxel voxels[IVY_NODE_WIDTH_CUBED];  // New value of each edited voxel
+    };
+
+    /**
+     * Voxel edits collected to be applied to a tree at once, see WideTree::apply. Edits are grouped by chunk as they are recorded, in any
+     * order, and when several of them set the same voxel, the last one recorded wins. Positions are in voxels from the corner of the
+     * region, and positions out of the region are ignored.
+     */
+    class EditBatch {
+        std::vector<ChunkEdit> chunks;
+        std::unordered_map<uint64_t, size_t> chunk_ids;  // Index in chunks of the edits of each chunk, by Morton key
+        size_t voxel_count = 0;
+
+        ChunkEdit &get_chunk(int dx, int dy, int dz);
+        void set(ChunkEdit &chunk, int child_xyz, Voxel voxel);
+
+        friend class WideTree;
+    public:
+        void set_voxel(int x, int y, int z, Voxel voxel);
+
+        /**
+         * Set every voxel of the box between the given corners, both included.
+         */
+        void fill_box(int min_x, int min_y, int min_z, int max_x, int max_y, int max_z, Voxel voxel);
+
+        /**
+         * Set every voxel whose center is in the given sphere.
+         */
+        void fill_sphere(float center_x, float center_y, float center_z, float radius, Voxel voxel);
+
+        /**
+         * @return The number of distinct voxels edited.
+         */
+        size_t size() const;
+
+        void clear();
+    };
+
     class WideTree : public ChunkStore {
+        /**
+         * During a concurrent build, each child of the root is built separately, behind its own lock and with its own memory subpool.
+         */
+        struct Shard {
+            std::mutex guard;
+            Node root;
+        };
+
+        MemoryPoolClient *root_subpool;  // Only holds the root node, so that the rest of the tree can be moved without moving the root
         MemoryPoolClient *memory_subpool;
         uint32_t root_node = 0;
+        Shard *shards = nullptr;  // Only set while a concurrent build is in progress
+        std::vector<MemoryPoolClient *> shard_subpools;  // One per root child during a concurrent build, merged into memory_subpool after
+        bool is_defragmenting = false;  // Whether a defragmentation pass is in progress
+        std::vector<int> defragmentation_path;  // Child indices leading from the root to the next node the pass visits
+        std::unordered_map<uint32_t, uint32_t> reference_counts;  // Number of parents of the arrays shared since deduplicate, by index
     public:
         WideTree();
         ~WideTree() override;
         void add_chunk(int dx, int dy, int dz, Chunk *chunk) override;
+
+        /**
+         * @return The voxel at the given position, in voxels from the corner of the region. Positions out of the region are air.
+         */
+        Voxel get_voxel(int x, int y, int z) const;
+
+        /**
+         * Apply the edits of a batch, then clear it. The edited chunks are sorted by Morton key and merged into the tree in a single
+         * depth-first pass, so that every node on their paths is rewritten once, and every child array reallocated at most once with its
+         * final size: missing nodes are created, uniform leaves turn into LOD leaves and back, and leaves left empty are removed with the
+         * parents they leave empty. Shared arrays on the paths are copied first, and every modified node is marked dirty, so that the
+         * next upload of the pool sends the changes of the whole batch at once. The tree must not be in a concurrent build.
+         */
+        void apply(EditBatch &batch);
+
+        /**
+         * Set the voxel at the given position, in voxels from the corner of the region, as a batch of one edit. Only the leaf holding
+         * the voxel is rewritten, along with its path from the root.
+         */
+        void set_voxel(int x, int y, int z, Voxel voxel);
+
+        /**
+         * Same as set_voxel, for every voxel of the box between the given corners, both included, applied as a single batch.
+         */
+        void fill_box(int min_x, int min_y, int min_z, int max_x, int max_y, int max_z, Voxel voxel);
+
+        /**
+         * Same as set_voxel, for every voxel whose center is in the given sphere, applied as a single batch.
+         */
+        void fill_sphere(float center_x, float center_y, float center_z, float radius, Voxel voxel);
+
+        /**
+         * Detach every child of the root into its own lock-protected shard, so that add_chunk can be called from several threads.
+         * Only end_concurrent_build may be called on the tree afterward, and only once every add_chunk call has returned. The tree must
+         * not have been deduplicated.
+         */
+        bool begin_concurrent_build() override;
+
+        /**
+         * Splice the shards back into the root, and merge their subpools into the one of the tree, see MemoryPoolClient::merge.
+         */
+        void end_concurrent_build() override;
+
+        /**
+         * @return The Morton key of the chunk at the given position, that is the concatenation of the 6-bit child indices on the path from
+         * the root to that chunk. Sorting chunks by key sorts them in the depth-first order of the tree.
+         */
+        static uint64_t morton_key(int dx, int dy, int dz);
+
+        /**
+         * Bulk-build the tree bottom-up from chunks sorted by Morton key. Every child array is allocated exactly once with its final size,
+         * which is much faster than incremental insertion and leaves no hole in the memory pool. The tree must be empty.
+         */
+        void build(const MortonChunk *chunks, size_t chunk_count);
+
+        /**
+         * Bulk-build the tree from a dense grid of chunks filling the cube of the given width at (dx, dy, dz). The width must be a power of 4,
+         * and the position a multiple of it. Chunks are indexed by x + y * n + z * n * n, n being the width in chunks. The tree must be empty.
+         */
+        void build(int dx, int dy, int dz, int width, const Chunk *chunks);
+
+        /**
+         * Rewrite the tree in depth-first order, so that every subtree is contiguous in the memory pool and siblings are stored in Morton
+         * order. Node arrays and voxel arrays go in two separate spans, to keep node arrays aligned on the node size.
+         */
+        void compact();
+
+        /**
+         * Turn the tree into a DAG by hash-consing its arrays bottom-up: identical child arrays, and so identical subtrees, are stored
+         * once and shared by all the nodes that reference them. The tree is then rewritten in depth-first order like compact does. The
+         * arrays shared by several nodes are reference-counted, and copied before being modified by later edits. Compacting the tree,
+         * saving it or exporting its subtrees writes every reference separately again.
+         * @return The number of bytes saved by sharing arrays.
+         */
+        size_t deduplicate();
+
+        /**
+         * Save the tree as a region file: a header page, then the node arrays and the voxel arrays of the tree in depth-first order, with
+         * addresses relative to the start of the node arrays. The file is first written next to the target path, then renamed over it.
+         * @return Whether the file could be written.
+         */
+        bool save(const char *path) const;
+
+        /**
+         * Load a region file written by save. The arrays are memory-mapped in place in the pool, so only the pages holding node arrays are
+         * read while rebasing their addresses, and voxel arrays are paged in on first access. The tree must be empty.
+         * @return Whether the file could be loaded. Missing files and files written with another tree layout are not loaded.
+         */
+        bool load(const char *path);
+
+        /**
+         * Export a child of the root as a standalone image: the child node, then the node arrays and the voxel arrays of its subtree in
+         * depth-first order, with addresses relative to the start of the image.
+         * @param child_xyz Index of the child in the root, x + 4y + 16z.
+         * @param image Output buffer, left empty if the root has no such child.
+         */
+        void export_subtree(int child_xyz, std::vector<char> &image) const;
+
+        /**
+         * Import a child of the root exported by export_subtree, replacing the existing one if any.
+         */
+        bool add_subtree(int child_xyz, const char *image, size_t image_size) override;
+
+        /**
+         * Save the tree as a region archive, with one LZ4 block per child of the root.
+         * @return Whether the archive could be written.
+         */
+        bool save_archive(const char *path) const;
+
+        /**
+         * Run one step of the defragmentation of the tree. A pass starts by selecting the blocks of the tree whose occupancy is below
+         * IVY_DEFRAGMENTATION_OCCUPANCY, which only looks at the blocks, then sweeps their free slots out of the free lists, and walks the
+         * tree depth-first to move the arrays out of them, patching the headers that reference them. Each step stops once its budget is
+         * spent, and the next one resumes where it stopped, even if the tree was edited in between, so that the work can be spread over
+         * frames. Emptied blocks go back to the pool along the way. The spans of compacted and loaded trees are defragmented too, once
+         * edits have freed arrays in them. Deduplicated trees are not defragmented, as their shared arrays cannot be moved for a single
+         * parent.
+         * @param budget Number of tree nodes visited and free slots swept by the step, at least one.
+         * @return Whether a pass is in progress, that is whether the next step has work to do.
+         */
+        bool defragment_step(int budget = IVY_DEFRAGMENTATION_STEP_BUDGET);
+
+        /**
+         * Mark every block of the tree as modified, so that it is uploaded again. In-place updates already mark what they change, this is
+         * meant for trees built on another thread, whose blocks may have been uploaded while they were being written.
+         */
+        void mark_dirty();
+
         uint32_t get_root_node() const;
     };
-}
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include "voxel.h"
 
 #define IVY_NODE_WIDTH (4l)
@@ -18,4 +19,19 @@ class ChunkStore {
 public:
     virtual ~ChunkStore() = default;
     virtual void add_chunk(int dx, int dy, int dz, Chunk *chunk) = 0;
+
+    /**
+     * Ask the store to accept add_chunk calls from several threads at once, until end_concurrent_build is called.
+     * @return Whether the store supports it. If not, add_chunk calls have to be serialized by the caller.
+     */
+    virtual bool begin_concurrent_build() { return false; }
+    virtual void end_concurrent_build() {}
+
+    /**
+     * Replace a whole child of the region root at once, from a subtree image exported by the same kind of store, such as the blocks of a
+     * region archive.
+     * @param child_xyz Index of the child in the root, x + 4y + 16z.
+     * @return Whether the store supports it.
+     */
+    virtual bool add_subtree(int child_xyz, const char *image, size_t image_size) { return false; }
 };
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lz4.h"
+#include "ivy_log.h"
+#include "region_archive.h"
+
+#define IVY_REGION_ARCHIVE_MAGIC (0x41795669u)  // "iVyA"
+#define IVY_REGION_ARCHIVE_VERSION (4)  // Version 2 stores node addresses in 12-byte units, version 3 adds palette leaves, version 4 LOD slots
+
+RegionArchiveWriter::RegionArchiveWriter(const char *path, uint32_t layout)
+        : path(path), temporary_path(std::string(path) + ".tmp"), file(nullptr), index(), layout(layout), is_valid(true) {
+    file = fopen(temporary_path.c_str(), "wb");
+    if (!file) {
+        error("Could not open %s for writing", temporary_path.c_str());
+        is_valid = false;
+        return;
+    }
+
+    // The header is written once the index is known, so we just leave room for it
+    RegionArchiveHeader header = {};
+    is_valid = fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+RegionArchiveWriter::~RegionArchiveWriter() {
+    if (file) {
+        fclose(file);
+        remove(temporary_path.c_str());
+    }
+}
+
+void RegionArchiveWriter::add_block(uint32_t key, const char *data, size_t size) {
+    if (!is_valid) return;
+    if (size > size_t(LZ4_MAX_INPUT_SIZE)) fatal("Region archive blocks are limited to %d bytes", LZ4_MAX_INPUT_SIZE);
+    std::vector<char> compressed(LZ4_compressBound(int(size)));
+    int compressed_size = LZ4_compress_default(data, compressed.data(), int(size), int(compressed.size()));
+    if (compressed_size <= 0) fatal("Could not compress a block of %zu bytes", size);
+    index.push_back({key, uint32_t(compressed_size), uint64_t(ftell(file)), size});
+    is_valid = fwrite(compressed.data(), 1, compressed_size, file) == size_t(compressed_size);
+}
+
+bool RegionArchiveWriter::finish() {
+    if (!is_valid) {
+        error("Could not write region archive %s", path.c_str());
+        return false;
+    }
+    RegionArchiveHeader header = {IVY_REGION_ARCHIVE_MAGIC, IVY_REGION_ARCHIVE_VERSION, layout, uint32_t(index.size()), uint64_t(ftell(file))};
+    is_valid = fwrite(index.data(), sizeof(RegionArchiveEntry), index.size(), file) == index.size();
+    is_valid = is_valid && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    is_valid = fclose(file) == 0 && is_valid;
+    file = nullptr;
+    if (!is_valid || rename(temporary_path.c_str(), path.c_str()) != 0) {
+        error("Could not write region archive %s", path.c_str());
+        remove(temporary_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+RegionArchiveReader::RegionArchiveReader(const char *path, uint32_t layout) : fd(-1), index() {
+    int file = open(path, O_RDONLY);
+    if (file < 0) return;
+
+    RegionArchiveHeader header;
+    struct stat file_stat = {};
+    if (pread(file, &header, sizeof(header), 0) != sizeof(header) || fstat(file, &file_stat) != 0 || header.magic != IVY_REGION_ARCHIVE_MAGIC ||
+        header.version != IVY_REGION_ARCHIVE_VERSION || header.layout != layout ||
+        header.index_offset + header.block_count * sizeof(RegionArchiveEntry) != uint64_t(file_stat.st_size)) {
+        warn("Ignoring region archive %s, as it was written with another layout", path);
+        close(file);
+        return;
+    }
+    index.resize(header.block_count);
+    size_t index_size = header.block_count * sizeof(RegionArchiveEntry);
+    if (pread(file, index.data(), index_size, off_t(header.index_offset)) != ssize_t(index_size)) {
+        warn("Could not read the index of region archive %s", path);
+        index.clear();
+        close(file);
+        return;
+    }
+    fd = file;
+}
+
+RegionArchiveReader::~RegionArchiveReader() {
+    if (fd >= 0) close(fd);
+}
+
+bool RegionArchiveReader::is_open() const {
+    return fd >= 0;
+}
+
+const std::vector<RegionArchiveEntry> &RegionArchiveReader::get_index() const {
+    return index;
+}
+
+bool RegionArchiveReader::read_block(uint32_t key, std::vector<char> &data) const {
+    for (const RegionArchiveEntry &entry: index) {
+        if (entry.key != key) continue;
+        std::vector<char> compressed(entry.compressed_size);
+        if (pread(fd, compressed.data(), entry.compressed_size, off_t(entry.offset)) != ssize_t(entry.compressed_size)) {
+            fatal("Could not read a block of %u bytes from a region archive", entry.compressed_size);
+        }
+        data.resize(entry.size);
+        if (LZ4_decompress_safe(compressed.data(), data.data(), int(entry.compressed_size), int(entry.size)) != int(entry.size)) {
+            fatal("Corrupted block in a region archive");
+        }
+        return true;
+    }
+    return false;
+}
\ No newline at end of file
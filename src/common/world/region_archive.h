@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * A region archive stores independent blocks of data, each compressed with LZ4 on its own, followed by an index of the blocks. Any single
+ * block can then be decoded without touching the rest of the archive. Regions are stored with one block per child of the region root.
+ *
+ * Layout: a RegionArchiveHeader, then the compressed blocks one after the other, then the index as an array of RegionArchiveEntry.
+ */
+
+struct RegionArchiveEntry {
+    uint32_t key;  // Caller-defined, such as the index of a root child
+    uint32_t compressed_size;
+    uint64_t offset;  // Offset of the compressed block from the start of the file
+    uint64_t size;  // Size of the block once decompressed
+};
+
+struct RegionArchiveHeader {
+    uint32_t magic, version;
+    uint32_t layout;  // Caller-defined tag describing the content of the blocks, see RegionArchiveReader
+    uint32_t block_count;
+    uint64_t index_offset;
+};
+
+class RegionArchiveWriter {
+    std::string path, temporary_path;
+    FILE *file;
+    std::vector<RegionArchiveEntry> index;
+    uint32_t layout;
+    bool is_valid;
+public:
+    /**
+     * Start writing an archive. It is written next to the target path, and only renamed over it by finish.
+     * @param layout Tag describing the content of the blocks.
+     */
+    RegionArchiveWriter(const char *path, uint32_t layout);
+    ~RegionArchiveWriter();
+
+    /**
+     * Compress a block and append it to the archive.
+     */
+    void add_block(uint32_t key, const char *data, size_t size);
+
+    /**
+     * Write the index, and move the archive to its target path.
+     * @return Whether the whole archive could be written.
+     */
+    bool finish();
+};
+
+class RegionArchiveReader {
+    int fd;
+    std::vector<RegionArchiveEntry> index;
+public:
+    /**
+     * Open an archive and read its index.
+     * @param layout Expected tag describing the content of the blocks. Archives written with another one are not opened.
+     */
+    RegionArchiveReader(const char *path, uint32_t layout);
+    ~RegionArchiveReader();
+
+    /**
+     * @return Whether the archive exists and was written with the expected layout.
+     */
+    bool is_open() const;
+
+    const std::vector<RegionArchiveEntry> &get_index() const;
+
+    /**
+     * Read and decompress a single block.
+     * @param data Output buffer, resized to the size of the block.
+     * @return Whether the archive has a block with this key.
+     */
+    bool read_block(uint32_t key, std::vector<char> &data) const;
+};
\ No newline at end of file
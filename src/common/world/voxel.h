@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cmath>
 #include <cstdint>
 
+/**
+ * Set to 1 to give every voxel a quantized surface normal, making voxels 16 bits wide instead of 8, see NormalVoxel.
+ */
+#define IVY_VOXEL_NORMALS (0)
+
 enum Material : uint8_t {
     AIR,
     DEBUG_RED,
@@ -12,7 +18,58 @@ enum Material : uint8_t {
     GRASS
 };
 
-// TODO: replace with the weird bitwise thing, with a normal encoded in spherical coordinates, one bit to know if there is a normal at all, and 7 bits for the material
-struct Voxel {
+/**
+ * 8-bit voxel, with only a material. It has the same interface as NormalVoxel, its normal being always missing.
+ */
+struct MaterialVoxel {
+    static constexpr bool has_normals = false;
+
     Material material;
-};
\ No newline at end of file
+
+    void set_normal(float x, float y, float z) {}
+    bool get_normal(float &x, float &y, float &z) const { return false; }
+};
+
+/**
+ * 16-bit voxel, with a material and a normal in spherical coordinates: the 4 high bits of the normal are its polar angle from +z, in
+ * 15ths of pi, and the 4 low bits its azimuth from +x, in 16ths of a turn. A null normal means that the voxel has none, so the normal
+ * pointing to +z, whose azimuth does not matter, is stored with an azimuth of 1.
+ */
+struct NormalVoxel {
+    static constexpr bool has_normals = true;
+
+    Material material;
+    uint8_t normal = 0;
+
+    /**
+     * Quantize the given direction, which does not need to be normalized. A null direction removes the normal.
+     */
+    void set_normal(float x, float y, float z) {
+        float length = std::sqrt(x * x + y * y + z * z);
+        if (length == 0) {
+            normal = 0;
+            return;
+        }
+        int polar = int(std::lround(std::acos(std::fmax(-1.0f, std::fmin(1.0f, z / length))) / float(M_PI) * 15.0f));
+        int azimuth = int(std::lround(std::atan2(y, x) / float(M_PI) * 8.0f)) & 0xf;
+        normal = uint8_t((polar << 4) | (polar == 0 ? 1 : azimuth));
+    }
+
+    /**
+     * @return Whether the voxel has a normal, in which case it is written as a unit vector.
+     */
+    bool get_normal(float &x, float &y, float &z) const {
+        if (normal == 0) return false;
+        float polar = float(normal >> 4) / 15.0f * float(M_PI), azimuth = float(normal & 0xf) / 8.0f * float(M_PI);
+        x = std::sin(polar) * std::cos(azimuth);
+        y = std::sin(polar) * std::sin(azimuth);
+        z = std::cos(polar);
+        return true;
+    }
+};
+
+#if IVY_VOXEL_NORMALS
+typedef NormalVoxel Voxel;
+#else
+typedef MaterialVoxel Voxel;
+#endif
\ No newline at end of file
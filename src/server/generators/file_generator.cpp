@@ -0,0 +1,41 @@
+#include <vector>
+#include "ivy_log.h"
+#include "ivy_time.h"
+#include "file_generator.h"
+#include "common/world/region_archive.h"
+
+server::FileGenerator::FileGenerator(const char *directory) : directory(directory) {}
+
+std::string server::FileGenerator::get_region_path(int rx, int ry, int rz) const {
+    return directory + "/" + std::to_string(rx) + "_" + std::to_string(ry) + "_" + std::to_string(rz) + ".ivya";
+}
+
+void server::FileGenerator::generate_view(int rx, int ry, int rz, ChunkStore &view) {
+    auto t0 = time_us();
+    std::string path = get_region_path(rx, ry, rz);
+    RegionArchiveReader archive(path.c_str(), IVY_REGION_ARCHIVE_LAYOUT);
+    if (!archive.is_open()) {
+        warn("No region archive at %s, leaving the region empty", path.c_str());
+        return;
+    }
+
+    // Decoding the subtrees one by one, so that only one of them is ever held decompressed
+    std::vector<char> image;
+    size_t decoded_size = 0;
+    for (const RegionArchiveEntry &entry: archive.get_index()) {
+        archive.read_block(entry.key, image);
+        if (!view.add_subtree(int(entry.key), image.data(), image.size())) fatal("This view does not support prebuilt subtrees");
+        decoded_size += image.size();
+    }
+    info("Streamed %zu subtrees (%.2f MiB) from %s in %.2f ms", archive.get_index().size(), double(decoded_size) / 1024.0 / 1024.0,
+         path.c_str(), double(time_us() - t0) / 1e3);
+}
+
+bool server::FileGenerator::generate_subtree(int rx, int ry, int rz, int child_xyz, ChunkStore &view) {
+    std::string path = get_region_path(rx, ry, rz);
+    RegionArchiveReader archive(path.c_str(), IVY_REGION_ARCHIVE_LAYOUT);
+    std::vector<char> image;
+    if (!archive.is_open() || !archive.read_block(uint32_t(child_xyz), image)) return false;
+    if (!view.add_subtree(child_xyz, image.data(), image.size())) fatal("This view does not support prebuilt subtrees");
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include "generator.h"
+
+namespace server {
+    /**
+     * Streams regions from region archives, one archive per region named "<rx>_<ry>_<rz>.ivya" in the given directory. Each child of the
+     * region root is decoded on its own and handed to the view as a prebuilt subtree, so that the whole region is never decompressed at
+     * once. Regions without an archive are left empty.
+     */
+    class FileGenerator : public Generator {
+    private:
+        std::string directory;
+    public:
+        explicit FileGenerator(const char *directory);
+        ~FileGenerator() override = default;
+        const char *get_name() override { return "File"; };
+        void generate_view(int rx, int ry, int rz, ChunkStore &view) override;
+
+        /**
+         * Decode a single child of a region root.
+         * @param child_xyz Index of the child in the root, x + 4y + 16z.
+         * @return Whether the region archive has that child.
+         */
+        bool generate_subtree(int rx, int ry, int rz, int child_xyz, ChunkStore &view);
+
+        /**
+         * @return The path of the archive of the given region.
+         */
+        std::string get_region_path(int rx, int ry, int rz) const;
+    };
+}
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #define IVY_REGION_TREE_DEPTH (6)
 #define IVY_REGION_WIDTH (0x1l<<(IVY_NODE_WIDTH_SQRT*IVY_REGION_TREE_DEPTH))
+#define IVY_REGION_ARCHIVE_LAYOUT ((IVY_REGION_TREE_DEPTH << 8) | sizeof(Voxel))  // Subtree images depend on the tree depth and voxel size
 
 namespace server{
     class Generator {
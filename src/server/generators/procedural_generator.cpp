@@ -1,13 +1,34 @@
+#include <atomic>
 #include <cfloat>
 #include <cmath>
+#include <mutex>
+#include <vector>
 #include <sys/param.h>
+#include "ivy_log.h"
+#include "ivy_time.h"
+#include "ivy_thread.h"
 #include "procedural_generator.h"
 #include "FastNoise/FastNoise.h"
 
+/**
+ * The region is split in square tiles of columns, each one being a single task for the worker pool. 64 voxels wide tiles give
+ * 4096 tasks at IVY_REGION_TREE_DEPTH=6, which is enough to balance the work between workers whatever the terrain looks like. Narrower
+ * regions are a single tile.
+ */
+#define IVY_GENERATION_TILE_WIDTH (64)
+
 static Voxel get_voxel(float *heightmap, int x, int y, int z);
+static float get_height(float *heightmap, int x, int y);
 static Chunk *generate_chunk(float *heightmap, int x, int y, int z);
 
-server::ProceduralGenerator::ProceduralGenerator() = default;
+namespace {
+    struct PendingChunk {
+        int x, y, z;
+        Chunk chunk;
+    };
+}
+
+server::ProceduralGenerator::ProceduralGenerator(int thread_count) : thread_count(thread_count_or_default(thread_count)) {}
 server::ProceduralGenerator::~ProceduralGenerator() = default;
 
 void server::ProceduralGenerator::generate_view(int rx, int ry, int rz, ChunkStore& view) {
@@ -17,54 +38,104 @@ void server::ProceduralGenerator::generate_view(int rx, int ry, int rz, ChunkSto
     const int height_multiplier = 32;
     const int scale_multiplier = 1;
 
-    // Generating the full-res heightmap
+    // Keeping track of the time spent working by each thread, insertion in the view included, to be able to report how busy the threads
+    // were: the work divided by the wall time of every thread. Busy threads may still be slower than one, see iVy_bench --generation-speedup
+    auto t0 = time_us();
+    std::atomic<uint64_t> work_duration_us = 0;
+    std::atomic<long> chunk_count = 0;
+    const int tile_width = int(MIN(IVY_GENERATION_TILE_WIDTH, IVY_REGION_WIDTH));
+    const int tiles_per_side = int(IVY_REGION_WIDTH / tile_width);
+
+    // Generating the full-res heightmap, one band of rows per task. The noise is sampled at integer coordinates, so the bands are
+    // exactly the same as if the whole heightmap had been generated at once.
     float *height_map = (float *) malloc(sizeof(float) * IVY_REGION_WIDTH * IVY_REGION_WIDTH);
     auto simplex = FastNoise::New<FastNoise::Simplex>();
     auto fractal = FastNoise::New<FastNoise::FractalFBm>();
     fractal->SetSource(simplex);
     fractal->SetOctaveCount(5);
-    fractal->GenUniformGrid2D(height_map, 0, 0, IVY_REGION_WIDTH, IVY_REGION_WIDTH, 0.005f/scale_multiplier, 1337);
-    for (int i = 0; i < IVY_REGION_WIDTH * IVY_REGION_WIDTH; i++) height_map[i] = height_offset + height_map[i] * height_multiplier;
-
-    // Generating the low-res heightmap
-    int *chunk_min = (int *) malloc(sizeof(int) * IVY_REGION_WIDTH * IVY_REGION_WIDTH);
-    int *chunk_max = (int *) malloc(sizeof(int) * IVY_REGION_WIDTH * IVY_REGION_WIDTH);
-    for (int y = ry; y < IVY_REGION_WIDTH; y += IVY_NODE_WIDTH) {
-        for (int x = rx; x < IVY_REGION_WIDTH; x += IVY_NODE_WIDTH) {
-            float min = FLT_MAX, max = FLT_MIN;
-            for (int dy = 0; dy < IVY_NODE_WIDTH; dy++) {
-                for (int dx = 0; dx < IVY_NODE_WIDTH; dx++) {
-                    float h = height_map[x + dx + (y + dy) * IVY_REGION_WIDTH];
-                    min = MIN(min, h);
-                    max = MAX(max, h);
+    parallel_for(tiles_per_side, [&](int band) {
+        auto t1 = time_us();
+        float *band_map = height_map + long(band) * tile_width * IVY_REGION_WIDTH;
+        fractal->GenUniformGrid2D(band_map, rx, ry + band * tile_width, IVY_REGION_WIDTH, tile_width,
+                                  0.005f / scale_multiplier, 1337);
+        for (int i = 0; i < tile_width * IVY_REGION_WIDTH; i++) band_map[i] = height_offset + band_map[i] * height_multiplier;
+        work_duration_us += time_us() - t1;
+    }, thread_count);
+
+    // Using the heightmap to generate, one tile per task. Each worker fills a thread-local chunk buffer, which is then merged into the
+    // view. If the view does not support concurrent insertion, the merge is done in a single critical section.
+    std::mutex view_guard;
+    bool is_view_concurrent = view.begin_concurrent_build();
+    const int shard_side = MIN(tiles_per_side, int(IVY_NODE_WIDTH));
+    const int tiles_per_shard_side = tiles_per_side / shard_side;
+    parallel_for(tiles_per_side * tiles_per_side, [&](int tile) {
+        auto t1 = time_us();
+        static thread_local std::vector<PendingChunk> pending_chunks;
+        pending_chunks.clear();
+
+        // Consecutive tiles are spread over the top-level subtrees of the view, so that concurrent workers rarely insert in the same one
+        int shard = tile % (shard_side * shard_side), shard_tile = tile / (shard_side * shard_side);
+        int tile_x = ((shard % shard_side) * tiles_per_shard_side + shard_tile % tiles_per_shard_side) * tile_width;
+        int tile_y = ((shard / shard_side) * tiles_per_shard_side + shard_tile / tiles_per_shard_side) * tile_width;
+        for (int y = tile_y; y < tile_y + tile_width; y += IVY_NODE_WIDTH) {
+            for (int x = tile_x; x < tile_x + tile_width; x += IVY_NODE_WIDTH) {
+
+                // Looking for the lowest and highest points of the column, to know which chunks may contain surface voxels
+                float min_height = FLT_MAX, max_height = -FLT_MAX;
+                for (int dy = 0; dy < IVY_NODE_WIDTH; dy++) {
+                    for (int dx = 0; dx < IVY_NODE_WIDTH; dx++) {
+                        float h = height_map[x + dx + (y + dy) * IVY_REGION_WIDTH];
+                        min_height = MIN(min_height, h);
+                        max_height = MAX(max_height, h);
+                    }
                 }
-            }
-            chunk_min[x + y * IVY_REGION_WIDTH / IVY_NODE_WIDTH] = int((std::floor(min / IVY_NODE_WIDTH) - 1) * IVY_NODE_WIDTH);
-            chunk_max[x + y * IVY_REGION_WIDTH / IVY_NODE_WIDTH] = int(std::ceil(max / IVY_NODE_WIDTH) * IVY_NODE_WIDTH);
-        }
-    }
+                int min = int((std::floor(min_height / IVY_NODE_WIDTH) - 1) * IVY_NODE_WIDTH);
+                int max = int(std::ceil(max_height / IVY_NODE_WIDTH) * IVY_NODE_WIDTH);
+                if (max < rz || min >= rz + IVY_REGION_WIDTH) continue;
 
-    // Using the heightmap to generate
-    for (int y = ry; y < ry + IVY_REGION_WIDTH; y += IVY_NODE_WIDTH) {
-        for (int x = rx; x < rx + IVY_REGION_WIDTH; x += IVY_NODE_WIDTH) {
-            int min = chunk_min[x + y * IVY_REGION_WIDTH / IVY_NODE_WIDTH];
-            int max = chunk_max[x + y * IVY_REGION_WIDTH / IVY_NODE_WIDTH];
-            if (max < rz || min > rz + IVY_REGION_WIDTH) continue;
-            for (int z = MAX(rz, min); z <= MIN(max, rz + IVY_REGION_WIDTH); z += IVY_NODE_WIDTH) {
-                Chunk *chunk = generate_chunk(height_map, x, y, z);
-                if (chunk != nullptr) view.add_chunk(x - rx, y - ry, z - rz, chunk);
+                // Then generating every chunk of the column
+                for (int z = MAX(rz, min); z <= max && z < rz + IVY_REGION_WIDTH; z += IVY_NODE_WIDTH) {
+                    Chunk *chunk = generate_chunk(height_map, x, y, z);
+                    if (chunk != nullptr) pending_chunks.push_back({x, y, z - rz, *chunk});
+                }
             }
         }
-    }
+        work_duration_us += time_us() - t1;
+        chunk_count += long(pending_chunks.size());
+        std::unique_lock<std::mutex> lock(view_guard, std::defer_lock);
+        if (!is_view_concurrent) lock.lock();
+        t1 = time_us();
+        for (auto &pending: pending_chunks) view.add_chunk(pending.x, pending.y, pending.z, &pending.chunk);
+        work_duration_us += time_us() - t1;
+    }, thread_count);
+    auto t1 = time_us();
+    if (is_view_concurrent) view.end_concurrent_build();
+    work_duration_us += time_us() - t1;
     free(height_map);
+
+    auto duration_us = time_us() - t0;
+    info("Generated %ld chunks on %d threads in %.2f ms (%.2f ms of work, %.0f%% worker utilization)", chunk_count.load(), thread_count,
+         double(duration_us) / 1e3, double(work_duration_us) / 1e3, 100.0 * double(work_duration_us) / double(MAX(duration_us, 1ul) * thread_count));
 }
 
+/**
+ * @return The voxel at the given position, x and y being relative to the region, and z being absolute.
+ */
 static Voxel get_voxel(float *heightmap, int x, int y, int z) {
-    if (x < 0 || x >= IVY_REGION_WIDTH || y < 0 || y >= IVY_REGION_WIDTH || z < 0 || z >= IVY_REGION_WIDTH) return Voxel{STONE};
+    if (x < 0 || x >= IVY_REGION_WIDTH || y < 0 || y >= IVY_REGION_WIDTH) return Voxel{STONE};
     float h = heightmap[x + y * IVY_REGION_WIDTH];
     return (z <= h) ? Voxel{STONE} : Voxel{AIR};
 }
 
+/**
+ * @return The height of the heightmap at the given position, clamped to the region.
+ */
+static float get_height(float *heightmap, int x, int y) {
+    x = MIN(MAX(x, 0), int(IVY_REGION_WIDTH) - 1);
+    y = MIN(MAX(y, 0), int(IVY_REGION_WIDTH) - 1);
+    return heightmap[x + y * IVY_REGION_WIDTH];
+}
+
 static Chunk *generate_chunk(float *heightmap, int x, int y, int z) {
     static __thread Chunk chunk;
     int voxel_count = 0;
@@ -80,6 +151,12 @@ static Chunk *generate_chunk(float *heightmap, int x, int y, int z) {
                                       get_voxel(heightmap, x + dx, y + dy, z + dz + 1).material == AIR ||
                                       get_voxel(heightmap, x + dx, y + dy, z + dz - 1).material == AIR;
                     v = is_surface ? v : Voxel{AIR};
+
+                    // Voxels with a normal get the one of the heightmap, from its gradient
+                    if (Voxel::has_normals && is_surface) {
+                        v.set_normal(get_height(heightmap, x + dx - 1, y + dy) - get_height(heightmap, x + dx + 1, y + dy),
+                                     get_height(heightmap, x + dx, y + dy - 1) - get_height(heightmap, x + dx, y + dy + 1), 2.0f);
+                    }
                 }
                 chunk.set(dx, dy, dz, v);
                 if (v.material != AIR) voxel_count += 1;
@@ -89,4 +166,4 @@ static Chunk *generate_chunk(float *heightmap, int x, int y, int z) {
     if (voxel_count == 0) return nullptr;
     //if(voxel_count == IVY_NODE_WIDTH_CUBED) return nullptr;
     return &chunk;
-}
+}
\ No newline at end of file
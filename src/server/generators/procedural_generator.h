@@ -7,8 +7,12 @@ namespace server {
     class ProceduralGenerator : public Generator {
     private:
         const char *name = "Procedural";
+        int thread_count;
     public:
-        ProceduralGenerator();
+        /**
+         * @param thread_count Number of worker threads used to generate a view. 0 means one per hardware thread, 1 is the single-threaded mode.
+         */
+        explicit ProceduralGenerator(int thread_count = 0);
         ~ProceduralGenerator() override;
         const char *get_name() override { return "Procedural"; };
         void generate_view(int rx, int ry, int rz, ChunkStore& view) override;
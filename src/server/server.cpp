@@ -1,17 +1,34 @@
+#include <filesystem>
 #include "ivy_log.h"
 #include "server/server.h"
+#include "server/generators/file_generator.h"
 #include "server/generators/procedural_generator.h"
 
 namespace server {
     namespace {
         // TODO: Everything :)
+
+        /**
+         * @return Whether the directory holds at least one region archive, see FileGenerator.
+         */
+        bool has_region_archives(const char *directory) {
+            std::error_code error;
+            for (const auto &entry: std::filesystem::directory_iterator(directory, error)) {
+                if (entry.path().extension() == ".ivya") return true;
+            }
+            return false;
+        }
     }
 
     Generator *world_generator;
 
     void start() {
-        if (world_generator == nullptr) world_generator = new ProceduralGenerator();
-        info("Server started");
+        if (world_generator == nullptr) {
+            // A world saved as region archives is streamed from them, otherwise it is generated
+            if (has_region_archives(IVY_REGION_ARCHIVE_DIRECTORY)) world_generator = new FileGenerator(IVY_REGION_ARCHIVE_DIRECTORY);
+            else world_generator = new ProceduralGenerator();
+        }
+        info("Server started with the %s generator", world_generator->get_name());
     }
 
     void stop() {
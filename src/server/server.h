@@ -2,6 +2,12 @@
 
 #include "server/generators/generator.h"
 
+/**
+ * Directory of the region archives of the world, see FileGenerator. When it holds any, the server streams the world from them instead of
+ * generating it. iVy_bench --save-archive writes the region it generates there.
+ */
+#define IVY_REGION_ARCHIVE_DIRECTORY ("regions")
+
 namespace server {
     extern Generator *world_generator;
     void start();
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "gtest/gtest.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/ext/matrix_clip_space.hpp"
+#include "client/client.h"
+#include "client/utils/cpu_tracer.h"
+#include "client/utils/wide_tree.h"
+#include "pool_test.h"
+
+/**
+ * Every test works on a bumpy stone ground seen from above one of its edges, so that rays hit it at every distance, and grazing rays
+ * take many more steps than the others before hitting it.
+ */
+class BumpyGroundTest : public PoolTest {
+protected:
+    client::utils::WideTree *tree = nullptr;
+    const int width = 96, height = 54;
+    glm::vec3 camera_position = {256.0f, 40.0f, 8.0f};
+    glm::mat4 view_matrix = glm::lookAt(camera_position, camera_position + glm::vec3(0.0f, -0.25f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection_matrix = glm::perspective(glm::radians(80.0f), float(width) / float(height), 0.1f, 100.0f);
+
+    void SetUp() override {
+        PoolTest::SetUp();
+        tree = new client::utils::WideTree();
+        client::utils::EditBatch batch;
+        for (int y = 0; y < 512; y++) {
+            for (int x = 0; x < 512; x++) batch.fill_box(x, y, 0, x, y, 4 + (x * 7 + y * 13) % 9, {STONE});
+        }
+        tree->apply(batch);
+    }
+
+    void TearDown() override {
+        delete tree;
+        PoolTest::TearDown();
+    }
+
+    /**
+     * Render the ground with a tracer of the tree, on a single thread.
+     */
+    client::utils::TraceStats trace(client::utils::CpuTracer &tracer, client::utils::CpuImage &image, bool use_packets) const {
+        image = {width, height, {}, {}};
+        return tracer.render(image, camera_position, view_matrix, projection_matrix, use_packets, 1);
+    }
+};
\ No newline at end of file
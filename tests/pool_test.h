@@ -0,0 +1,29 @@
+#pragma once
+
+#include "gtest/gtest.h"
+#include "client/client.h"
+
+/**
+ * Every test works on its own memory pool, in place of the one of the client. Pools only reserve their address space, so large ones cost
+ * nothing until they are written to.
+ */
+class PoolTest : public testing::Test {
+protected:
+    FastMemoryPool *previous_pool = nullptr;
+    size_t pool_size;
+
+    /**
+     * @param pool_size Maximum size of the pool of every test, see FastMemoryPool.
+     */
+    explicit PoolTest(size_t pool_size = 64 * 1024 * 1024) : pool_size(pool_size) {}
+
+    void SetUp() override {
+        previous_pool = client::memory_pool;
+        client::memory_pool = new FastMemoryPool(pool_size);
+    }
+
+    void TearDown() override {
+        delete client::memory_pool;
+        client::memory_pool = previous_pool;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include "gtest/gtest.h"
+#include "client/utils/cpu_tracer.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "bumpy_ground_test.h"
+
+using client::utils::CpuImage;
+using client::utils::CpuTracer;
+using client::utils::TraceStats;
+
+namespace {
+    /**
+     * The ground of BumpyGroundTest, rendered with a LOD cutoff, see CpuTracer::set_lod_cone.
+     */
+    class LodCutoffTest : public BumpyGroundTest {
+    protected:
+        TraceStats render(CpuImage &image, float lod_pixel_size, bool use_packets) const {
+            CpuTracer tracer(*tree);
+            tracer.set_lod_cone(CpuTracer::get_lod_cone(projection_matrix, height, lod_pixel_size));
+            return trace(tracer, image, use_packets);
+        }
+    };
+}
+
+TEST_F(LodCutoffTest, NoCutoffTracesDownToVoxels) {
+    CpuImage image, other_image;
+    TraceStats stats = render(image, 0.0f, false);
+    EXPECT_GT(stats.hit_count, 0);
+    EXPECT_EQ(stats.lod_hit_count, 0);
+    render(other_image, 0.0f, true);
+    EXPECT_EQ(image.materials, other_image.materials);
+}
+
+TEST_F(LodCutoffTest, FarNodesAreShadedWithTheirLodVoxel) {
+    CpuImage image, lod_image;
+    TraceStats stats = render(image, 0.0f, false), lod_stats = render(lod_image, 1.0f, false);
+    EXPECT_GT(lod_stats.lod_hit_count, 0);
+    EXPECT_LT(lod_stats.dda_steps, stats.dda_steps);
+    EXPECT_LT(lod_stats.node_visits, stats.node_visits);
+
+    // Coarse nodes cover a bit more than the ground, so only the rays that hit it at full detail are sure to hit it again
+    for (size_t i = 0; i < image.materials.size(); i++) {
+        if (image.materials[i] != AIR) {
+            EXPECT_EQ(lod_image.materials[i], STONE) << "pixel " << i;
+        }
+    }
+
+    // A larger footprint stops even earlier, and packets stop at the same nodes as single rays
+    CpuImage coarse_image, packet_image;
+    TraceStats coarse_stats = render(coarse_image, 8.0f, false);
+    EXPECT_GT(coarse_stats.lod_hit_count, lod_stats.lod_hit_count);
+    EXPECT_LT(coarse_stats.dda_steps, lod_stats.dda_steps);
+    TraceStats packet_stats = render(packet_image, 8.0f, true);
+    EXPECT_EQ(packet_image.materials, coarse_image.materials);
+    EXPECT_EQ(packet_stats.lod_hit_count, coarse_stats.lod_hit_count);
+}
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <vector>
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "pool_test.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    class LodVoxelsTest : public PoolTest {};
+
+    const Node &get_root(const WideTree &tree) {
+        return *(Node *) client::memory_pool->to_pointer(tree.get_root_node());
+    }
+
+    /**
+     * @return The node of the given depth on the path to the voxel at the given position, which must exist.
+     */
+    const Node &get_node(const WideTree &tree, int depth, int x, int y, int z) {
+        const Node *node = &get_root(tree);
+        long node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH;
+        for (int i = 0; i < depth; i++, node_width /= IVY_NODE_WIDTH) {
+            int child_xyz = int((x / node_width) % IVY_NODE_WIDTH + (y / node_width) % IVY_NODE_WIDTH * IVY_NODE_WIDTH +
+                                (z / node_width) % IVY_NODE_WIDTH * IVY_NODE_WIDTH_SQUARED);
+            int child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
+            node = (Node *) client::memory_pool->to_pointer(node->header & ~(0b11u << 30)) + child_id;
+        }
+        return *node;
+    }
+
+    /**
+     * Append the LOD voxel of every inner node of a subtree, in depth-first order.
+     */
+    void collect_lods(const Node &node, std::vector<Material> &materials) {
+        if (node.bitmap == 0 || (node.header >> 30) != 0b00u) return;
+        materials.push_back(client::utils::get_lod_voxel(node).material);
+        auto *child_array = (const Node *) client::memory_pool->to_pointer(node.header & ~(0b11u << 30));
+        for (int i = 0; i < __builtin_popcountll(node.bitmap); i++) collect_lods(child_array[i], materials);
+    }
+
+    /**
+     * Inverse of WideTree::morton_key.
+     */
+    void get_position(uint64_t key, int &dx, int &dy, int &dz) {
+        dx = dy = dz = 0;
+        for (int depth = 0; depth < IVY_REGION_TREE_DEPTH - 1; depth++) {
+            int child_xyz = int(key >> 6 * (IVY_REGION_TREE_DEPTH - 2 - depth)) & 0x3f;
+            int node_width = IVY_REGION_WIDTH / (IVY_NODE_WIDTH << 2 * depth);
+            dx += child_xyz % IVY_NODE_WIDTH * node_width;
+            dy += child_xyz / IVY_NODE_WIDTH % IVY_NODE_WIDTH * node_width;
+            dz += child_xyz / IVY_NODE_WIDTH_SQUARED * node_width;
+        }
+    }
+
+    /**
+     * A few hills of stone under dirt, with some grass, spread over several children of the root.
+     */
+    Chunk make_chunk(int dx, int dy, int dz) {
+        Chunk chunk;
+        for (int z = 0; z < IVY_NODE_WIDTH; z++) {
+            for (int y = 0; y < IVY_NODE_WIDTH; y++) {
+                for (int x = 0; x < IVY_NODE_WIDTH; x++) {
+                    int height = 20 + (dx + x) % 37 / 3 + (dy + y) % 23 / 2;
+                    int voxel_z = dz + z;
+                    if (voxel_z < height - 3) chunk.set(x, y, z, {STONE});
+                    else if (voxel_z < height) chunk.set(x, y, z, {(dx + dy + x) % 7 == 0 ? GRASS : DIRT});
+                }
+            }
+        }
+        return chunk;
+    }
+}
+
+TEST_F(LodVoxelsTest, InnerNodesHoldTheirDominantMaterial) {
+    WideTree tree;
+    tree.fill_box(0, 0, 0, 63, 63, 47, {STONE});
+    tree.fill_box(64, 0, 0, 79, 15, 15, {DIRT});
+    EXPECT_EQ(client::utils::get_lod_voxel(get_root(tree)).material, STONE);
+    EXPECT_EQ(client::utils::get_lod_voxel(get_node(tree, 3, 64, 0, 0)).material, DIRT);
+
+    // Inner children weigh as much as their number of children, and the column spans four children of its node where the box fills one
+    tree.fill_box(0, 0, 0, 63, 63, 47, {AIR});
+    tree.fill_box(0, 0, 0, 0, 0, 63, {GRASS});
+    EXPECT_EQ(client::utils::get_lod_voxel(get_root(tree)).material, GRASS);
+    EXPECT_EQ(client::utils::get_lod_voxel(get_node(tree, 3, 0, 0, 0)).material, GRASS);
+}
+
+TEST_F(LodVoxelsTest, LodsFollowEdits) {
+    WideTree tree;
+    tree.fill_box(0, 0, 0, 255, 255, 127, {STONE});
+    EXPECT_EQ(client::utils::get_lod_voxel(get_root(tree)).material, STONE);
+
+    client::utils::EditBatch batch;
+    batch.fill_box(0, 0, 0, 255, 255, 110, {DIRT});
+    tree.apply(batch);
+    EXPECT_EQ(client::utils::get_lod_voxel(get_root(tree)).material, DIRT);
+
+    // A single edit updates the path of its chunk
+    tree.fill_box(0, 0, 0, 255, 255, 120, {GRASS});
+    tree.set_voxel(300, 300, 300, {STONE});
+    EXPECT_EQ(client::utils::get_lod_voxel(get_root(tree)).material, GRASS);
+    EXPECT_EQ(client::utils::get_lod_voxel(get_node(tree, 4, 300, 300, 300)).material, STONE);
+}
+
+TEST_F(LodVoxelsTest, LodsDoNotDependOnHowTheTreeIsBuilt) {
+    std::vector<client::utils::MortonChunk> chunks;
+    for (int dz = 0; dz < 64; dz += IVY_NODE_WIDTH) {
+        for (int dy = 0; dy < 320; dy += IVY_NODE_WIDTH) {
+            for (int dx = 0; dx < 320; dx += IVY_NODE_WIDTH) chunks.push_back({WideTree::morton_key(dx, dy, dz), make_chunk(dx, dy, dz)});
+        }
+    }
+    std::sort(chunks.begin(), chunks.end(), [](auto &a, auto &b) { return a.key < b.key; });
+
+    WideTree inserted_tree;
+    int dx, dy, dz;
+    for (auto &chunk: chunks) {
+        get_position(chunk.key, dx, dy, dz);
+        inserted_tree.add_chunk(dx, dy, dz, &chunk.chunk);
+    }
+    std::vector<Material> expected;
+    collect_lods(get_root(inserted_tree), expected);
+    ASSERT_GT(expected.size(), 10);
+
+    WideTree concurrent_tree;
+    ASSERT_TRUE(concurrent_tree.begin_concurrent_build());
+    for (auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
+        get_position(it->key, dx, dy, dz);
+        concurrent_tree.add_chunk(dx, dy, dz, &it->chunk);
+    }
+    concurrent_tree.end_concurrent_build();
+
+    WideTree built_tree;
+    built_tree.build(chunks.data(), chunks.size());
+
+    std::vector<Material> lods;
+    for (WideTree *tree: {&concurrent_tree, &built_tree}) {
+        lods.clear();
+        collect_lods(get_root(*tree), lods);
+        EXPECT_EQ(lods, expected);
+    }
+    built_tree.compact();
+    lods.clear();
+    collect_lods(get_root(built_tree), lods);
+    EXPECT_EQ(lods, expected);
+    inserted_tree.deduplicate();
+    lods.clear();
+    collect_lods(get_root(inserted_tree), lods);
+    EXPECT_EQ(lods, expected);
+}
\ No newline at end of file
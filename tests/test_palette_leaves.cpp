@@ -0,0 +1,115 @@
+#include <vector>
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "pool_test.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    class PaletteLeavesTest : public PoolTest {};
+
+    /**
+     * A chunk whose non-empty voxels cycle through the given number of materials, every fifth voxel being empty.
+     */
+    Chunk make_chunk(int material_count) {
+        Chunk chunk;
+        for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) {
+            chunk.set(i % 4, i / 4 % 4, i / 16, {Material(i % 5 == 4 ? AIR : 1 + (i - i / 5) % material_count)});
+        }
+        return chunk;
+    }
+
+    /**
+     * @return The terminal node holding the chunk at the given position.
+     */
+    const Node *get_leaf(const WideTree &tree, int dx, int dy, int dz) {
+        const Node *node = (Node *) client::memory_pool->to_pointer(tree.get_root_node());
+        for (long node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH; node_width >= IVY_NODE_WIDTH; node_width /= IVY_NODE_WIDTH) {
+            int child_x = int(dx / node_width), child_y = int(dy / node_width), child_z = int(dz / node_width);
+            dx -= int(child_x * node_width);
+            dy -= int(child_y * node_width);
+            dz -= int(child_z * node_width);
+            int child_xyz = int(child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
+            int child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
+            node = (Node *) client::memory_pool->to_pointer(node->header & ~(0b11u << 30)) + child_id;
+        }
+        return node;
+    }
+
+    /**
+     * Compare every voxel of a leaf with the chunk it was written with.
+     */
+    bool holds_chunk(const Node *leaf, const Chunk &chunk) {
+        for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) {
+            Material expected = chunk.get(i % 4, i / 4 % 4, i / 16).material;
+            if (((leaf->bitmap >> i) & 0x1ul) != (expected != AIR)) return false;
+            if (expected != AIR && client::utils::get_leaf_voxel(*leaf, i).material != expected) return false;
+        }
+        return true;
+    }
+}
+
+TEST_F(PaletteLeavesTest, FewMaterialsArePacked) {
+    WideTree tree;
+    size_t used = client::memory_pool->used();
+    Chunk chunk = make_chunk(1);
+    tree.add_chunk(0, 0, 0, &chunk);
+    size_t leaf_used = client::memory_pool->used();
+    for (int material_count: {2, 4, 5, 16}) {
+        chunk = make_chunk(material_count);
+        tree.add_chunk(0, 0, 0, &chunk);
+        const Node *leaf = get_leaf(tree, 0, 0, 0);
+        EXPECT_EQ(leaf->header >> 30, 0b10u) << material_count << " materials";
+        EXPECT_EQ(*(uint8_t *) client::memory_pool->to_pointer(leaf->header & ~(0b11u << 30)), material_count);
+        EXPECT_TRUE(holds_chunk(leaf, chunk)) << material_count << " materials";
+
+        // The leaf takes less room than its 52 voxels would
+        EXPECT_LT(client::memory_pool->used() - leaf_used, (52 * sizeof(Voxel) + 11) / 12 * 12);
+    }
+
+    // Overwriting the palette leaf with a uniform chunk frees the palette array
+    chunk = make_chunk(1);
+    tree.add_chunk(0, 0, 0, &chunk);
+    EXPECT_EQ(get_leaf(tree, 0, 0, 0)->header >> 30, 0b11u);
+    EXPECT_EQ(client::memory_pool->used(), leaf_used);
+    EXPECT_GT(leaf_used, used);
+}
+
+TEST_F(PaletteLeavesTest, ManyMaterialsKeepVoxelArrays) {
+    WideTree tree;
+    Chunk chunk = make_chunk(20);
+    tree.add_chunk(0, 0, 0, &chunk);
+    const Node *leaf = get_leaf(tree, 0, 0, 0);
+    EXPECT_EQ(leaf->header >> 30, 0b01u);
+    EXPECT_TRUE(holds_chunk(leaf, chunk));
+
+    // Going back to a few materials switches the leaf to a palette array
+    chunk = make_chunk(3);
+    tree.add_chunk(0, 0, 0, &chunk);
+    leaf = get_leaf(tree, 0, 0, 0);
+    EXPECT_EQ(leaf->header >> 30, 0b10u);
+    EXPECT_TRUE(holds_chunk(leaf, chunk));
+}
+
+TEST_F(PaletteLeavesTest, PaletteArraysSurviveRelayouts) {
+    WideTree tree;
+    Chunk chunks[] = {make_chunk(2), make_chunk(7), make_chunk(20), make_chunk(1)};
+    for (int i = 0; i < 64; i++) tree.add_chunk(i % 4 * 4, i / 4 % 4 * 4, i / 16 * 4, &chunks[i % 4]);
+    tree.compact();
+    tree.deduplicate();
+
+    // Exporting the subtree, then importing it in another tree, rewrites and rebases every array
+    std::vector<char> image;
+    tree.export_subtree(0, image);
+    WideTree other_tree;
+    ASSERT_TRUE(other_tree.add_subtree(0, image.data(), image.size()));
+    for (WideTree *current_tree: {&tree, &other_tree}) {
+        for (int i = 0; i < 64; i++) {
+            const Node *leaf = get_leaf(*current_tree, i % 4 * 4, i / 4 % 4 * 4, i / 16 * 4);
+            EXPECT_TRUE(holds_chunk(leaf, chunks[i % 4])) << "chunk " << i;
+        }
+    }
+}
\ No newline at end of file
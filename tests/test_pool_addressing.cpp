@@ -0,0 +1,48 @@
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/region_manager.h"
+#include "client/utils/wide_tree.h"
+#include "pool_test.h"
+
+using client::utils::RegionManager;
+using client::utils::WideTree;
+
+namespace {
+    const size_t gibibyte = size_t(1) << 30;
+
+    /**
+     * Pools of 2 GiB, so that trees can be pushed beyond the first gibibyte of pool indices.
+     */
+    class PoolAddressingTest : public PoolTest {
+    protected:
+        PoolAddressingTest() : PoolTest(2 * gibibyte) {}
+    };
+}
+
+TEST_F(PoolAddressingTest, TreesCanLiveBeyondTheFirstGibibyte) {
+    // A span that is never written to pushes every later block past 1 GiB of pool indices
+    MemoryPoolClient *filler = client::memory_pool->create_client();
+    filler->allocate_span(gibibyte + gibibyte / 4);
+    EXPECT_GT(client::memory_pool->extent(), gibibyte);
+
+    WideTree tree;
+    tree.fill_box(0, 0, 0, 63, 15, 63, {STONE});
+    tree.set_voxel(1000, 2000, 3000, {GRASS});
+    EXPECT_GT(size_t(tree.get_root_node()) * IVY_POOL_INDEX_UNIT, gibibyte);
+    EXPECT_EQ(tree.get_voxel(10, 10, 10).material, STONE);
+    EXPECT_EQ(tree.get_voxel(1000, 2000, 3000).material, GRASS);
+    EXPECT_EQ(tree.get_voxel(10, 16, 10).material, AIR);
+
+    // Moving the tree to a single span keeps it past the first gibibyte
+    tree.compact();
+    EXPECT_GT(size_t(tree.get_root_node()) * IVY_POOL_INDEX_UNIT, gibibyte);
+    EXPECT_EQ(tree.get_voxel(1000, 2000, 3000).material, GRASS);
+    client::memory_pool->free_client(filler);
+}
+
+TEST(PoolSizeTest, PoolGrowsWithTheWindowUpToTheAddressableSize) {
+    EXPECT_GE(RegionManager::get_pool_size(0), 2 * IVY_REGION_POOL_SIZE);
+    EXPECT_GT(RegionManager::get_pool_size(2), RegionManager::get_pool_size(1));
+    EXPECT_LE(RegionManager::get_pool_size(64), IVY_POOL_MAX_SIZE);
+    EXPECT_GT(IVY_POOL_MAX_SIZE, 8 * gibibyte);
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include <climits>
+#include <vector>
+#include "gtest/gtest.h"
+#include "client/utils/memory_pool.h"
+
+namespace {
+    /**
+     * Fill the given number of blocks with 12-byte allocations, and return them in allocation order.
+     */
+    std::vector<void *> fill_blocks(FastMemoryPool &pool, MemoryPoolClient *client, int block_count) {
+        std::vector<void *> allocations;
+        for (size_t i = 0; i < block_count * (pool.get_chunk_size() / 12); i++) allocations.push_back(client->allocate(12));
+        return allocations;
+    }
+
+    /**
+     * Sweep every free slot set aside by MemoryPoolClient::begin_evacuation at once.
+     */
+    void sweep(MemoryPoolClient *client) {
+        int budget = INT_MAX;
+        EXPECT_FALSE(client->sweep_free_slots(budget));
+    }
+}
+
+TEST(PoolDefragmentationTest, DenseBlocksAreNotEvacuated) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    fill_blocks(pool, client, 3);
+
+    EXPECT_EQ(client->begin_evacuation(0.5f), 0);
+    EXPECT_EQ(client->get_evacuated_count(), 0);
+
+    pool.free_client(client);
+}
+
+TEST(PoolDefragmentationTest, EmptyBlocksAreGivenBackOnceSwept) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    std::vector<void *> allocations = fill_blocks(pool, client, 3);
+    size_t per_block = pool.get_chunk_size() / 12;
+    for (size_t i = 0; i < per_block; i++) client->deallocate(allocations[i], 12);
+
+    // The free slots of the block still chain through it until they are swept
+    EXPECT_EQ(client->begin_evacuation(0.5f), 1);
+    EXPECT_EQ(client->get_evacuated_count(), 1);
+    sweep(client);
+    EXPECT_EQ(client->get_evacuated_count(), 0);
+
+    // The first block is free again, so the pool hands it out before bumping a new one
+    EXPECT_EQ(pool.allocated(), 2 * pool.get_chunk_size());
+    EXPECT_EQ(pool.allocate(), allocations[0]);
+    EXPECT_EQ(pool.allocated(), 3 * pool.get_chunk_size());
+
+    pool.free_client(client);
+}
+
+TEST(PoolDefragmentationTest, SparseBlocksAreGivenBackOnceEvacuated) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    std::vector<void *> allocations = fill_blocks(pool, client, 3);
+    size_t per_block = pool.get_chunk_size() / 12;
+
+    // Keeping a single allocation in the first block
+    for (size_t i = 1; i < per_block; i++) client->deallocate(allocations[i], 12);
+    EXPECT_EQ(client->begin_evacuation(0.5f), 1);
+    sweep(client);
+    EXPECT_EQ(client->get_evacuated_count(), 1);
+    EXPECT_TRUE(client->is_evacuated(allocations[0]));
+    EXPECT_FALSE(client->is_evacuated(allocations[per_block]));
+
+    // The free slots of the block are no longer handed out
+    void *moved = client->allocate(12);
+    EXPECT_FALSE(client->is_evacuated(moved));
+
+    // Moving the last allocation out gives the block back to the pool
+    client->deallocate(allocations[0], 12);
+    EXPECT_EQ(client->get_evacuated_count(), 0);
+    EXPECT_EQ(pool.allocate(), allocations[0]);
+    EXPECT_EQ(client->get_used_memory(), (2 * per_block + 1) * 12);
+
+    pool.free_client(client);
+}
+
+TEST(PoolDefragmentationTest, FreeListsStayUsableAfterEvacuation) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    std::vector<void *> allocations = fill_blocks(pool, client, 3);
+    size_t per_block = pool.get_chunk_size() / 12;
+
+    // Freeing slots in both a sparse block and a dense one, then checking that only the latter are reused
+    for (size_t i = 1; i < per_block; i++) client->deallocate(allocations[i], 12);
+    client->deallocate(allocations[per_block + 1], 12);
+    client->deallocate(allocations[per_block + 3], 12);
+    client->begin_evacuation(0.5f);
+    sweep(client);
+    void *first = client->allocate(12), *second = client->allocate(12);
+    EXPECT_TRUE((first == allocations[per_block + 1] && second == allocations[per_block + 3]) ||
+                (first == allocations[per_block + 3] && second == allocations[per_block + 1]));
+
+    pool.free_client(client);
+}
+
+TEST(PoolDefragmentationTest, SparseSpanBlocksAreGivenBackOnceEvacuated) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    size_t chunk_size = pool.get_chunk_size(), per_block = chunk_size / 36;
+    char *span = (char *) client->allocate_span(3 * chunk_size), *cursor = span;
+    std::vector<void *> allocations;
+    for (size_t i = 0; i < 3 * chunk_size / 36; i++) allocations.push_back(client->allocate_in_span(cursor, 36));
+
+    // Keeping the first allocation of the first block, and the one crossing into the second block
+    for (size_t i = 1; i < per_block; i++) client->deallocate(allocations[i], 36);
+    EXPECT_EQ(client->begin_evacuation(0.5f), 1);
+    sweep(client);
+    EXPECT_TRUE(client->is_evacuated(allocations[0], 36));
+    EXPECT_TRUE(client->is_evacuated(allocations[per_block], 36));
+    EXPECT_FALSE(client->is_evacuated(allocations[per_block + 1], 36));
+
+    // The free slots of the span are no longer handed out
+    void *moved = client->allocate(36);
+    EXPECT_FALSE(client->is_evacuated(moved, 36));
+
+    // Moving both allocations out gives the block back to the pool, whatever the order
+    client->deallocate(allocations[per_block], 36);
+    EXPECT_EQ(client->get_evacuated_count(), 1);
+    client->deallocate(allocations[0], 36);
+    EXPECT_EQ(client->get_evacuated_count(), 0);
+    EXPECT_EQ(pool.allocate(), span);
+    EXPECT_EQ(pool.get_stats().span_block_count, 2);
+
+    pool.free_client(client);
+}
+
+TEST(PoolDefragmentationTest, SweepsStayWithinTheirBudget) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    std::vector<void *> allocations = fill_blocks(pool, client, 3);
+    size_t per_block = pool.get_chunk_size() / 12;
+    for (size_t i = 0; i < per_block; i++) client->deallocate(allocations[i], 12);
+    for (size_t i = per_block; i < 2 * per_block; i += 2) client->deallocate(allocations[i], 12);
+    EXPECT_EQ(client->begin_evacuation(0.75f), 2);
+
+    // Every free slot costs one unit of budget, whether it is dropped or handed back
+    size_t swept_count = 0;
+    for (bool is_sweeping = true; is_sweeping;) {
+        int budget = 100;
+        is_sweeping = client->sweep_free_slots(budget);
+        EXPECT_GE(budget, 0);
+        EXPECT_TRUE(!is_sweeping || budget == 0);
+        swept_count += 100 - budget;
+
+        // Allocations meanwhile never land in the selected blocks
+        void *allocation = client->allocate(12);
+        EXPECT_FALSE(client->is_evacuated(allocation));
+        client->deallocate(allocation, 12);
+    }
+    EXPECT_GE(swept_count, per_block + per_block / 2);
+
+    // The empty block was kept until the end of the sweep, then given back
+    EXPECT_EQ(client->get_evacuated_count(), 1);
+    EXPECT_EQ(pool.allocated(), 3 * pool.get_chunk_size());
+
+    pool.free_client(client);
+}
\ No newline at end of file
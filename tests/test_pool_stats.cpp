@@ -0,0 +1,126 @@
+#include <string>
+#include "gtest/gtest.h"
+#include "client/utils/memory_pool.h"
+
+namespace {
+    const PoolSizeClassStats *find_size_class(const PoolStats &stats, int size) {
+        for (const PoolSizeClassStats &size_class: stats.size_classes) {
+            if (size_class.size == size) return &size_class;
+        }
+        return nullptr;
+    }
+}
+
+TEST(PoolStatsTest, EmptyPoolHasNoSizeClass) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    PoolStats stats = pool.get_stats();
+
+    EXPECT_EQ(stats.allocated, 0);
+    EXPECT_EQ(stats.used, 0);
+    EXPECT_EQ(stats.client_count, 0);
+    EXPECT_TRUE(stats.size_classes.empty());
+}
+
+TEST(PoolStatsTest, SizeClassesAreSummedOverClients) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *first = pool.create_client(), *second = pool.create_client();
+    first->allocate(12);
+    second->allocate(12);
+    second->allocate(96);
+
+    PoolStats stats = pool.get_stats();
+    EXPECT_EQ(stats.client_count, 2);
+    EXPECT_EQ(stats.allocated, 3 * pool.get_chunk_size());
+    EXPECT_EQ(stats.used, 2 * 12 + 96);
+    ASSERT_EQ(stats.size_classes.size(), 2);
+    EXPECT_EQ(stats.size_classes[0].size, 12);
+    EXPECT_EQ(stats.size_classes[0].live_bytes, 24);
+    EXPECT_EQ(stats.size_classes[0].block_count, 2);
+    EXPECT_EQ(stats.size_classes[1].size, 96);
+    EXPECT_EQ(stats.size_classes[1].block_count, 1);
+
+    pool.free_client(first);
+    pool.free_client(second);
+}
+
+TEST(PoolStatsTest, HolesAreReportedAsFragmentation) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    void *slots[4];
+    for (void *&slot: slots) slot = client->allocate(24);
+    client->deallocate(slots[1], 24);
+
+    PoolStats stats = pool.get_stats();
+    const PoolSizeClassStats *size_class = find_size_class(stats, 24);
+    ASSERT_NE(size_class, nullptr);
+    EXPECT_EQ(size_class->live_bytes, 3 * 24);
+    EXPECT_EQ(size_class->hole_count, 1);
+    EXPECT_DOUBLE_EQ(size_class->fragmentation, 0.25);
+
+    // Reusing the hole defragments the size class again
+    client->allocate(24);
+    stats = pool.get_stats();
+    size_class = find_size_class(stats, 24);
+    ASSERT_NE(size_class, nullptr);
+    EXPECT_EQ(size_class->hole_count, 0);
+    EXPECT_DOUBLE_EQ(size_class->fragmentation, 0.0);
+
+    pool.free_client(client);
+}
+
+TEST(PoolStatsTest, GivenBackBlocksAreCountedAsFree) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    client->allocate_span(3 * pool.get_chunk_size());
+    client->allocate(12);
+    EXPECT_EQ(pool.get_stats().span_block_count, 3);
+    EXPECT_EQ(pool.get_stats().free_block_count, 0);
+
+    pool.free_client(client);
+    PoolStats stats = pool.get_stats();
+    EXPECT_EQ(stats.span_block_count, 0);
+    EXPECT_EQ(stats.free_block_count, 4);
+}
+
+TEST(PoolStatsTest, MergedClientsFillTheRoomLeftInTheirBlocks) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client(), *other = pool.create_client();
+    void *slot = client->allocate(24);
+    for (int i = 0; i < 10; i++) other->allocate(24);
+    size_t slot_count = pool.get_chunk_size() / 24;
+    EXPECT_EQ(pool.get_stats().unfilled_bytes, (2 * slot_count - 11) * 24);
+
+    // The block of the other client has less room left, so its end becomes free slots, which are handed out before the room left
+    client->merge(other);
+    pool.free_client(other);
+    PoolStats stats = pool.get_stats();
+    EXPECT_EQ(stats.client_count, 1);
+    EXPECT_EQ(stats.allocated, 2 * pool.get_chunk_size());
+    EXPECT_EQ(stats.used, 11 * 24);
+    EXPECT_EQ(stats.unfilled_bytes, (slot_count - 1) * 24);
+    const PoolSizeClassStats *size_class = find_size_class(stats, 24);
+    ASSERT_NE(size_class, nullptr);
+    EXPECT_EQ(size_class->hole_count, slot_count - 10);
+    for (size_t i = 0; i < slot_count - 10; i++) client->allocate(24);
+    EXPECT_EQ(pool.get_stats().unfilled_bytes, (slot_count - 1) * 24);
+    EXPECT_EQ(pool.get_stats().allocated, 2 * pool.get_chunk_size());
+    client->deallocate(slot, 24);
+
+    pool.free_client(client);
+}
+
+TEST(PoolStatsTest, JsonExportHasEveryField) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    client->allocate(12);
+
+    std::string json = pool.get_stats().to_json();
+    EXPECT_EQ(json.front(), '{');
+    EXPECT_EQ(json.back(), '}');
+    for (const char *field: {"\"allocated\":", "\"used\":12,", "\"free_block_count\":", "\"span_block_count\":", "\"unfilled_bytes\":", "\"client_count\":1,",
+                             "\"size_classes\":[{\"size\":12,\"live_bytes\":12,\"hole_count\":0,\"block_count\":1,\"fragmentation\":0.0000}]"}) {
+        EXPECT_NE(json.find(field), std::string::npos) << field;
+    }
+
+    pool.free_client(client);
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+#include "client/utils/memory_pool.h"
+
+namespace {
+    /**
+     * Allocate a few slots in every size class of the client, so that each of them holds at least a block.
+     */
+    void fill_size_classes(MemoryPoolClient *client) {
+        for (int size = 1; size <= 64; size++) {
+            for (int i = 0; i < 3; i++) client->allocate(size);
+        }
+        for (int size = 72; size <= 64 * 12; size += 12) {
+            for (int i = 0; i < 3; i++) client->allocate(size);
+        }
+    }
+}
+
+TEST(PoolTeardownTest, FreedClientGivesBackEverySizeClass) {
+    FastMemoryPool pool(1024 * 12 * 1024);
+    size_t baseline = pool.allocated();
+    MemoryPoolClient *client = pool.create_client();
+    fill_size_classes(client);
+    size_t block_count = (pool.allocated() - baseline) / pool.get_chunk_size();
+    EXPECT_EQ(block_count, 64 + 64 - 5);
+
+    pool.free_client(client);
+    EXPECT_EQ(pool.allocated(), baseline);
+    EXPECT_EQ(pool.get_stats().free_block_count, block_count);
+}
+
+TEST(PoolTeardownTest, FreedSpansAreGivenBack) {
+    FastMemoryPool pool(1024 * 12 * 1024);
+    MemoryPoolClient *resident = pool.create_client();
+    resident->allocate(12);
+    size_t baseline = pool.allocated();
+
+    MemoryPoolClient *client = pool.create_client();
+    char *cursor = (char *) client->allocate_span(5 * pool.get_chunk_size());
+    client->allocate_in_span(cursor, 96);
+    client->allocate(96);
+    pool.free_client(client);
+    EXPECT_EQ(pool.allocated(), baseline);
+
+    pool.free_client(resident);
+    EXPECT_EQ(pool.allocated(), 0);
+}
+
+TEST(PoolTeardownTest, GivenBackBlocksAreReusedBeforeBumpingNewOnes) {
+    FastMemoryPool pool(1024 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    fill_size_classes(client);
+    size_t peak = pool.allocated();
+    pool.free_client(client);
+
+    // Loading and freeing the same view over and over, as region paging does, does not grow the pool
+    for (int i = 0; i < 4; i++) {
+        client = pool.create_client();
+        fill_size_classes(client);
+        EXPECT_EQ(pool.allocated(), peak);
+        pool.free_client(client);
+        EXPECT_EQ(pool.allocated(), 0);
+    }
+    void *block = pool.allocate();
+    EXPECT_LT((char *) block, (char *) pool.to_pointer(0) + peak);
+    pool.deallocate(block);
+}
\ No newline at end of file
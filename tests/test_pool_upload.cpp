@@ -0,0 +1,115 @@
+#include <vector>
+#include "gtest/gtest.h"
+#include "client/utils/memory_pool.h"
+
+/**
+ * Records the ranges handed out by FastMemoryPool::upload_dirty_blocks instead of copying them to the GPU.
+ */
+class MockUploader final: public PoolUploader {
+public:
+    struct Range {
+        size_t offset, size;
+    };
+    std::vector<Range> ranges;
+
+    void upload(size_t offset, size_t size, const void *data) override {
+        ranges.push_back({offset, size});
+    }
+};
+
+TEST(PoolUploadTest, NothingToUploadOnANewPool) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MockUploader uploader;
+
+    EXPECT_EQ(pool.upload_dirty_blocks(uploader), 0);
+    EXPECT_TRUE(uploader.ranges.empty());
+}
+
+TEST(PoolUploadTest, ConsecutiveAllocationsAreMergedInASingleRange) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    MockUploader uploader;
+
+    // Two size classes, so two blocks handed out one after the other
+    client->allocate(12);
+    client->allocate(24);
+    EXPECT_EQ(pool.upload_dirty_blocks(uploader), 2 * pool.get_chunk_size());
+    ASSERT_EQ(uploader.ranges.size(), 1);
+    EXPECT_EQ(uploader.ranges[0].offset, 0);
+    EXPECT_EQ(uploader.ranges[0].size, 2 * pool.get_chunk_size());
+
+    pool.free_client(client);
+}
+
+TEST(PoolUploadTest, UploadedBlocksAreClean) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    MockUploader uploader;
+
+    client->allocate(12);
+    pool.upload_dirty_blocks(uploader);
+    uploader.ranges.clear();
+    EXPECT_EQ(pool.upload_dirty_blocks(uploader), 0);
+    EXPECT_TRUE(uploader.ranges.empty());
+
+    pool.free_client(client);
+}
+
+TEST(PoolUploadTest, InPlaceWritesOnlyUploadTheirBlock) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    MockUploader uploader;
+
+    client->allocate(12);
+    client->allocate(24);
+    auto *ptr = (uint32_t *) client->allocate(36);
+    pool.upload_dirty_blocks(uploader);
+    uploader.ranges.clear();
+
+    *ptr = 42;
+    pool.mark_dirty(ptr, sizeof(uint32_t));
+    EXPECT_EQ(pool.upload_dirty_blocks(uploader), pool.get_chunk_size());
+    ASSERT_EQ(uploader.ranges.size(), 1);
+    EXPECT_EQ(uploader.ranges[0].offset, 2 * pool.get_chunk_size());
+    EXPECT_EQ(uploader.ranges[0].size, pool.get_chunk_size());
+
+    pool.free_client(client);
+}
+
+TEST(PoolUploadTest, SeparateBlocksAreUploadedAsSeparateRanges) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    MockUploader uploader;
+
+    void *first = client->allocate(12);
+    client->allocate(24);
+    void *third = client->allocate(36);
+    pool.upload_dirty_blocks(uploader);
+    uploader.ranges.clear();
+
+    pool.mark_dirty(first, 12);
+    pool.mark_dirty(third, 36);
+    EXPECT_EQ(pool.upload_dirty_blocks(uploader), 2 * pool.get_chunk_size());
+    ASSERT_EQ(uploader.ranges.size(), 2);
+    EXPECT_EQ(uploader.ranges[0].offset, 0);
+    EXPECT_EQ(uploader.ranges[1].offset, 2 * pool.get_chunk_size());
+
+    pool.free_client(client);
+}
+
+TEST(PoolUploadTest, ClientMarksAllItsBlocks) {
+    FastMemoryPool pool(64 * 12 * 1024);
+    MemoryPoolClient *client = pool.create_client();
+    MockUploader uploader;
+
+    client->allocate(12);
+    client->allocate(24);
+    pool.upload_dirty_blocks(uploader);
+    uploader.ranges.clear();
+
+    client->mark_dirty();
+    EXPECT_EQ(pool.upload_dirty_blocks(uploader), 2 * pool.get_chunk_size());
+    ASSERT_EQ(uploader.ranges.size(), 1);
+
+    pool.free_client(client);
+}
\ No newline at end of file
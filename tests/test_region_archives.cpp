@@ -0,0 +1,83 @@
+#include <filesystem>
+#include <string>
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/file_generator.h"
+#include "pool_test.h"
+#include "tree_comparison.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    class RegionArchivesTest : public PoolTest {};
+
+    /**
+     * Chunks spread over several children of the root, mixing uniform chunks, palettes and voxel arrays.
+     */
+    void build_scene(WideTree &tree) {
+        for (int i = 0; i < 256; i++) {
+            Chunk chunk;
+            int material_count = 1 + i % 6;
+            for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+                if (i % 3 != 0 && (child_xyz + i) % 7 == 0) continue;
+                Voxel voxel{Material(1 + (child_xyz * 5 + i) % material_count)};
+                if (i % 4 == 1) voxel.set_normal(float(child_xyz % 3) - 1.0f, 1.0f, 0.0f);
+                chunk.set(child_xyz % 4, child_xyz / 4 % 4, child_xyz / 16, voxel);
+            }
+            tree.add_chunk(i * 97 % 64 * 64, i / 8 * 16, i * 61 % 64 * 64 + i % 4 * 4, &chunk);
+        }
+    }
+
+    /**
+     * An empty directory for the archives of a test, removed along with its content when the test ends.
+     */
+    struct ArchiveDirectory {
+        std::string path = testing::TempDir() + "ivy_region_archives_" + testing::UnitTest::GetInstance()->current_test_info()->name();
+
+        ArchiveDirectory() {
+            std::filesystem::remove_all(path);
+            std::filesystem::create_directories(path);
+        }
+
+        ~ArchiveDirectory() {
+            std::filesystem::remove_all(path);
+        }
+    };
+}
+
+TEST_F(RegionArchivesTest, StreamedRegionsMatchTheSavedOnes) {
+    WideTree tree;
+    build_scene(tree);
+    tree.compact();
+    ArchiveDirectory directory;
+    server::FileGenerator generator(directory.path.c_str());
+    ASSERT_TRUE(tree.save_archive(generator.get_region_path(1, 0, 2).c_str()));
+
+    // The whole region is streamed back, one subtree at a time
+    WideTree streamed_tree;
+    generator.generate_view(1, 0, 2, streamed_tree);
+    EXPECT_TRUE(have_same_voxels(tree, streamed_tree));
+    EXPECT_EQ(streamed_tree.get_voxel(33 * 64, 0, 61 * 64 + 4).material, tree.get_voxel(33 * 64, 0, 61 * 64 + 4).material);
+    EXPECT_NE(streamed_tree.get_voxel(33 * 64, 0, 61 * 64 + 4).material, AIR);
+    streamed_tree.set_voxel(33 * 64, 0, 61 * 64 + 4, {DEBUG_RED});
+    EXPECT_FALSE(have_same_voxels(tree, streamed_tree));
+
+    // Single subtrees can be streamed too, the others staying empty
+    WideTree partial_tree;
+    int child_xyz = __builtin_ctzll(((const Node *) client::memory_pool->to_pointer(tree.get_root_node()))->bitmap);
+    EXPECT_TRUE(generator.generate_subtree(1, 0, 2, child_xyz, partial_tree));
+    const Node *root = (const Node *) client::memory_pool->to_pointer(partial_tree.get_root_node());
+    EXPECT_EQ(root->bitmap, 0x1ul << child_xyz);
+    EXPECT_FALSE(generator.generate_subtree(1, 0, 2, 63, partial_tree));
+}
+
+TEST_F(RegionArchivesTest, RegionsWithoutArchiveStayEmpty) {
+    ArchiveDirectory directory;
+    server::FileGenerator generator(directory.path.c_str());
+    WideTree tree;
+    generator.generate_view(0, 0, 0, tree);
+    EXPECT_EQ(((const Node *) client::memory_pool->to_pointer(tree.get_root_node()))->bitmap, 0);
+    EXPECT_FALSE(generator.generate_subtree(0, 0, 0, 0, tree));
+}
\ No newline at end of file
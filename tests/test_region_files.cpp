@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "pool_test.h"
+#include "tree_comparison.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    /**
+     * Every test saves its region file in its own path, removed when the test ends.
+     */
+    class RegionFilesTest : public PoolTest {
+    protected:
+        std::string path = testing::TempDir() + "ivy_region_file_" + testing::UnitTest::GetInstance()->current_test_info()->name() + ".ivy";
+
+        void TearDown() override {
+            std::filesystem::remove(path);
+            PoolTest::TearDown();
+        }
+    };
+
+    /**
+     * A ground, a sphere and scattered voxels, mixing uniform chunks, palettes and voxel arrays over several children of the root.
+     */
+    void build_scene(WideTree &tree) {
+        client::utils::EditBatch batch;
+        batch.fill_box(0, 0, 0, 255, 7, 255, {STONE});
+        batch.fill_sphere(1500.0f, 40.0f, 900.0f, 30.0f, {DIRT});
+        for (int i = 0; i < 4096; i++) {
+            Voxel voxel{Material(1 + i % 6)};
+            if (i % 2 == 0) voxel.set_normal(float(i % 3) - 1.0f, 1.0f, 0.0f);
+            batch.set_voxel(i * 37 % 4096, 8 + i % 5, i * 91 % 4096, voxel);
+        }
+        tree.apply(batch);
+    }
+
+    /**
+     * Overwrite a field of the header of a region file, which starts with its magic, version, tree depth and voxel size on 4 bytes each.
+     */
+    void patch_header(const std::string &path, long offset, uint32_t value) {
+        FILE *file = fopen(path.c_str(), "r+b");
+        ASSERT_NE(file, nullptr);
+        ASSERT_EQ(fseek(file, offset, SEEK_SET), 0);
+        ASSERT_EQ(fwrite(&value, sizeof(value), 1, file), 1);
+        ASSERT_EQ(fclose(file), 0);
+    }
+
+    bool is_empty(const WideTree &tree) {
+        return ((const Node *) client::memory_pool->to_pointer(tree.get_root_node()))->bitmap == 0;
+    }
+}
+
+TEST_F(RegionFilesTest, LoadedRegionsHoldEveryVoxel) {
+    WideTree tree;
+    build_scene(tree);
+    tree.compact();
+    ASSERT_TRUE(tree.save(path.c_str()));
+
+    WideTree loaded_tree;
+    ASSERT_TRUE(loaded_tree.load(path.c_str()));
+    EXPECT_TRUE(have_same_voxels(tree, loaded_tree));
+    EXPECT_EQ(loaded_tree.get_voxel(100, 7, 100).material, STONE);
+    EXPECT_EQ(loaded_tree.get_voxel(1500, 40, 900).material, DIRT);
+
+    // The loaded tree can be edited, and saved again
+    loaded_tree.set_voxel(100, 7, 100, {GRASS});
+    EXPECT_EQ(loaded_tree.get_voxel(100, 7, 100).material, GRASS);
+    EXPECT_FALSE(have_same_voxels(tree, loaded_tree));
+    ASSERT_TRUE(loaded_tree.save(path.c_str()));
+    WideTree reloaded_tree;
+    ASSERT_TRUE(reloaded_tree.load(path.c_str()));
+    EXPECT_TRUE(have_same_voxels(loaded_tree, reloaded_tree));
+}
+
+TEST_F(RegionFilesTest, MissingFilesAreNotLoaded) {
+    WideTree tree;
+    EXPECT_FALSE(tree.load(path.c_str()));
+    EXPECT_TRUE(is_empty(tree));
+}
+
+TEST_F(RegionFilesTest, TruncatedFilesAreRejected) {
+    WideTree tree;
+    build_scene(tree);
+    ASSERT_TRUE(tree.save(path.c_str()));
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - sizeof(Voxel));
+    WideTree loaded_tree;
+    EXPECT_FALSE(loaded_tree.load(path.c_str()));
+    EXPECT_TRUE(is_empty(loaded_tree));
+
+    // Down to files shorter than their header
+    std::filesystem::resize_file(path, 16);
+    EXPECT_FALSE(loaded_tree.load(path.c_str()));
+    EXPECT_TRUE(is_empty(loaded_tree));
+}
+
+TEST_F(RegionFilesTest, FilesOfAnotherTreeLayoutAreRejected) {
+    WideTree tree;
+    build_scene(tree);
+    ASSERT_TRUE(tree.save(path.c_str()));
+
+    // Another tree depth, then another voxel size, then the layout of this build again
+    WideTree loaded_tree;
+    patch_header(path, 8, IVY_REGION_TREE_DEPTH + 1);
+    EXPECT_FALSE(loaded_tree.load(path.c_str()));
+    patch_header(path, 8, IVY_REGION_TREE_DEPTH);
+    patch_header(path, 12, sizeof(Voxel) == 1 ? 2 : 1);
+    EXPECT_FALSE(loaded_tree.load(path.c_str()));
+    EXPECT_TRUE(is_empty(loaded_tree));
+    patch_header(path, 12, sizeof(Voxel));
+    ASSERT_TRUE(loaded_tree.load(path.c_str()));
+    EXPECT_TRUE(have_same_voxels(tree, loaded_tree));
+}
\ No newline at end of file
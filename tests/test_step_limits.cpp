@@ -0,0 +1,92 @@
+#include <algorithm>
+#include "gtest/gtest.h"
+#include "client/utils/cpu_tracer.h"
+#include "client/utils/step_histogram.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "bumpy_ground_test.h"
+
+using client::utils::CpuImage;
+using client::utils::CpuTracer;
+using client::utils::StepHistogram;
+using client::utils::TraceStats;
+
+namespace {
+    /**
+     * The ground of BumpyGroundTest, rendered with step limits, see CpuTracer::set_step_limits.
+     */
+    class StepLimitsTest : public BumpyGroundTest {
+    protected:
+        TraceStats render(CpuImage &image, int dda_step_limit, int tree_step_limit, bool use_packets) const {
+            CpuTracer tracer(*tree);
+            tracer.set_step_limits(dda_step_limit, tree_step_limit);
+            return trace(tracer, image, use_packets);
+        }
+    };
+}
+
+TEST_F(StepLimitsTest, NoLimitTruncatesNothing) {
+    CpuImage image;
+    TraceStats stats = render(image, 0, 0, false);
+    EXPECT_EQ(stats.truncated_count, 0);
+    ASSERT_EQ(image.step_counts.size(), size_t(width * height));
+    EXPECT_GT(*std::max_element(image.step_counts.begin(), image.step_counts.end()), 64);
+
+    // A ray takes at least one DDA step per hit check, and the histogram of the frame sees all of them
+    uint64_t step_count = 0;
+    for (uint32_t steps: image.step_counts) step_count += steps;
+    EXPECT_GE(step_count, stats.dda_steps);
+    StepHistogram histogram;
+    histogram.add(image.step_counts.data(), image.step_counts.size());
+    EXPECT_EQ(histogram.pixel_count, image.step_counts.size());
+    EXPECT_EQ(histogram.step_count, step_count);
+}
+
+TEST_F(StepLimitsTest, LimitsCapEveryRay) {
+    CpuImage image, limited_image;
+    render(image, 0, 0, false);
+    const int dda_step_limit = 24, tree_step_limit = 8;
+    TraceStats stats = render(limited_image, dda_step_limit, tree_step_limit, false);
+    EXPECT_GT(stats.truncated_count, 0);
+    for (uint32_t steps: limited_image.step_counts) EXPECT_LE(steps, uint32_t(dda_step_limit + tree_step_limit));
+
+    // Truncated rays count as misses, and the other ones still hit what they hit without limits
+    uint64_t lost_hit_count = 0;
+    for (size_t i = 0; i < image.materials.size(); i++) {
+        if (limited_image.materials[i] == image.materials[i]) continue;
+        EXPECT_EQ(limited_image.materials[i], AIR) << "pixel " << i;
+        lost_hit_count += 1;
+    }
+    EXPECT_GT(lost_hit_count, 0);
+    EXPECT_LE(lost_hit_count, stats.truncated_count);
+
+    // Packets truncate the same rays as single rays
+    CpuImage packet_image;
+    TraceStats packet_stats = render(packet_image, dda_step_limit, tree_step_limit, true);
+    EXPECT_EQ(packet_image.materials, limited_image.materials);
+    EXPECT_EQ(packet_stats.truncated_count, stats.truncated_count);
+    for (uint32_t steps: packet_image.step_counts) EXPECT_LE(steps, uint32_t(dda_step_limit + tree_step_limit));
+}
+
+TEST(StepHistogramTest, BucketsGrowExponentially) {
+    StepHistogram histogram;
+    for (uint32_t steps: {0u, 1u, 2u, 3u, 4u, 7u, 8u, 100u}) histogram.add(steps);
+    EXPECT_EQ(histogram.counts[0], 1);
+    EXPECT_EQ(histogram.counts[1], 1);
+    EXPECT_EQ(histogram.counts[2], 2);
+    EXPECT_EQ(histogram.counts[3], 2);
+    EXPECT_EQ(histogram.counts[4], 1);
+    EXPECT_EQ(histogram.counts[7], 1);
+    EXPECT_EQ(StepHistogram::get_bucket_min(7), 64);
+    EXPECT_EQ(histogram.max_steps, 100);
+
+    // Percentiles are rounded up to the end of their bucket, but never beyond the largest count
+    EXPECT_EQ(histogram.get_percentile(50), 3);
+    EXPECT_EQ(histogram.get_percentile(75), 7);
+    EXPECT_EQ(histogram.get_percentile(100), 100);
+
+    // The last bucket is open-ended
+    histogram.add(UINT32_MAX);
+    EXPECT_EQ(histogram.counts[IVY_STEP_HISTOGRAM_SIZE - 1], 1);
+    EXPECT_EQ(histogram.get_percentile(100), UINT32_MAX);
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "pool_test.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    class TreeDeduplicationTest : public PoolTest {};
+
+    /**
+     * A chunk with a few materials, so that it is stored with an array rather than as a LOD leaf.
+     */
+    Chunk make_chunk(int seed) {
+        Chunk chunk;
+        for (int z = 0; z < IVY_NODE_WIDTH; z++) {
+            for (int y = 0; y < IVY_NODE_WIDTH; y++) {
+                for (int x = 0; x < IVY_NODE_WIDTH; x++) chunk.set(x, y, z, {Material((x + y + z + seed) % 3 == 0 ? AIR : STONE + (x + seed) % 3)});
+            }
+        }
+        return chunk;
+    }
+
+    /**
+     * Fill the cube of the given width at (dx, dy, dz) with copies of the same chunk.
+     */
+    void fill(WideTree &tree, int dx, int dy, int dz, int width, Chunk chunk) {
+        for (int z = 0; z < width; z += IVY_NODE_WIDTH) {
+            for (int y = 0; y < width; y += IVY_NODE_WIDTH) {
+                for (int x = 0; x < width; x += IVY_NODE_WIDTH) tree.add_chunk(dx + x, dy + y, dz + z, &chunk);
+            }
+        }
+    }
+
+    Material get_voxel(const WideTree &tree, int dx, int dy, int dz) {
+        const Node *node = (Node *) client::memory_pool->to_pointer(tree.get_root_node());
+        for (long node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH; ; node_width /= IVY_NODE_WIDTH) {
+            int child_x = int(dx / node_width), child_y = int(dy / node_width), child_z = int(dz / node_width);
+            dx -= int(child_x * node_width);
+            dy -= int(child_y * node_width);
+            dz -= int(child_z * node_width);
+            int child_xyz = int(child_x + child_y * IVY_NODE_WIDTH + child_z * IVY_NODE_WIDTH * IVY_NODE_WIDTH);
+            if ((node->bitmap & (0x1ul << child_xyz)) == 0) return AIR;
+            if ((node->header >> 30) != 0b00u) return client::utils::get_leaf_voxel(*node, child_xyz).material;
+            int child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
+            node = (Node *) client::memory_pool->to_pointer(node->header & ~(0b11u << 30)) + child_id;
+        }
+    }
+
+    /**
+     * Compare every voxel of the cube of the given width at (dx, dy, dz) with the chunk it was filled with.
+     */
+    bool is_filled_with(const WideTree &tree, int dx, int dy, int dz, int width, Chunk chunk) {
+        for (int z = 0; z < width; z++) {
+            for (int y = 0; y < width; y++) {
+                for (int x = 0; x < width; x++) {
+                    Material expected = chunk.get(x % IVY_NODE_WIDTH, y % IVY_NODE_WIDTH, z % IVY_NODE_WIDTH).material;
+                    if (get_voxel(tree, dx + x, dy + y, dz + z) != expected) return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+TEST_F(TreeDeduplicationTest, IdenticalSubtreesAreStoredOnce) {
+    auto *tree = new WideTree();
+    Chunk chunk = make_chunk(0);
+    fill(*tree, 0, 0, 0, 64, chunk);
+    fill(*tree, 256, 0, 0, 64, chunk);
+    size_t used = client::memory_pool->used();
+
+    size_t saved = tree->deduplicate();
+    EXPECT_GT(saved, 0);
+    EXPECT_EQ(client::memory_pool->used(), used - saved);
+    EXPECT_TRUE(is_filled_with(*tree, 0, 0, 0, 64, chunk));
+    EXPECT_TRUE(is_filled_with(*tree, 256, 0, 0, 64, chunk));
+
+    // A second pass has nothing left to share
+    size_t used_once = client::memory_pool->used();
+    tree->deduplicate();
+    EXPECT_EQ(client::memory_pool->used(), used_once);
+    delete tree;
+}
+
+TEST_F(TreeDeduplicationTest, EditsOnlyChangeTheirOwnSubtree) {
+    auto *tree = new WideTree();
+    Chunk chunk = make_chunk(0), other_chunk = make_chunk(1);
+    fill(*tree, 0, 0, 0, 64, chunk);
+    fill(*tree, 256, 0, 0, 64, chunk);
+    tree->deduplicate();
+
+    fill(*tree, 256, 0, 0, 16, other_chunk);
+    EXPECT_TRUE(is_filled_with(*tree, 0, 0, 0, 64, chunk));
+    EXPECT_TRUE(is_filled_with(*tree, 256, 0, 0, 16, other_chunk));
+    EXPECT_TRUE(is_filled_with(*tree, 256 + 16, 0, 0, 16, chunk));
+    EXPECT_TRUE(is_filled_with(*tree, 256 + 32, 32, 32, 32, chunk));
+
+    // Overwriting a single shared leaf array leaves its other references untouched
+    Chunk air;
+    for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) air.set(i % 4, i / 4 % 4, i / 16, {AIR});
+    tree->add_chunk(4, 0, 0, &air);
+    EXPECT_EQ(get_voxel(*tree, 5, 0, 0), AIR);
+    EXPECT_TRUE(is_filled_with(*tree, 0, 0, 0, 4, chunk));
+    EXPECT_TRUE(is_filled_with(*tree, 8, 0, 0, 4, chunk));
+    delete tree;
+}
+
+TEST_F(TreeDeduplicationTest, CompactingWritesEveryReferenceAgain) {
+    auto *tree = new WideTree();
+    Chunk chunk = make_chunk(2);
+    fill(*tree, 0, 0, 0, 64, chunk);
+    tree->compact();
+    size_t used = client::memory_pool->used();
+    tree->deduplicate();
+    EXPECT_LT(client::memory_pool->used(), used);
+
+    tree->compact();
+    EXPECT_EQ(client::memory_pool->used(), used);
+    EXPECT_TRUE(is_filled_with(*tree, 0, 0, 0, 64, chunk));
+    delete tree;
+}
\ No newline at end of file
@@ -0,0 +1,319 @@
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "pool_test.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    class TreeEditingTest : public PoolTest {};
+
+    /**
+     * Counts the ranges handed out by FastMemoryPool::upload_dirty_blocks.
+     */
+    class CountingUploader final : public PoolUploader {
+    public:
+        size_t range_count = 0;
+
+        void upload(size_t offset, size_t size, const void *data) override {
+            range_count++;
+        }
+    };
+
+    /**
+     * @return The terminal node holding the chunk at the given position, or nullptr if there is none.
+     */
+    const Node *get_leaf(const WideTree &tree, int dx, int dy, int dz) {
+        const Node *node = (Node *) client::memory_pool->to_pointer(tree.get_root_node());
+        for (long node_width = IVY_REGION_WIDTH / IVY_NODE_WIDTH; node_width >= IVY_NODE_WIDTH; node_width /= IVY_NODE_WIDTH) {
+            int child_xyz = int((dx / node_width) % IVY_NODE_WIDTH + (dy / node_width) % IVY_NODE_WIDTH * IVY_NODE_WIDTH +
+                                (dz / node_width) % IVY_NODE_WIDTH * IVY_NODE_WIDTH_SQUARED);
+            if ((node->bitmap & (0x1ul << child_xyz)) == 0) return nullptr;
+            int child_id = __builtin_popcountll(node->bitmap & ~(UINT64_MAX << child_xyz));
+            node = (Node *) client::memory_pool->to_pointer(node->header & ~(0b11u << 30)) + child_id;
+        }
+        return node;
+    }
+
+    /**
+     * Collect the index of every array of a subtree, depth-first, to tell which ones were moved.
+     */
+    void collect_arrays(const Node *node, std::vector<uint32_t> &arrays) {
+        if (node->bitmap == 0 || (node->header >> 30) == 0b11u) return;
+        arrays.push_back(node->header & ~(0b11u << 30));
+        if ((node->header >> 30) != 0b00u) return;
+        const Node *child_array = (Node *) client::memory_pool->to_pointer(node->header & ~(0b11u << 30));
+        for (int i = 0; i < __builtin_popcountll(node->bitmap); i++) collect_arrays(&child_array[i], arrays);
+    }
+
+    bool is_in_sphere(int x, int y, int z, float center_x, float center_y, float center_z, float radius) {
+        float distance_x = float(x) + 0.5f - center_x, distance_y = float(y) + 0.5f - center_y, distance_z = float(z) + 0.5f - center_z;
+        return distance_x * distance_x + distance_y * distance_y + distance_z * distance_z <= radius * radius;
+    }
+}
+
+TEST_F(TreeEditingTest, SetVoxelsCanBeReadBack) {
+    WideTree tree;
+    tree.set_voxel(0, 0, 0, {STONE});
+    tree.set_voxel(1, 2, 3, {DIRT});
+    tree.set_voxel(4095, 4095, 4095, {GRASS});
+    tree.set_voxel(4096, 0, 0, {GRASS});
+    tree.set_voxel(-1, 0, 0, {GRASS});
+
+    EXPECT_EQ(tree.get_voxel(0, 0, 0).material, STONE);
+    EXPECT_EQ(tree.get_voxel(1, 2, 3).material, DIRT);
+    EXPECT_EQ(tree.get_voxel(4095, 4095, 4095).material, GRASS);
+    EXPECT_EQ(tree.get_voxel(1, 0, 0).material, AIR);
+    EXPECT_EQ(tree.get_voxel(1000, 0, 0).material, AIR);
+    EXPECT_EQ(tree.get_voxel(4096, 0, 0).material, AIR);
+}
+
+TEST_F(TreeEditingTest, UniformLeavesAreSplitAndMerged) {
+    WideTree tree;
+    tree.fill_box(8, 8, 8, 11, 11, 11, {STONE});
+    EXPECT_EQ(get_leaf(tree, 8, 8, 8)->header >> 30, 0b11u);
+
+    // A different voxel gives the leaf an array, and restoring it turns the leaf back into a LOD leaf
+    size_t used = client::memory_pool->used();
+    tree.set_voxel(9, 9, 9, {DIRT});
+    EXPECT_NE(get_leaf(tree, 8, 8, 8)->header >> 30, 0b11u);
+    EXPECT_EQ(tree.get_voxel(9, 9, 9).material, DIRT);
+    EXPECT_EQ(tree.get_voxel(10, 9, 9).material, STONE);
+    tree.set_voxel(9, 9, 9, {STONE});
+    EXPECT_EQ(get_leaf(tree, 8, 8, 8)->header >> 30, 0b11u);
+    EXPECT_EQ(client::memory_pool->used(), used);
+}
+
+TEST_F(TreeEditingTest, EmptiedLeavesAreRemoved) {
+    WideTree tree;
+    size_t used = client::memory_pool->used();
+    tree.set_voxel(100, 200, 300, {STONE});
+    tree.set_voxel(101, 200, 300, {STONE});
+    EXPECT_GT(client::memory_pool->used(), used);
+
+    tree.set_voxel(100, 200, 300, {AIR});
+    EXPECT_NE(get_leaf(tree, 100, 200, 300), nullptr);
+    tree.set_voxel(101, 200, 300, {AIR});
+    EXPECT_EQ(get_leaf(tree, 100, 200, 300), nullptr);
+
+    // The whole path is gone, down to the root
+    EXPECT_EQ(((Node *) client::memory_pool->to_pointer(tree.get_root_node()))->bitmap, 0);
+    EXPECT_EQ(client::memory_pool->used(), used);
+}
+
+TEST_F(TreeEditingTest, SpheresOnlyChangeTheirVoxels) {
+    WideTree tree;
+    tree.fill_box(0, 0, 0, 63, 63, 31, {STONE});
+    tree.fill_sphere(32, 32, 32, 10.5f, {DIRT});
+    tree.fill_sphere(30, 33, 35, 4.0f, {AIR});
+    for (int z = 0; z < 64; z++) {
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++) {
+                Material expected = z < 32 ? STONE : AIR;
+                if (is_in_sphere(x, y, z, 32, 32, 32, 10.5f)) expected = DIRT;
+                if (is_in_sphere(x, y, z, 30, 33, 35, 4.0f)) expected = AIR;
+                ASSERT_EQ(tree.get_voxel(x, y, z).material, expected) << x << " " << y << " " << z;
+            }
+        }
+    }
+}
+
+TEST_F(TreeEditingTest, EditsOnlyMarkTheirPathDirty) {
+    WideTree tree;
+    tree.fill_box(0, 0, 0, 255, 255, 15, {STONE});
+    tree.compact();
+    CountingUploader uploader;
+    client::memory_pool->upload_dirty_blocks(uploader);
+
+    // A single edit changes the leaf and the arrays on its path, which are a few blocks at most
+    uploader.range_count = 0;
+    tree.set_voxel(130, 70, 3, {DIRT});
+    size_t uploaded = client::memory_pool->upload_dirty_blocks(uploader);
+    EXPECT_GT(uploaded, 0);
+    EXPECT_LE(uploaded, IVY_REGION_TREE_DEPTH * client::memory_pool->get_chunk_size());
+    EXPECT_LE(uploader.range_count, IVY_REGION_TREE_DEPTH);
+    EXPECT_EQ(tree.get_voxel(130, 70, 3).material, DIRT);
+}
+
+TEST_F(TreeEditingTest, EditsLeaveSharedSubtreesUntouched) {
+    WideTree tree;
+    tree.fill_box(0, 0, 0, 63, 63, 63, {STONE});
+    tree.fill_sphere(20, 20, 20, 12, {DIRT});
+    tree.fill_box(256, 0, 0, 256 + 63, 63, 63, {STONE});
+    tree.fill_sphere(256 + 20, 20, 20, 12, {DIRT});
+    EXPECT_GT(tree.deduplicate(), 0);
+
+    tree.fill_sphere(20, 20, 20, 5, {AIR});
+    EXPECT_EQ(tree.get_voxel(20, 20, 20).material, AIR);
+    EXPECT_EQ(tree.get_voxel(256 + 20, 20, 20).material, DIRT);
+    EXPECT_EQ(tree.get_voxel(256 + 20, 20, 27).material, DIRT);
+    EXPECT_EQ(tree.get_voxel(256 + 40, 40, 40).material, STONE);
+}
+
+TEST_F(TreeEditingTest, BatchesMatchSingleEdits) {
+    WideTree tree, other_tree;
+    client::utils::EditBatch batch;
+    batch.fill_box(0, 0, 0, 40, 40, 20, {STONE});
+    EXPECT_EQ(batch.size(), 41 * 41 * 21);
+    batch.fill_sphere(20, 20, 20, 9.5f, {DIRT});
+    batch.set_voxel(20, 20, 20, {GRASS});
+    size_t edit_count = batch.size();
+    batch.set_voxel(4096, 0, 0, {GRASS});
+    EXPECT_EQ(batch.size(), edit_count);
+    tree.apply(batch);
+    EXPECT_EQ(batch.size(), 0);
+
+    // The same edits, one voxel after the other
+    other_tree.fill_box(0, 0, 0, 40, 40, 20, {STONE});
+    for (int z = 0; z < 41; z++) {
+        for (int y = 0; y < 41; y++) {
+            for (int x = 0; x < 41; x++) {
+                if (is_in_sphere(x, y, z, 20, 20, 20, 9.5f)) other_tree.set_voxel(x, y, z, {DIRT});
+            }
+        }
+    }
+    other_tree.set_voxel(20, 20, 20, {GRASS});
+    for (int z = 0; z < 48; z++) {
+        for (int y = 0; y < 48; y++) {
+            for (int x = 0; x < 48; x++) {
+                ASSERT_EQ(tree.get_voxel(x, y, z).material, other_tree.get_voxel(x, y, z).material) << x << " " << y << " " << z;
+            }
+        }
+    }
+    EXPECT_EQ(tree.get_voxel(20, 20, 20).material, GRASS);
+}
+
+TEST_F(TreeEditingTest, BatchesAllocateEachArrayOnce) {
+    WideTree tree;
+    size_t used = client::memory_pool->used();
+    client::utils::EditBatch batch;
+    batch.fill_sphere(100, 100, 100, 32, {STONE});
+    batch.fill_sphere(100, 100, 100, 16, {AIR});
+    tree.apply(batch);
+    EXPECT_EQ(tree.get_voxel(100, 100, 100).material, AIR);
+    EXPECT_EQ(tree.get_voxel(100, 100, 125).material, STONE);
+
+    // No array was reallocated, so the pool has no hole left behind
+    for (const PoolSizeClassStats &size_class: client::memory_pool->get_stats().size_classes) EXPECT_EQ(size_class.hole_count, 0) << size_class.size;
+
+    // Emptying the sphere in a second batch frees the whole tree
+    batch.fill_box(68, 68, 68, 132, 132, 132, {AIR});
+    tree.apply(batch);
+    EXPECT_EQ(((Node *) client::memory_pool->to_pointer(tree.get_root_node()))->bitmap, 0);
+    EXPECT_EQ(client::memory_pool->used(), used);
+}
+
+TEST_F(TreeEditingTest, DefragmentationReclaimsTheSpansOfCompactedTrees) {
+    WideTree tree;
+    client::utils::EditBatch batch;
+    for (int z = 0; z < 256; z++) {
+        for (int x = 0; x < 256; x++) batch.fill_box(x, 0, z, x, 2 + (x * 7 + z * 13) % 9, z, {(x + z) % 3 == 0 ? DIRT : STONE});
+    }
+    tree.apply(batch);
+    tree.compact();
+    EXPECT_FALSE(tree.defragment_step());  // The partly filled end of the span is not worth moving
+
+    // Clearing most of the ground leaves the spans of the compacted tree sparse, and only defragmentation can give them back
+    tree.fill_box(0, 0, 0, 223, 15, 255, {AIR});
+    size_t allocated = client::memory_pool->allocated();
+    int step_count = 0;
+    while (tree.defragment_step() && step_count < 1000) step_count++;
+    EXPECT_LT(step_count, 1000);
+    EXPECT_LT(client::memory_pool->allocated(), allocated / 2);
+
+    // The remaining voxels moved out of the spans along the way
+    for (int z = 0; z < 256; z += 5) {
+        for (int x = 224; x < 256; x++) {
+            EXPECT_EQ(tree.get_voxel(x, 2, z).material, (x + z) % 3 == 0 ? DIRT : STONE);
+            EXPECT_EQ(tree.get_voxel(x, 11, z).material, AIR);
+        }
+    }
+    EXPECT_EQ(tree.get_voxel(100, 1, 100).material, AIR);
+}
+
+TEST_F(TreeEditingTest, DefragmentationStepsStayWithinTheirBudget) {
+    WideTree tree;
+    client::utils::EditBatch batch;
+    for (int z = 0; z < 256; z++) {
+        for (int x = 0; x < 256; x++) batch.fill_box(x, 0, z, x, 2 + (x * 7 + z * 13) % 9, z, {(x + z) % 3 == 0 ? DIRT : STONE});
+    }
+    tree.apply(batch);
+    tree.compact();
+    tree.fill_box(0, 0, 0, 191, 15, 255, {AIR});
+    const Node *root = (Node *) client::memory_pool->to_pointer(tree.get_root_node());
+    std::vector<uint32_t> arrays;
+    collect_arrays(root, arrays);
+
+    // Each step moves at most as many arrays as its budget, and the pass takes about as many steps as there are nodes and free slots
+    const int budget = 64;
+    size_t step_count = 0, moved_count = 0;
+    for (bool is_defragmenting = true; is_defragmenting && step_count < 100000; step_count++) {
+        is_defragmenting = tree.defragment_step(budget);
+        std::vector<uint32_t> moved_arrays;
+        collect_arrays(root, moved_arrays);
+        ASSERT_EQ(moved_arrays.size(), arrays.size());
+        size_t step_moved_count = 0;
+        for (size_t i = 0; i < arrays.size(); i++) step_moved_count += moved_arrays[i] != arrays[i];
+        EXPECT_LE(step_moved_count, size_t(budget));
+        moved_count += step_moved_count;
+        arrays = moved_arrays;
+    }
+    EXPECT_GT(moved_count, 0);
+    EXPECT_GE(step_count, arrays.size() / budget);
+    EXPECT_LT(step_count, 100000);
+
+    // Edits between two steps are picked up by the rest of the pass
+    tree.fill_box(0, 0, 0, 255, 15, 191, {AIR});
+    tree.set_voxel(10, 20, 30, {GRASS});
+    step_count = 0;
+    while (tree.defragment_step(budget) && step_count < 100000) {
+        if (step_count++ == 3) tree.fill_box(250, 0, 250, 255, 15, 255, {DIRT});
+    }
+    EXPECT_GT(step_count, 3);
+    EXPECT_EQ(tree.get_voxel(10, 20, 30).material, GRASS);
+    EXPECT_EQ(tree.get_voxel(252, 14, 252).material, DIRT);
+    for (int z = 192; z < 250; z += 3) {
+        for (int x = 192; x < 250; x++) EXPECT_EQ(tree.get_voxel(x, 2, z).material, (x + z) % 3 == 0 ? DIRT : STONE);
+    }
+}
+
+TEST_F(TreeEditingTest, ConcurrentBuildsMergeTheirShardSubpools) {
+    WideTree tree;
+    size_t client_count = client::memory_pool->get_stats().client_count;
+    ASSERT_TRUE(tree.begin_concurrent_build());
+    std::vector<std::thread> threads;
+    for (int thread_id = 0; thread_id < 4; thread_id++) {
+        threads.emplace_back([&tree, thread_id]() {
+            Chunk chunk;
+            for (int z = thread_id * 4; z < 512; z += 16) {
+                for (int x = 0; x < 512; x += 4) {
+                    for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) chunk.set(i % 4, i / 4 % 4, i / 16, {(x + z + i) % 5 == 0 ? DIRT : STONE});
+                    tree.add_chunk(x, 0, z, &chunk);
+                }
+            }
+        });
+    }
+    for (std::thread &thread: threads) thread.join();
+    EXPECT_EQ(client::memory_pool->get_stats().client_count, client_count + IVY_NODE_WIDTH_CUBED);
+    tree.end_concurrent_build();
+
+    // The shards leave no client behind, and at most one unfilled block per size class
+    PoolStats stats = client::memory_pool->get_stats();
+    EXPECT_EQ(stats.client_count, client_count);
+    EXPECT_LE(stats.unfilled_bytes, stats.size_classes.size() * client::memory_pool->get_chunk_size());
+    EXPECT_EQ(tree.get_voxel(5, 1, 7).material, (4 + 4 + 1 + 4 * 1 + 16 * 3) % 5 == 0 ? DIRT : STONE);
+    EXPECT_EQ(tree.get_voxel(5, 4, 7).material, AIR);
+
+    // Their arrays now belong to the tree, which can be defragmented without being compacted first
+    tree.fill_box(0, 0, 0, 447, 3, 511, {AIR});
+    size_t allocated = client::memory_pool->allocated();
+    int step_count = 0;
+    while (tree.defragment_step() && step_count < 1000) step_count++;
+    EXPECT_LT(step_count, 1000);
+    EXPECT_LT(client::memory_pool->allocated(), allocated);
+    EXPECT_EQ(tree.get_voxel(500, 3, 500).material, (500 + 500 + 4 * 3) % 5 == 0 ? DIRT : STONE);
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <cmath>
+#include <cstring>
+#include "gtest/gtest.h"
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+#include "server/generators/generator.h"
+#include "pool_test.h"
+
+using client::utils::Node;
+using client::utils::WideTree;
+
+namespace {
+    class VoxelNormalsTest : public PoolTest {};
+
+    /**
+     * @return The angle between the given direction and the normal of the voxel, in radians.
+     */
+    template<typename T>
+    float angle_to(const T &voxel, float x, float y, float z) {
+        float normal_x, normal_y, normal_z;
+        if (!voxel.get_normal(normal_x, normal_y, normal_z)) return float(M_PI);
+        float length = std::sqrt(x * x + y * y + z * z);
+        return std::acos(std::fmin(1.0f, (normal_x * x + normal_y * y + normal_z * z) / length));
+    }
+}
+
+TEST(NormalVoxelTest, NormalsAreQuantizedOnOneByte) {
+    EXPECT_EQ(sizeof(MaterialVoxel), 1);
+    EXPECT_EQ(sizeof(NormalVoxel), 2);
+
+    // Quantization steps are pi/15 for the polar angle and pi/8 for the azimuth, so the error stays below half their diagonal
+    const float directions[][3] = {{0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {0, -1, 0}, {1, 1, 1}, {-0.3f, 0.5f, 2}, {0.2f, -0.1f, -0.4f}};
+    for (auto &direction: directions) {
+        NormalVoxel voxel{STONE};
+        voxel.set_normal(direction[0], direction[1], direction[2]);
+        EXPECT_NE(voxel.normal, 0);
+        EXPECT_EQ(voxel.material, STONE);
+        EXPECT_LT(angle_to(voxel, direction[0], direction[1], direction[2]), 0.25f) << direction[0] << " " << direction[1] << " " << direction[2];
+    }
+}
+
+TEST(NormalVoxelTest, NullDirectionsRemoveTheNormal) {
+    NormalVoxel voxel{DIRT};
+    float x, y, z;
+    EXPECT_FALSE(voxel.get_normal(x, y, z));
+    voxel.set_normal(0, 1, 0);
+    EXPECT_TRUE(voxel.get_normal(x, y, z));
+    voxel.set_normal(0, 0, 0);
+    EXPECT_FALSE(voxel.get_normal(x, y, z));
+
+    MaterialVoxel material_voxel{DIRT};
+    material_voxel.set_normal(0, 1, 0);
+    EXPECT_FALSE(material_voxel.get_normal(x, y, z));
+}
+
+TEST_F(VoxelNormalsTest, LeavesKeepTheirNormals) {
+    if (!Voxel::has_normals) GTEST_SKIP() << "Voxels have no normal, see IVY_VOXEL_NORMALS";
+
+    // A uniform chunk, whose voxels all have the same normal, becomes a LOD leaf that keeps it
+    Chunk chunk;
+    for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) {
+        Voxel voxel{GRASS};
+        voxel.set_normal(1, 0, 2);
+        chunk.set(i % 4, i / 4 % 4, i / 16, voxel);
+    }
+    WideTree tree;
+    tree.add_chunk(0, 0, 0, &chunk);
+    const Node *node = (Node *) client::memory_pool->to_pointer(tree.get_root_node());
+    for (int depth = 1; depth < IVY_REGION_TREE_DEPTH; depth++) node = (Node *) client::memory_pool->to_pointer(node->header & ~(0b11u << 30));
+    EXPECT_EQ(node->header >> 30, 0b11u);
+    Voxel lod_voxel = client::utils::get_leaf_voxel(*node, 0), expected = chunk.get(0, 0, 0);
+    EXPECT_EQ(memcmp(&lod_voxel, &expected, sizeof(Voxel)), 0);
+    EXPECT_LT(angle_to(lod_voxel, 1, 0, 2), 0.25f);
+
+    // Voxels of the same material with different normals are not merged in a LOD leaf
+    for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) {
+        Voxel voxel{GRASS};
+        voxel.set_normal(i % 2 == 0 ? 1.0f : 0.0f, 0, 1);
+        chunk.set(i % 4, i / 4 % 4, i / 16, voxel);
+    }
+    tree.add_chunk(0, 0, 0, &chunk);
+    EXPECT_NE(node->header >> 30, 0b11u);
+    for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) {
+        Voxel voxel = client::utils::get_leaf_voxel(*node, i);
+        expected = chunk.get(i % 4, i / 4 % 4, i / 16);
+        EXPECT_EQ(memcmp(&voxel, &expected, sizeof(Voxel)), 0) << "voxel " << i;
+    }
+
+    // The voxels of other leaves are stored as they are
+    chunk.set(1, 0, 0, {STONE});
+    tree.add_chunk(0, 0, 0, &chunk);
+    EXPECT_NE(node->header >> 30, 0b11u);
+    for (int i = 0; i < IVY_NODE_WIDTH_CUBED; i++) {
+        Voxel voxel = client::utils::get_leaf_voxel(*node, i);
+        expected = chunk.get(i % 4, i / 4 % 4, i / 16);
+        EXPECT_EQ(memcmp(&voxel, &expected, sizeof(Voxel)), 0) << "voxel " << i;
+    }
+}
\ No newline at end of file
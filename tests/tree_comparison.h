@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstring>
+#include "client/client.h"
+#include "client/utils/wide_tree.h"
+
+/**
+ * Walk two subtrees side by side, wherever their arrays are in the pool.
+ * @return Whether every node has the same children in both, and every terminal node the same voxels, compared byte for byte.
+ */
+inline bool have_same_voxels(const client::utils::Node &node, const client::utils::Node &other_node) {
+    using client::utils::Node;
+    if (node.bitmap != other_node.bitmap || ((node.header >> 30) == 0b00u) != ((other_node.header >> 30) == 0b00u)) return false;
+    if (node.bitmap == 0) return true;
+    if ((node.header >> 30) != 0b00u) {
+        for (int child_xyz = 0; child_xyz < IVY_NODE_WIDTH_CUBED; child_xyz++) {
+            if ((node.bitmap & (0x1ul << child_xyz)) == 0) continue;
+            Voxel voxel = client::utils::get_leaf_voxel(node, child_xyz), other_voxel = client::utils::get_leaf_voxel(other_node, child_xyz);
+            if (memcmp(&voxel, &other_voxel, sizeof(Voxel)) != 0) return false;
+        }
+        return true;
+    }
+    auto *children = (const Node *) client::memory_pool->to_pointer(node.header & ~(0b11u << 30));
+    auto *other_children = (const Node *) client::memory_pool->to_pointer(other_node.header & ~(0b11u << 30));
+    for (int i = 0; i < __builtin_popcountll(node.bitmap); i++) {
+        if (!have_same_voxels(children[i], other_children[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * @return Whether both trees hold the same voxels, see the overload on nodes.
+ */
+inline bool have_same_voxels(const client::utils::WideTree &tree, const client::utils::WideTree &other_tree) {
+    return have_same_voxels(*(const client::utils::Node *) client::memory_pool->to_pointer(tree.get_root_node()),
+                            *(const client::utils::Node *) client::memory_pool->to_pointer(other_tree.get_root_node()));
+}
\ No newline at end of file